@@ -0,0 +1,112 @@
+#ifndef _PID_Q16_H_
+#define _PID_Q16_H_
+
+// Q16.16 定点 PID 和 PWM 占空比计算, 不用浮点.
+// 驱动 (project.c) 和用户态调参工具 (pid_tune.c) 共用同一份代码.
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+typedef int32_t s32;
+typedef int64_t s64;
+typedef uint32_t u32;
+#endif
+
+typedef s32 q16_t;
+
+#define Q16_SHIFT 16
+#define Q16_ONE (1 << Q16_SHIFT)
+#define Q16_FROM_INT(x) ((q16_t)((x) * Q16_ONE))
+// num / den, 编译期常量, 例如 Q16_RATIO(1, 20) = 0.05
+#define Q16_RATIO(num, den) ((q16_t)(((s64)(num) << Q16_SHIFT) / (den)))
+
+// PID 默认参数 (每个控制周期), 用 pid_tune 调整.
+// 驱动里的当前速度就是上一次的输出, kp 取 1 时输出每个周期正负交替 (电机反转),
+// 稳态靠积分项: ki * integral_max 要大于最大目标速度.
+// 下面这组在目标 1-100 时 8 个周期 (40ms) 内收敛, 输出不变号
+#define PID_DEFAULT_KP Q16_RATIO(1, 5)
+#define PID_DEFAULT_KI Q16_RATIO(1, 2)
+#define PID_DEFAULT_KD Q16_RATIO(1, 10)
+#define PID_DEFAULT_INTEGRAL_MAX Q16_FROM_INT(200)
+#define PID_DEFAULT_ERROR_THRESHOLD Q16_FROM_INT(100)
+
+#define PID_OUTPUT_MAX 100
+// 误差限幅, 转换成 Q16.16 前先限制, 目标速度来自用户态, 可能很大
+#define PID_ERROR_MAX (PID_OUTPUT_MAX * 2)
+
+// PWM参数
+#define PWM_PERIOD_NS 10000000  // PWM周期10ms
+#define MAX_DUTY_CYCLE_NS 9000000  // 最大占空比90%
+#define MIN_DUTY_CYCLE_NS 1000000  // 最小占空比10%
+// 速度每加 1 占空比增加的时间, 超出 q16_t 范围, 用 s64
+#define DUTY_STEP_NS_Q16 (((s64)(MAX_DUTY_CYCLE_NS - MIN_DUTY_CYCLE_NS) << Q16_SHIFT) / 100)
+
+struct pid_q16 {
+    q16_t kp;              // 比例系数
+    q16_t ki;              // 积分系数
+    q16_t kd;              // 微分系数
+    q16_t integral_max;    // 积分限幅值
+    q16_t error_threshold; // 积分分离阈值
+    q16_t integral;        // 积分项
+    q16_t prev_error;      // 上一次误差
+};
+
+static inline q16_t q16_clamp(s64 v, q16_t min, q16_t max)
+{
+    return v < min ? min : (v > max ? max : (q16_t)v);
+}
+
+// a * b, 四舍五入, 结果为 s64 以便累加后再限幅
+static inline s64 q16_mul(q16_t a, q16_t b)
+{
+    return ((s64)a * b + (1 << (Q16_SHIFT - 1))) >> Q16_SHIFT;
+}
+
+static inline void pid_q16_init(struct pid_q16 *pid, q16_t kp, q16_t ki, q16_t kd, q16_t integral_max,
+                                q16_t error_threshold)
+{
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->integral_max = integral_max;
+    pid->error_threshold = error_threshold;
+    pid->integral = 0;
+    pid->prev_error = 0;
+}
+
+// 一个控制周期: 返回 -100 .. 100 的速度
+static inline int pid_q16_update(struct pid_q16 *pid, int target_speed, int current_speed)
+{
+    s64 raw_error = (s64)target_speed - current_speed;
+    q16_t error = Q16_FROM_INT(raw_error < -PID_ERROR_MAX ? -PID_ERROR_MAX
+                               : (raw_error > PID_ERROR_MAX ? PID_ERROR_MAX : (int)raw_error));
+    q16_t derivative = error - pid->prev_error;
+    q16_t abs_error = error < 0 ? -error : error;
+    s64 output;
+
+    // 积分分离：仅在误差较小时使用积分项
+    if (abs_error < pid->error_threshold) {
+        // 积分限幅
+        pid->integral = q16_clamp((s64)pid->integral + error, -pid->integral_max, pid->integral_max);
+    } else {
+        // 误差较大时重置积分项
+        pid->integral = 0;
+    }
+
+    pid->prev_error = error;
+
+    // 计算PID输出
+    output = q16_mul(pid->kp, error) + q16_mul(pid->ki, pid->integral) + q16_mul(pid->kd, derivative);
+
+    // 限制输出范围, 向零取整
+    return q16_clamp(output, -Q16_FROM_INT(PID_OUTPUT_MAX), Q16_FROM_INT(PID_OUTPUT_MAX)) / Q16_ONE;
+}
+
+// 速度 (0-100) 对应的 PWM 占空比
+static inline u32 motor_duty_ns(int speed)
+{
+    return MIN_DUTY_CYCLE_NS + (u32)(((s64)speed * DUTY_STEP_NS_Q16) >> Q16_SHIFT);
+}
+
+#endif //_PID_Q16_H_
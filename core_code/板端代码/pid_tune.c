@@ -0,0 +1,146 @@
+// 用户态 PID 调参工具: 和驱动相同的定点代码 (pid_q16.h), 模拟驱动的控制周期,
+// 同时运行原来的浮点 PID 作为对照. 输出和目标方向相反时 (电机会反转) 返回失败.
+// 另外检查超出范围的目标速度 (来自用户态的坐标) 不会溢出, 输出仍在 -100..100.
+// 用法: ./pid_tune [target kp ki kd [integral_max error_threshold [ticks]]]
+// 例如: ./pid_tune 80 0.2 0.5 0.1 200 100 50
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "pid_q16.h"
+
+struct pid_float {
+    float kp, ki, kd;
+    float integral_max;
+    float error_threshold;
+    float integral;
+    float prev_error;
+};
+
+// 定点化之前驱动中的 calculate_pid
+static int pid_float_update(struct pid_float *pid, int target_speed, int current_speed)
+{
+    float error = target_speed - current_speed;
+    float derivative = error - pid->prev_error;
+
+    if (fabsf(error) < pid->error_threshold) {
+        pid->integral += error;
+        if (pid->integral > pid->integral_max) {
+            pid->integral = pid->integral_max;
+        } else if (pid->integral < -pid->integral_max) {
+            pid->integral = -pid->integral_max;
+        }
+    } else {
+        pid->integral = 0;
+    }
+    pid->prev_error = error;
+
+    float output = pid->kp * error + pid->ki * pid->integral + pid->kd * derivative;
+    if (output > 100) output = 100;
+    if (output < -100) output = -100;
+    return (int)output;
+}
+
+static q16_t to_q16(double v)
+{
+    return (q16_t)lround(v * Q16_ONE);
+}
+
+// set_motor_speed 记录的当前速度
+static int motor_speed(int speed)
+{
+    speed = speed < 0 ? -speed : speed;
+    return speed > 100 ? 100 : speed;
+}
+
+// 目标速度远超 0-100 时, 误差先限幅再转 Q16.16, 输出饱和且方向不变
+static int check_out_of_range(void)
+{
+    static const int targets[] = {INT_MAX, INT_MIN, 1000000, -1000000, 32768, -32768};
+    int failed = 0;
+
+    for (unsigned i = 0; i < sizeof(targets) / sizeof(targets[0]); i++) {
+        struct pid_q16 pid;
+        int speed = 0;
+
+        pid_q16_init(&pid, PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_DEFAULT_INTEGRAL_MAX,
+                     PID_DEFAULT_ERROR_THRESHOLD);
+        for (int tick = 0; tick < 20; tick++) {
+            int out = pid_q16_update(&pid, targets[i], speed);
+            if (out < -PID_OUTPUT_MAX || out > PID_OUTPUT_MAX || (long)out * targets[i] < 0) {
+                printf("target %d: output %d at tick %d\n", targets[i], out, tick);
+                failed = 1;
+                break;
+            }
+            speed = motor_speed(out);
+        }
+    }
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 1 && argc != 5 && argc != 7 && argc != 8) {
+        printf("Usage: %s [target kp ki kd [integral_max error_threshold [ticks]]]\n", argv[0]);
+        return -1;
+    }
+    if (check_out_of_range()) {
+        printf("out of range targets failed\n");
+        return -1;
+    }
+    int target = argc > 1 ? atoi(argv[1]) : 80;
+    struct pid_q16 pid;
+    struct pid_float ref;
+    if (argc > 1) {
+        double integral_max = argc > 5 ? atof(argv[5]) : 100;
+        double error_threshold = argc > 6 ? atof(argv[6]) : 20;
+        pid_q16_init(&pid, to_q16(atof(argv[2])), to_q16(atof(argv[3])), to_q16(atof(argv[4])),
+                     to_q16(integral_max), to_q16(error_threshold));
+    } else {
+        pid_q16_init(&pid, PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_DEFAULT_INTEGRAL_MAX,
+                     PID_DEFAULT_ERROR_THRESHOLD);
+    }
+    int ticks = argc > 7 ? atoi(argv[7]) : 40;
+    ref.kp = (float)pid.kp / Q16_ONE;
+    ref.ki = (float)pid.ki / Q16_ONE;
+    ref.kd = (float)pid.kd / Q16_ONE;
+    ref.integral_max = (float)pid.integral_max / Q16_ONE;
+    ref.error_threshold = (float)pid.error_threshold / Q16_ONE;
+    ref.integral = 0;
+    ref.prev_error = 0;
+
+    printf("target %d, kp %.4f ki %.4f kd %.4f, integral max %.1f, threshold %.1f\n", target, ref.kp, ref.ki,
+           ref.kd, ref.integral_max, ref.error_threshold);
+    printf("tick  q16  float  duty_ns\n");
+    int speed = 0, ref_speed = 0;
+    int max_diff = 0;
+    int reversals = 0;
+    int settled = -1;  // 之后一直在目标 ±1 以内的第一个周期
+    for (int i = 0; i < ticks; i++) {
+        int out = pid_q16_update(&pid, target, speed);
+        int ref_out = pid_float_update(&ref, target, ref_speed);
+        speed = motor_speed(out);
+        ref_speed = motor_speed(ref_out);
+        int diff = abs(out - ref_out);
+        max_diff = diff > max_diff ? diff : max_diff;
+        if ((long)out * target < 0)
+            reversals++;
+        if (abs(out - target) > 1)
+            settled = -1;
+        else if (settled < 0)
+            settled = i;
+        printf("%4d %4d %6d  %7u\n", i, out, ref_out, motor_duty_ns(speed));
+    }
+    printf("max difference to float: %d\n", max_diff);
+    if (settled >= 0)
+        printf("settled at tick %d\n", settled);
+    else
+        printf("not settled\n");
+    if (reversals) {
+        printf("output reversed direction %d times\n", reversals);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,102 @@
+#ifndef _POS_RING_H_
+#define _POS_RING_H_
+
+// 视觉程序和驱动共享的位置环形缓冲, 驱动通过 mmap 提供一页内存.
+// 单生产者 (用户态, 每帧 pos_ring_publish, 不用系统调用),
+// 单消费者 (驱动控制线程, 每个控制周期取最新一条).
+// 每一条带序号 (奇数表示正在写), 读到一半被覆盖时重读.
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#define POS_RING_LOAD_ACQUIRE(p) smp_load_acquire(p)
+#define POS_RING_READ_ONCE(x) READ_ONCE(x)
+#define POS_RING_STORE_RELEASE(p, v) smp_store_release(p, v)
+#define pos_ring_rmb() smp_rmb()
+#define pos_ring_wmb() smp_wmb()
+#else
+#include <stdint.h>
+typedef int32_t s32;
+typedef uint32_t u32;
+typedef uint64_t u64;
+#define POS_RING_LOAD_ACQUIRE(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define POS_RING_READ_ONCE(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define POS_RING_STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define pos_ring_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define pos_ring_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+#define POS_RING_SIZE 8        // 2 的幂
+#define POS_RING_READ_TRIES 4  // 读的时候一直被覆盖, 放到下个周期再读
+
+// ioctl: 检测状态变化 (检测到/丢失) 时唤醒控制线程, 不用等下一个周期
+#define POS_RING_IOC_KICK 0x300
+
+struct pos_entry {
+    u32 seq;           // 偶数: 已写完, 奇数: 正在写
+    s32 x;             // 物体中心X坐标 (0-100)
+    s32 y;             // 物体中心Y坐标 (0-100)
+    s32 width;         // 物体宽度百分比
+    u32 detected;      // 是否检测到物体
+    u32 reserved;
+    u64 timestamp_ns;  // CLOCK_MONOTONIC
+};
+
+// 生产者和驱动写的字段分在不同的 cache line
+struct pos_ring {
+    u32 head;           // 用户态写: 已发布的条数
+    u32 reserved0[15];
+    u32 state;          // 驱动写: 驱动当前的 detected
+    u32 state_changes;  // 驱动写: detected 变化的次数
+    u32 reserved1[14];
+    struct pos_entry entries[POS_RING_SIZE];
+};
+
+// 生产者: 写入一条位置并发布
+static inline void pos_ring_publish(struct pos_ring *ring, int x, int y, int width, int detected,
+                                    u64 timestamp_ns)
+{
+    u32 head = ring->head;
+    struct pos_entry *e = &ring->entries[head & (POS_RING_SIZE - 1)];
+    u32 seq = e->seq;
+
+    e->seq = seq + 1;
+    pos_ring_wmb();
+    e->x = x;
+    e->y = y;
+    e->width = width;
+    e->detected = detected ? 1 : 0;
+    e->timestamp_ns = timestamp_ns;
+    POS_RING_STORE_RELEASE(&e->seq, seq + 2);
+    POS_RING_STORE_RELEASE(&ring->head, head + 1);
+}
+
+// 消费者: 读取 *last_head 之后最新的一条, 中间的被跳过.
+// 返回 1 表示有新数据 (写入 *out 并更新 *last_head), 0 表示没有
+static inline int pos_ring_read_newest(struct pos_ring *ring, u32 *last_head, struct pos_entry *out)
+{
+    int tries;
+
+    for (tries = 0; tries < POS_RING_READ_TRIES; tries++) {
+        u32 head = POS_RING_LOAD_ACQUIRE(&ring->head);
+        const struct pos_entry *e;
+        u32 seq;
+
+        if (head == *last_head)
+            return 0;
+        e = &ring->entries[(head - 1) & (POS_RING_SIZE - 1)];
+        seq = POS_RING_LOAD_ACQUIRE(&e->seq);
+        if (seq & 1)
+            continue;
+        *out = *e;
+        pos_ring_rmb();
+        if (POS_RING_READ_ONCE(e->seq) != seq)
+            continue;
+        *last_head = head;
+        return 1;
+    }
+    return 0;
+}
+
+#endif //_POS_RING_H_
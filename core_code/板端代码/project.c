@@ -13,6 +13,18 @@
 #include <linux/kfifo.h>
 #include <linux/time.h>
 #include <linux/pid.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/seqlock.h>
+
+#include "pid_q16.h"
+#include "pos_ring.h"
 
 #define DEVICE_NAME "motor_control_device"
 
@@ -25,16 +37,22 @@
 #define MOTOR2_PWM_GPIO 0 * 32 + 21  // GPIO0_C5
 #define ALARM_GPIO 1 * 32 + 15      // GPIO1_D7
 
-// PWM参数
-#define PWM_PERIOD_NS 10000000  // PWM周期10ms
-#define MAX_DUTY_CYCLE_NS 9000000  // 最大占空比90%
-#define MIN_DUTY_CYCLE_NS 1000000  // 最小占空比10%
+// PWM参数见 pid_q16.h
 
+// 控制周期: hrtimer 以固定频率唤醒控制线程, 与摄像头帧率无关
+#define CONTROL_RATE_HZ 200
+#define CONTROL_PERIOD_NS (NSEC_PER_SEC / CONTROL_RATE_HZ)
 
 
 // 4G通信串口
 #define MODEM_TTY "/dev/ttyUSB0"
 
+// 报警: 先入 kfifo, 由工作队列发送, 调用者从不睡眠
+#define ALERT_FIFO_SIZE 16         // 等待发送的报警条数, 2 的幂
+#define ALERT_MSG_LEN 64
+#define ALERT_COALESCE_MS 10000    // 同一条报警在这段时间内只发一次
+#define ALARM_BUZZ_MS 500          // 蜂鸣器鸣响时间
+
 // 物体位置结构
 struct object_position {
     int x;          // 物体中心X坐标 (0-100)
@@ -50,8 +68,7 @@ struct motor_control {
     int dir_gpio2;
     int current_speed;  // 当前速度 (0-100)
     int target_speed;   // 目标速度 (0-100)
-    float integral;     // PID积分项
-    float prev_error;   // PID上一次误差
+    struct pid_q16 pid; // PID参数和状态, Q16.16
 };
 
 static dev_t dev_num;
@@ -59,69 +76,54 @@ struct cdev my_cdev;
 int major;
 int minor;
 
+// 位置状态, 整体由 pos_seq 保护. 读者不加锁, 被写者打断时重读.
+// 写者关中断, 这样读者将来放到 hrtimer/中断里也不会在同一个 CPU 上等写者
+struct pos_state {
+    struct object_position pos;
+    bool valid;         // 已收到第一个位置
+    bool manual;        // ioctl 手动速度, 下一次位置更新前有效
+    int manual_speed;
+    u32 events;         // detected 变化次数
+};
+
 // 全局结构
 static struct motor_control motor1, motor2;
-static struct object_position obj_pos = {0};
+static struct pos_state pos_state;
 static struct tty_struct *modem_tty = NULL;
-static DEFINE_SPINLOCK(pos_lock);
+static DEFINE_SEQLOCK(pos_seq);
 static DECLARE_WAIT_QUEUE_HEAD(data_waitq);
 
-struct pid_params {
-    float kp;           // 比例系数
-    float ki;           // 积分系数
-    float kd;           // 微分系数
-    float integral_max; // 积分限幅值
-    float error_threshold; // 积分分离阈值
-    float integral;     // 积分项
-    float prev_error;   // 上一次误差
-};
+// 控制循环: write() 只发布位置, PID 和 PWM 在控制线程里按 CONTROL_RATE_HZ 更新
+static struct hrtimer control_timer;
+static struct task_struct *control_thread;
+static DECLARE_WAIT_QUEUE_HEAD(control_waitq);
+static atomic_t control_tick = ATOMIC_INIT(0);
+static bool prev_detected;  // 仅控制线程使用
 
-// 电机控制结构
-struct motor_control {
-    struct pwm_device *pwm;
-    int dir_gpio1;
-    int dir_gpio2;
-    int current_speed;  // 当前速度 (0-100)
-    int target_speed;   // 目标速度 (0-100)
-    struct pid_params pid; // PID参数
-};
+// 共享位置页 (pos_ring.h): 视觉程序写入, 控制线程每个周期取最新一条
+static struct pos_ring *pos_ring;
+static u32 ring_head;           // 已消费到的 head, 仅控制线程使用
+static u64 ring_max_age_ns;     // 位置从发布到被消费的最大延迟, 仅控制线程使用
+static u32 state_events_read;   // read() 已确认的 pos_state.events
 
-// ... (其他全局定义保持不变)
+// 报警队列
+struct alert_msg {
+    char text[ALERT_MSG_LEN];
+};
+static DEFINE_KFIFO(alert_fifo, struct alert_msg, ALERT_FIFO_SIZE);
+static DEFINE_SPINLOCK(alert_lock);
+static char last_alert[ALERT_MSG_LEN];  // 合并重复报警 (alert_lock)
+static unsigned long last_alert_time;   // jiffies (alert_lock)
+static unsigned int alerts_dropped;     // 队列满丢弃的条数 (alert_lock)
+static struct work_struct alert_work;
+static struct timer_list buzzer_timer;
 
-// PID计算函数
+// PID计算函数, 定点运算, 不使用 FPU
 static int calculate_pid(struct motor_control *motor, int target_speed)
 {
-    float error = target_speed - motor->current_speed;
-    float derivative = error - motor->pid.prev_error;
-    
-    // 积分分离：仅在误差较小时使用积分项
-    if (fabs(error) < motor->pid.error_threshold) {
-        motor->pid.integral += error;
-        
-        // 积分限幅
-        if (motor->pid.integral > motor->pid.integral_max) {
-            motor->pid.integral = motor->pid.integral_max;
-        } else if (motor->pid.integral < -motor->pid.integral_max) {
-            motor->pid.integral = -motor->pid.integral_max;
-        }
-    } else {
-        // 误差较大时重置积分项
-        motor->pid.integral = 0;
-    }
-    
-    motor->pid.prev_error = error;
-    
-    // 计算PID输出
-    float output = motor->pid.kp * error + 
-                   motor->pid.ki * motor->pid.integral + 
-                   motor->pid.kd * derivative;
-    
-    // 限制输出范围
-    if (output > 100) output = 100;
-    if (output < -100) output = -100;
-    
-    return (int)output;
+    return pid_q16_update(&motor->pid, target_speed, motor->current_speed);
 }
+
 // 设置电机速度和方向
 static void set_motor_speed(struct motor_control *motor, int speed)
 {
@@ -144,68 +146,204 @@ static void set_motor_speed(struct motor_control *motor, int speed)
     if (speed > 100) speed = 100;
     
     // 计算PWM占空比
-    u64 duty_cycle = MIN_DUTY_CYCLE_NS + 
-                     (MAX_DUTY_CYCLE_NS - MIN_DUTY_CYCLE_NS) * speed / 100;
+    u32 duty_cycle = motor_duty_ns(speed);
     
     // 更新PWM
     pwm_config(motor->pwm, duty_cycle, PWM_PERIOD_NS);
     motor->current_speed = speed;
 }
 
-// 4G报警函数
-static void send_4g_alert(const char *message)
+// 串口参数只在打开 4G 模块时设置一次
+static void configure_modem_tty(struct tty_struct *tty)
 {
-    if (!modem_tty) {
-        printk(KERN_WARNING "4G modem not initialized\n");
-        return;
-    }
-    
-    struct tty_ldisc *ld;
     struct ktermios kterm;
     
-    ld = tty_ldisc_ref(modem_tty);
-    if (ld) {
-        // 设置串口参数
-        kterm = modem_tty->termios;
-        cfsetospeed(&kterm, B115200);
-        cfsetispeed(&kterm, B115200);
-        kterm.c_cflag &= ~PARENB; // 无奇偶校验
-        kterm.c_cflag &= ~CSTOPB; // 1位停止位
-        kterm.c_cflag &= ~CSIZE;
-        kterm.c_cflag |= CS8;    // 8位数据位
-        
-        tty_set_termios(modem_tty, &kterm);
-        
-        // 发送报警消息
-        tty_write_message(modem_tty, message);
+    kterm = tty->termios;
+    cfsetospeed(&kterm, B115200);
+    cfsetispeed(&kterm, B115200);
+    kterm.c_cflag &= ~PARENB; // 无奇偶校验
+    kterm.c_cflag &= ~CSTOPB; // 1位停止位
+    kterm.c_cflag &= ~CSIZE;
+    kterm.c_cflag |= CS8;    // 8位数据位
+    tty_set_termios(tty, &kterm);
+}
+
+static void buzzer_timer_fn(struct timer_list *t)
+{
+    gpio_set_value(ALARM_GPIO, 0);
+}
+
+// 工作队列: 发送队列中的报警, 可以睡眠
+static void alert_work_fn(struct work_struct *work)
+{
+    struct alert_msg msg;
+    
+    while (kfifo_out_spinlocked(&alert_fifo, &msg, 1, &alert_lock)) {
+        if (modem_tty) {
+            struct tty_ldisc *ld = tty_ldisc_ref(modem_tty);
+            if (ld) {
+                tty_write_message(modem_tty, msg.text);
+                tty_ldisc_deref(ld);
+            }
+        } else {
+            printk(KERN_WARNING "4G modem not initialized: %s\n", msg.text);
+        }
         
-        tty_ldisc_deref(ld);
+        // 同时触发GPIO报警, 由定时器关闭
+        gpio_set_value(ALARM_GPIO, 1);
+        mod_timer(&buzzer_timer, jiffies + msecs_to_jiffies(ALARM_BUZZ_MS));
     }
+}
+
+// 4G报警函数: 只入队, 不睡眠. ALERT_COALESCE_MS 内重复的报警被合并
+static void send_4g_alert(const char *message)
+{
+    struct alert_msg msg;
+    bool queued = false;
+    
+    strscpy(msg.text, message, sizeof(msg.text));
+    
+    spin_lock(&alert_lock);
+    if (strcmp(last_alert, msg.text) != 0 ||
+        time_after(jiffies, last_alert_time + msecs_to_jiffies(ALERT_COALESCE_MS))) {
+        if (kfifo_put(&alert_fifo, msg)) {
+            strscpy(last_alert, msg.text, sizeof(last_alert));
+            last_alert_time = jiffies;
+            queued = true;
+        } else {
+            alerts_dropped++;
+        }
+    }
+    spin_unlock(&alert_lock);
     
-    // 同时触发GPIO报警
-    gpio_set_value(ALARM_GPIO, 1);
-    msleep(500);
+    if (queued)
+        schedule_work(&alert_work);
+}
+
+static void init_alerts(void)
+{
+    spin_lock(&alert_lock);
+    kfifo_reset(&alert_fifo);
+    last_alert[0] = '\0';
+    alerts_dropped = 0;
+    spin_unlock(&alert_lock);
+    INIT_WORK(&alert_work, alert_work_fn);
+    timer_setup(&buzzer_timer, buzzer_timer_fn, 0);
+}
+
+// 已入队的报警丢弃, 正在发送的等它完成
+static void stop_alerts(void)
+{
+    spin_lock(&alert_lock);
+    kfifo_reset(&alert_fifo);
+    if (alerts_dropped)
+        printk(KERN_WARNING "%u alerts dropped, queue full\n", alerts_dropped);
+    spin_unlock(&alert_lock);
+    cancel_work_sync(&alert_work);
+    del_timer_sync(&buzzer_timer);
     gpio_set_value(ALARM_GPIO, 0);
 }
 
-// 基于视觉位置控制电机
+// 取位置状态的一致快照, 不加锁, 任何上下文都可以调用
+static void read_pos_state(struct pos_state *st)
+{
+    unsigned int seq;
+    
+    do {
+        seq = read_seqbegin(&pos_seq);
+        *st = pos_state;
+    } while (read_seqretry(&pos_seq, seq));
+}
+
+static int clamp_percent(int v)
+{
+    return v < 0 ? 0 : (v > 100 ? 100 : v);
+}
+
+// 发布新位置, write() 和共享页都走这里. 只在 detected 变化时唤醒 poll.
+// 坐标来自用户态, 限制在 0-100
+static void update_position(const struct object_position *new_pos)
+{
+    struct object_position pos = *new_pos;
+    unsigned long flags;
+    bool changed;
+    
+    pos.x = clamp_percent(pos.x);
+    pos.y = clamp_percent(pos.y);
+    pos.width = clamp_percent(pos.width);
+    
+    write_seqlock_irqsave(&pos_seq, flags);
+    changed = !pos_state.valid || pos_state.pos.detected != pos.detected;
+    pos_state.pos = pos;
+    pos_state.valid = true;
+    pos_state.manual = false;
+    if (changed) {
+        pos_state.events++;
+        WRITE_ONCE(pos_ring->state, pos.detected);
+        smp_store_release(&pos_ring->state_changes, pos_state.events);
+    }
+    write_sequnlock_irqrestore(&pos_seq, flags);
+    
+    if (changed)
+        wake_up_interruptible(&data_waitq);
+}
+
+// 取共享页中最新的位置, 中间被覆盖的帧直接跳过
+static void consume_pos_ring(void)
+{
+    struct pos_entry e;
+    struct object_position pos;
+    u64 now;
+    
+    if (!pos_ring_read_newest(pos_ring, &ring_head, &e))
+        return;
+    
+    // 时间戳来自用户态, 不可信, 只用于统计
+    now = ktime_get_ns();
+    if (e.timestamp_ns <= now && now - e.timestamp_ns > ring_max_age_ns)
+        ring_max_age_ns = now - e.timestamp_ns;
+    
+    pos.x = e.x;
+    pos.y = e.y;
+    pos.width = e.width;
+    pos.detected = e.detected;
+    update_position(&pos);
+}
+
+// 基于视觉位置控制电机, 每个控制周期在控制线程中调用一次
 static void vision_based_control(void)
 {
+    struct pos_state st;
     int obj_x, obj_detected;
     
-    // 获取物体位置（受锁保护）
-    spin_lock(&pos_lock);
-    obj_x = obj_pos.x;
-    obj_detected = obj_pos.detected;
-    spin_unlock(&pos_lock);
+    consume_pos_ring();
+    
+    // 获取物体位置（无锁快照）
+    read_pos_state(&st);
+    obj_x = st.pos.x;
+    obj_detected = st.pos.detected;
+    
+    if (st.manual) {
+        set_motor_speed(&motor1, st.manual_speed);
+        set_motor_speed(&motor2, st.manual_speed);
+        return;
+    }
+    if (!st.valid) {
+        // 还没有视觉数据
+        return;
+    }
     
     if (!obj_detected) {
         // 物体丢失 ，旋转寻找物体
         set_motor_speed(&motor1, 50);
       
-        send_4g_alert("ALERT: Object lost!");
+        // 每 CONTROL_RATE_HZ 都会走到这里, 只在丢失的那一刻报警 (入队, 不阻塞控制)
+        if (prev_detected)
+            send_4g_alert("ALERT: Object lost!");
+        prev_detected = false;
         return;
     }
+    prev_detected = true;
     
     // 计算偏差（中心点为50）
     int error = obj_x - 50;
@@ -234,6 +372,70 @@ static void vision_based_control(void)
     set_motor_speed(&motor2, pid_out2);
 }
 
+// hrtimer 回调运行在中断上下文, 而 PWM 配置和报警可能睡眠,
+// 所以这里只唤醒控制线程, 由它完成 PID 和 PWM 更新
+static enum hrtimer_restart control_timer_fn(struct hrtimer *timer)
+{
+    atomic_set(&control_tick, 1);
+    wake_up(&control_waitq);
+    hrtimer_forward_now(timer, ns_to_ktime(CONTROL_PERIOD_NS));
+    return HRTIMER_RESTART;
+}
+
+static int control_thread_fn(void *data)
+{
+    while (!kthread_should_stop()) {
+        wait_event_interruptible(control_waitq,
+                                 atomic_xchg(&control_tick, 0) || kthread_should_stop());
+        if (kthread_should_stop())
+            break;
+        vision_based_control();
+    }
+    return 0;
+}
+
+static int start_control_loop(void)
+{
+    unsigned long flags;
+    
+    write_seqlock_irqsave(&pos_seq, flags);
+    memset(&pos_state, 0, sizeof(pos_state));
+    write_sequnlock_irqrestore(&pos_seq, flags);
+    WRITE_ONCE(state_events_read, 0);
+    prev_detected = true;
+    // 共享页在控制线程启动前清零, 视觉程序在 open 之后才 mmap
+    memset(pos_ring, 0, PAGE_SIZE);
+    ring_head = 0;
+    ring_max_age_ns = 0;
+    atomic_set(&control_tick, 0);
+
+    control_thread = kthread_run(control_thread_fn, NULL, "motor_control");
+    if (IS_ERR(control_thread)) {
+        int ret = PTR_ERR(control_thread);
+        control_thread = NULL;
+        return ret;
+    }
+    // 实时优先级, 控制延迟不受普通进程影响
+    sched_set_fifo(control_thread);
+
+    hrtimer_init(&control_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    control_timer.function = control_timer_fn;
+    hrtimer_start(&control_timer, ns_to_ktime(CONTROL_PERIOD_NS), HRTIMER_MODE_REL);
+    return 0;
+}
+
+static void stop_control_loop(void)
+{
+    if (!control_thread)
+        return;
+    hrtimer_cancel(&control_timer);
+    kthread_stop(control_thread);
+    control_thread = NULL;
+    if (ring_head)
+        printk(KERN_INFO "Position ring: %u published, max age %llu us\n",
+               ring_head, ring_max_age_ns / NSEC_PER_USEC);
+}
+
 // 设备打开函数
 static int device_open(struct inode *inode, struct file *file)
 {
@@ -287,26 +489,39 @@ static int device_open(struct inode *inode, struct file *file)
     motor1.dir_gpio2 = MOTOR1_DIR_GPIO2;
     motor1.current_speed = 0;
     motor1.target_speed = 0;
-    motor1.integral = 0;
-    motor1.prev_error = 0;
+    pid_q16_init(&motor1.pid, PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_DEFAULT_INTEGRAL_MAX,
+                 PID_DEFAULT_ERROR_THRESHOLD);
     
     motor2.dir_gpio1 = MOTOR2_DIR_GPIO1;
     motor2.dir_gpio2 = MOTOR2_DIR_GPIO2;
     motor2.current_speed = 0;
     motor2.target_speed = 0;
-    motor2.integral = 0;
-    motor2.prev_error = 0;
+    pid_q16_init(&motor2.pid, PID_DEFAULT_KP, PID_DEFAULT_KI, PID_DEFAULT_KD, PID_DEFAULT_INTEGRAL_MAX,
+                 PID_DEFAULT_ERROR_THRESHOLD);
     
     // 初始化4G模块
+    init_alerts();
     modem_tty = tty_kopen(MODEM_TTY);
     if (IS_ERR(modem_tty)) {
         printk(KERN_WARNING "Failed to open 4G modem: %s\n", MODEM_TTY);
         modem_tty = NULL;
     } else {
+        configure_modem_tty(modem_tty);
         printk(KERN_INFO "4G modem initialized: %s\n", MODEM_TTY);
     }
     
-    printk(KERN_INFO "Motor control initialized\n");
+    ret = start_control_loop();
+    if (ret) {
+        // 撤销报警队列和 4G 模块, 否则下次打开时串口仍被占用
+        stop_alerts();
+        if (modem_tty) {
+            tty_kclose(modem_tty);
+            modem_tty = NULL;
+        }
+        goto error;
+    }
+    
+    printk(KERN_INFO "Motor control initialized, control loop %d Hz\n", CONTROL_RATE_HZ);
     return 0;
     
 error:
@@ -317,6 +532,11 @@ error:
 // 设备释放函数
 static int device_release(struct inode *inode, struct file *file)
 {
+    // 先停控制循环, 之后只有这里操作电机
+    stop_control_loop();
+    // 控制循环不再报警, 清空报警队列并关闭蜂鸣器
+    stop_alerts();
+    
     // 停止电机
     set_motor_speed(&motor1, 0);
     set_motor_speed(&motor2, 0);
@@ -347,20 +567,19 @@ static int device_release(struct inode *inode, struct file *file)
 // 设备读取函数 - 用于获取物体位置
 static ssize_t device_read(struct file *file, char __user *buffer, size_t length, loff_t *offset)
 {
-    struct object_position pos;
+    struct pos_state st;
     
-    if (length < sizeof(pos))
+    if (length < sizeof(st.pos))
         return -EINVAL;
     
-    // 复制位置数据
-    spin_lock(&pos_lock);
-    pos = obj_pos;
-    spin_unlock(&pos_lock);
+    // 复制位置数据, 同时确认已看到的状态变化
+    read_pos_state(&st);
+    WRITE_ONCE(state_events_read, st.events);
     
-    if (copy_to_user(buffer, &pos, sizeof(pos)))
+    if (copy_to_user(buffer, &st.pos, sizeof(st.pos)))
         return -EFAULT;
     
-    return sizeof(pos);
+    return sizeof(st.pos);
 }
 
 // 设备写入函数 - 用于更新物体位置
@@ -374,16 +593,8 @@ static ssize_t device_write(struct file *file, const char __user *buffer, size_t
     if (copy_from_user(&new_pos, buffer, sizeof(new_pos)))
         return -EFAULT;
     
-    // 更新位置数据
-    spin_lock(&pos_lock);
-    obj_pos = new_pos;
-    spin_unlock(&pos_lock);
-    
-    // 触发控制更新
-    vision_based_control();
-    
-    // 唤醒等待进程
-    wake_up_interruptible(&data_waitq);
+    // 更新位置数据, 控制线程在下一个周期读取
+    update_position(&new_pos);
     
     return sizeof(new_pos);
 }
@@ -392,11 +603,14 @@ static ssize_t device_write(struct file *file, const char __user *buffer, size_t
 static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
     switch (cmd) {
-        case 0x100: // 手动设置速度
+        case 0x100: // 手动设置速度, 由控制线程执行, 直到下一次 write()
             if (arg) {
-                int speed = (int)arg;
-                set_motor_speed(&motor1, speed);
-                set_motor_speed(&motor2, speed);
+                unsigned long flags;
+                
+                write_seqlock_irqsave(&pos_seq, flags);
+                pos_state.manual_speed = (int)arg;
+                pos_state.manual = true;
+                write_sequnlock_irqrestore(&pos_seq, flags);
             }
             break;
             
@@ -404,6 +618,11 @@ static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
             send_4g_alert("ALERT: Manual trigger!");
             break;
             
+        case POS_RING_IOC_KICK: // 共享页中检测状态变化, 立即运行一次控制
+            atomic_set(&control_tick, 1);
+            wake_up(&control_waitq);
+            break;
+            
         default:
             return -ENOTTY;
     }
@@ -411,21 +630,33 @@ static long device_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
     return 0;
 }
 
-// Poll函数 - 等待位置更新
+// Poll函数 - 等待检测状态变化 (检测到/丢失), read() 确认
 static unsigned int device_poll(struct file *file, poll_table *wait)
 {
+    struct pos_state st;
     unsigned int mask = 0;
     
     poll_wait(file, &data_waitq, wait);
     
-    spin_lock(&pos_lock);
-    if (obj_pos.detected)
+    read_pos_state(&st);
+    if (st.events != READ_ONCE(state_events_read))
         mask |= POLLIN | POLLRDNORM;
-    spin_unlock(&pos_lock);
     
     return mask;
 }
 
+// 把共享位置页映射到用户态, 只读写这一页.
+// 必须是 MAP_SHARED, 私有映射写时复制, 驱动看不到写入的位置
+static int device_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+        return -EINVAL;
+    if (!(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    
+    return vm_insert_page(vma, vma->vm_start, virt_to_page(pos_ring));
+}
+
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .open = device_open,
@@ -434,16 +665,24 @@ static struct file_operations fops = {
     .write = device_write,
     .unlocked_ioctl = device_ioctl,
     .poll = device_poll,
+    .mmap = device_mmap,
 };
 
 static int __init mydevice_init(void)
 {
     int ret;
     
+    BUILD_BUG_ON(sizeof(struct pos_ring) > PAGE_SIZE);
+    pos_ring = (struct pos_ring *)get_zeroed_page(GFP_KERNEL);
+    if (!pos_ring)
+        return -ENOMEM;
+    
     // 注册字符设备
     ret = alloc_chrdev_region(&dev_num, 0, 1, DEVICE_NAME);
-    if (ret < 0)
+    if (ret < 0) {
+        free_page((unsigned long)pos_ring);
         return ret;
+    }
     
     major = MAJOR(dev_num);
     minor = MINOR(dev_num);
@@ -454,6 +693,7 @@ static int __init mydevice_init(void)
     ret = cdev_add(&my_cdev, dev_num, 1);
     if (ret < 0) {
         unregister_chrdev_region(dev_num, 1);
+        free_page((unsigned long)pos_ring);
         return ret;
     }
     
@@ -465,6 +705,7 @@ static void __exit mydevice_exit(void)
 {
     cdev_del(&my_cdev);
     unregister_chrdev_region(dev_num, 1);
+    free_page((unsigned long)pos_ring);
     printk(KERN_INFO "Motor control device unregistered\n");
 }
 
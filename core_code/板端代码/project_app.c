@@ -5,10 +5,14 @@
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/poll.h>
+#include <sys/mman.h>
 #include <signal.h>
+#include <time.h>
 #include <opencv2/opencv.hpp>
 #include <json-c/json.h>  // 用于配置加载
 
+#include "pos_ring.h"
+
 #define DEV_NAME "/dev/motor_control_device"
 #define CONFIG_FILE "motor_config.json"
 
@@ -37,6 +41,7 @@ struct app_config {
 // 全局变量
 volatile sig_atomic_t stop = 0;
 int dev_fd = -1;
+struct pos_ring *pos_ring = NULL;  // 驱动共享的位置页, 为空时用 write()
 cv::VideoCapture cap;
 struct app_config config;
 
@@ -164,6 +169,25 @@ struct object_position detect_object(cv::Mat &frame) {
     return pos;
 }
 
+static u64 monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 发送位置到驱动: 有共享页时直接写入, 否则 write()
+int publish_position(const struct object_position *pos) {
+    if (pos_ring) {
+        pos_ring_publish(pos_ring, pos->x, pos->y, pos->width, pos->detected, monotonic_ns());
+        return 0;
+    }
+    if (write(dev_fd, pos, sizeof(*pos)) != sizeof(*pos)) {
+        perror("Write to device failed");
+        return -1;
+    }
+    return 0;
+}
+
 // 初始化设备
 int init_devices() {
     // 打开设备
@@ -173,10 +197,22 @@ int init_devices() {
         return -1;
     }
     
+    // 映射共享位置页, 驱动不支持时退回 write()
+    void *page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, dev_fd, 0);
+    if (page == MAP_FAILED) {
+        perror("mmap position ring failed, using write()");
+    } else {
+        pos_ring = (struct pos_ring *)page;
+    }
+    
     // 打开摄像头
     cap.open(config.camera_index);
     if (!cap.isOpened()) {
         fprintf(stderr, "Failed to open camera %d\n", config.camera_index);
+        if (pos_ring) {
+            munmap(pos_ring, sysconf(_SC_PAGESIZE));
+            pos_ring = NULL;
+        }
         close(dev_fd);
         return -1;
     }
@@ -187,7 +223,7 @@ int init_devices() {
     cap.set(cv::CAP_PROP_FPS, 30);
     
     printf("Devices initialized:\n");
-    printf("  - Motor control device: %s\n", DEV_NAME);
+    printf("  - Motor control device: %s (%s)\n", DEV_NAME, pos_ring ? "shared ring" : "write");
     printf("  - Camera: index %d, resolution %dx%d\n", 
            config.camera_index, config.frame_width, config.frame_height);
     
@@ -200,8 +236,12 @@ void cleanup_devices() {
         // 发送停止命令
         struct object_position stop_cmd = {0};
         stop_cmd.detected = false;
-        write(dev_fd, &stop_cmd, sizeof(stop_cmd));
+        publish_position(&stop_cmd);
         
+        if (pos_ring) {
+            munmap(pos_ring, sysconf(_SC_PAGESIZE));
+            pos_ring = NULL;
+        }
         close(dev_fd);
         printf("Motor device closed\n");
     }
@@ -228,6 +268,8 @@ void run_control_loop() {
     time_t start_time = time(NULL);
     int lost_count = 0;
     const int max_lost_frames = 30; // 30帧后报警
+    bool last_detected = false;
+    u32 state_changes = 0;
     
     printf("Starting control loop...\n");
     
@@ -254,13 +296,26 @@ void run_control_loop() {
         }
         
         // 发送位置信息到驱动
-        if (write(dev_fd, &pos, sizeof(pos)) != sizeof(pos)) {
-            perror("Write to device failed");
+        if (publish_position(&pos) != 0) {
             break;
         }
         
-        // 检查是否有报警信息（非阻塞）
-        if (poll(&pfd, 1, 0) > 0) {
+        if (pos_ring) {
+            // 检测状态变化时才唤醒控制线程, 其余帧由驱动定时读取
+            if (pos.detected != last_detected) {
+                ioctl(dev_fd, POS_RING_IOC_KICK);
+                last_detected = pos.detected;
+            }
+            // 驱动的状态变化直接从共享页读取, 不用系统调用
+            u32 changes = POS_RING_LOAD_ACQUIRE(&pos_ring->state_changes);
+            if (changes != state_changes) {
+                state_changes = changes;
+                if (!pos_ring->state) {
+                    printf("ALERT: Object lost detected in driver!\n");
+                }
+            }
+        } else if (poll(&pfd, 1, 0) > 0) {
+            // 检查是否有报警信息（非阻塞）
             if (pfd.revents & POLLIN) {
                 struct object_position driver_pos;
                 if (read(dev_fd, &driver_pos, sizeof(driver_pos)) == sizeof(driver_pos)) {
@@ -0,0 +1,101 @@
+#include "alloc_stats.h"
+
+#if defined(ALLOC_STATS)
+
+#include <errno.h>
+#include <stddef.h>
+#include <new>
+
+static uint64_t g_alloc_count = 0;
+// initial-exec TLS of the executable, reading it does not allocate
+static __thread uint64_t t_alloc_count = 0;
+
+uint64_t alloc_stats_count() { return __atomic_load_n(&g_alloc_count, __ATOMIC_RELAXED); }
+
+uint64_t alloc_stats_thread_count() { return t_alloc_count; }
+
+static inline void count_alloc()
+{
+    __atomic_fetch_add(&g_alloc_count, 1, __ATOMIC_RELAXED);
+    t_alloc_count++;
+}
+
+#if defined(__GLIBC__)
+// Interpose the allocator itself, so malloc from C code, operator new and
+// the shared libraries (OpenCV, rknn runtime) are all counted.
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    count_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+
+// glibc has no __libc_ entry points for these two, both go through memalign
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    count_alloc();
+    void *p = __libc_memalign(alignment, size);
+    if (p == NULL)
+    {
+        return ENOMEM;
+    }
+    *memptr = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    count_alloc();
+    return __libc_memalign(alignment, size);
+}
+}
+#else
+// Other C libraries: only C++ allocations are visible.
+#include <stdlib.h>
+
+void *operator new(size_t size)
+{
+    count_alloc();
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete[](void *p) noexcept { free(p); }
+#endif
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _RKNN_YOLOV8_DEMO_ALLOC_STATS_H_
+#define _RKNN_YOLOV8_DEMO_ALLOC_STATS_H_
+
+#include <stdint.h>
+
+// Heap allocation counters, compiled in with -DALLOC_STATS (CMake option
+// ALLOC_STATS, not together with ENABLE_ASAN). alloc_stats_count is process
+// wide, alloc_stats_thread_count only counts the calling thread: take the
+// difference of two readings around a piece of work (npu_pool brackets
+// inference and post_process this way) to check it does not allocate.
+#if defined(ALLOC_STATS)
+uint64_t alloc_stats_count();
+uint64_t alloc_stats_thread_count();
+#else
+static inline uint64_t alloc_stats_count() { return 0; }
+static inline uint64_t alloc_stats_thread_count() { return 0; }
+#endif
+
+#endif //_RKNN_YOLOV8_DEMO_ALLOC_STATS_H_
@@ -0,0 +1,708 @@
+#include "async_log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ASYNC_LOG_CACHE_LINE 64
+#define ASYNC_LOG_LINE_BYTES 512
+#define ASYNC_LOG_OUT_BYTES 4096
+
+int async_log_level = ASYNC_LOG_COMPILE_LEVEL;
+
+// One log call. args hold the values in conversion order, '*' widths and
+// precisions included: integers widened to 64 bits, doubles by their bits,
+// %s as an offset into str (-1 if it did not fit).
+typedef struct {
+    uint64_t time_ns;
+    const char *fmt;
+    uint32_t suppressed;
+    uint8_t level;
+    uint8_t n_args;
+    uint8_t str_used;
+    uint64_t args[ASYNC_LOG_MAX_ARGS];
+    char str[ASYNC_LOG_STR_BYTES];
+} log_record_t;
+
+// Records of one thread. head is written by that thread only, tail by the
+// background thread only.
+typedef struct log_ring
+{
+    uint64_t head;
+    char pad0[ASYNC_LOG_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    char pad1[ASYNC_LOG_CACHE_LINE - sizeof(uint64_t)];
+    bool orphaned;         // the thread has exited, freed once drained
+    struct log_ring *next; // under log_lock
+    log_record_t records[ASYNC_LOG_RING_SIZE];
+} log_ring_t;
+
+static struct
+{
+    log_ring_t *rings;    // under log_lock
+    pthread_key_t key;    // exit hook of the owning thread
+    pthread_t thread;
+    bool running;
+    bool stop;
+    uint64_t dropped;
+    uint64_t dropped_reported;
+} log_state;
+
+// ring list and registration, not taken per record
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t log_key_once = PTHREAD_ONCE_INIT;
+
+static __thread log_ring_t *thread_ring;
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*-------------------------------------------
+                  Format strings
+-------------------------------------------*/
+
+// One conversion of a printf format
+typedef struct {
+    const char *end;       // one past the conversion character
+    const char *flags;
+    int n_flags;
+    const char *width;     // digits, or NULL for '*'
+    int n_width;
+    bool has_prec;
+    const char *prec;      // digits, or NULL for '*'
+    int n_prec;
+    char length;           // 0, 'H' hh, 'h', 'l', 'L' ll, 'j', 'z', 't', 'D' long double
+    char conv;
+} fmt_spec_t;
+
+// p points at the '%'
+static void parse_spec(const char *p, fmt_spec_t *s)
+{
+    p++;
+    s->flags = p;
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+    {
+        p++;
+    }
+    s->n_flags = (int)(p - s->flags);
+
+    s->width = NULL;
+    s->n_width = 0;
+    if (*p == '*')
+    {
+        p++;
+    }
+    else
+    {
+        s->width = p;
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+        s->n_width = (int)(p - s->width);
+    }
+
+    s->has_prec = *p == '.';
+    s->prec = NULL;
+    s->n_prec = 0;
+    if (s->has_prec)
+    {
+        p++;
+        if (*p == '*')
+        {
+            p++;
+        }
+        else
+        {
+            s->prec = p;
+            while (*p >= '0' && *p <= '9')
+            {
+                p++;
+            }
+            s->n_prec = (int)(p - s->prec);
+        }
+    }
+
+    s->length = 0;
+    if (p[0] == 'h' && p[1] == 'h')
+    {
+        s->length = 'H';
+        p += 2;
+    }
+    else if (p[0] == 'l' && p[1] == 'l')
+    {
+        s->length = 'L';
+        p += 2;
+    }
+    else if (*p == 'L')
+    {
+        s->length = 'D';
+        p++;
+    }
+    else if (*p != '\0' && strchr("hljzt", *p) != NULL)
+    {
+        s->length = *p++;
+    }
+
+    s->conv = *p;
+    if (*p != '\0')
+    {
+        p++;
+    }
+    s->end = p;
+}
+
+typedef enum {
+    ARG_NONE = 0, // %%
+    ARG_SIGNED,
+    ARG_UNSIGNED,
+    ARG_DOUBLE,
+    ARG_STRING,
+    ARG_POINTER,
+    ARG_INVALID,  // %n, unknown conversions
+} arg_kind_t;
+
+static arg_kind_t arg_kind(char conv)
+{
+    switch (conv)
+    {
+    case '%':
+        return ARG_NONE;
+    case 'd':
+    case 'i':
+        return ARG_SIGNED;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        return ARG_UNSIGNED;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return ARG_DOUBLE;
+    case 's':
+        return ARG_STRING;
+    case 'p':
+        return ARG_POINTER;
+    default:
+        return ARG_INVALID;
+    }
+}
+
+static int spec_args(const fmt_spec_t *s)
+{
+    return (s->width == NULL) + (s->has_prec && s->prec == NULL) + (arg_kind(s->conv) != ARG_NONE);
+}
+
+/*-------------------------------------------
+                  Caller side
+-------------------------------------------*/
+
+static uint64_t read_signed(char length, va_list *ap)
+{
+    switch (length)
+    {
+    case 'l':
+        return (uint64_t)(int64_t)va_arg(*ap, long);
+    case 'L':
+        return (uint64_t)(int64_t)va_arg(*ap, long long);
+    case 'j':
+        return (uint64_t)(int64_t)va_arg(*ap, intmax_t);
+    case 'z':
+        return (uint64_t)(int64_t)va_arg(*ap, ssize_t);
+    case 't':
+        return (uint64_t)(int64_t)va_arg(*ap, ptrdiff_t);
+    default:
+        return (uint64_t)(int64_t)va_arg(*ap, int);
+    }
+}
+
+static uint64_t read_unsigned(char length, va_list *ap)
+{
+    switch (length)
+    {
+    case 'l':
+        return va_arg(*ap, unsigned long);
+    case 'L':
+        return va_arg(*ap, unsigned long long);
+    case 'j':
+        return va_arg(*ap, uintmax_t);
+    case 'z':
+        return va_arg(*ap, size_t);
+    case 't':
+        return (uint64_t)va_arg(*ap, ptrdiff_t);
+    default:
+        return va_arg(*ap, unsigned int);
+    }
+}
+
+static uint64_t copy_string(log_record_t *r, const char *str)
+{
+    if (str == NULL)
+    {
+        str = "(null)";
+    }
+    int room = ASYNC_LOG_STR_BYTES - r->str_used;
+    if (room <= 0)
+    {
+        return (uint64_t)-1;
+    }
+    int len = (int)strnlen(str, room - 1);
+    uint64_t offset = r->str_used;
+    memcpy(r->str + offset, str, len);
+    r->str[offset + len] = '\0';
+    r->str_used += len + 1;
+    return offset;
+}
+
+// The values the background thread needs to format fmt later. Stops at the
+// first conversion it cannot take, the rest of the format prints verbatim.
+static void capture_args(log_record_t *r, const char *fmt, va_list *ap)
+{
+    r->n_args = 0;
+    r->str_used = 0;
+    for (const char *p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%'))
+    {
+        fmt_spec_t s;
+        parse_spec(p, &s);
+        p = s.end;
+        arg_kind_t kind = arg_kind(s.conv);
+        if (kind == ARG_NONE)
+        {
+            continue;
+        }
+        if (kind == ARG_INVALID || r->n_args + spec_args(&s) > ASYNC_LOG_MAX_ARGS)
+        {
+            return;
+        }
+        if (s.width == NULL)
+        {
+            r->args[r->n_args++] = (uint64_t)(int64_t)va_arg(*ap, int);
+        }
+        if (s.has_prec && s.prec == NULL)
+        {
+            r->args[r->n_args++] = (uint64_t)(int64_t)va_arg(*ap, int);
+        }
+        uint64_t v;
+        switch (kind)
+        {
+        case ARG_SIGNED:
+            v = read_signed(s.length, ap);
+            break;
+        case ARG_UNSIGNED:
+            v = read_unsigned(s.length, ap);
+            break;
+        case ARG_DOUBLE:
+        {
+            double d = s.length == 'D' ? (double)va_arg(*ap, long double) : va_arg(*ap, double);
+            memcpy(&v, &d, sizeof(v));
+            break;
+        }
+        case ARG_STRING:
+            v = copy_string(r, va_arg(*ap, const char *));
+            break;
+        default:
+            v = (uint64_t)(uintptr_t)va_arg(*ap, void *);
+            break;
+        }
+        r->args[r->n_args++] = v;
+    }
+}
+
+/*-------------------------------------------
+                Background thread
+-------------------------------------------*/
+
+typedef struct {
+    char *buf;
+    int size;
+    int len;
+} line_t;
+
+static void put(line_t *line, const char *s, int n)
+{
+    int room = line->size - 1 - line->len;
+    if (n > room)
+    {
+        n = room;
+    }
+    if (n > 0)
+    {
+        memcpy(line->buf + line->len, s, n);
+        line->len += n;
+    }
+}
+
+static void put_printf(line_t *line, const char *spec, ...) __attribute__((format(printf, 2, 3)));
+static void put_printf(line_t *line, const char *spec, ...)
+{
+    int room = line->size - line->len;
+    va_list ap;
+    va_start(ap, spec);
+    int n = vsnprintf(line->buf + line->len, room, spec, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        line->len += n < room ? n : room - 1;
+    }
+}
+
+// One conversion with its '*' resolved and the length normalised to the
+// widened value, e.g. "%-*.*hd" -> "%-8.3lld"
+static void build_spec(const fmt_spec_t *s, const log_record_t *r, int *arg, char *spec, int size)
+{
+    line_t out = {spec, size, 0};
+    put(&out, "%", 1);
+    put(&out, s->flags, s->n_flags);
+    if (s->width == NULL)
+    {
+        put_printf(&out, "%d", (int)(int64_t)r->args[(*arg)++]);
+    }
+    else
+    {
+        put(&out, s->width, s->n_width);
+    }
+    if (s->has_prec)
+    {
+        put(&out, ".", 1);
+        if (s->prec == NULL)
+        {
+            put_printf(&out, "%d", (int)(int64_t)r->args[(*arg)++]);
+        }
+        else
+        {
+            put(&out, s->prec, s->n_prec);
+        }
+    }
+    arg_kind_t kind = arg_kind(s->conv);
+    if ((kind == ARG_SIGNED || kind == ARG_UNSIGNED) && s->conv != 'c')
+    {
+        put(&out, "ll", 2);
+    }
+    put(&out, &s->conv, 1);
+    spec[out.len] = '\0';
+}
+
+// printf of the record into line, the parts of the format beyond the
+// captured arguments verbatim
+static void format_record(const log_record_t *r, line_t *line)
+{
+    static const char level_chars[] = "DIWE";
+    put_printf(line, "[%c %.3f] ", level_chars[r->level & 3], r->time_ns / 1e9);
+
+    int arg = 0;
+    const char *p = r->fmt;
+    while (*p != '\0')
+    {
+        const char *q = strchr(p, '%');
+        if (q == NULL)
+        {
+            put(line, p, (int)strlen(p));
+            break;
+        }
+        put(line, p, (int)(q - p));
+        fmt_spec_t s;
+        parse_spec(q, &s);
+        p = s.end;
+        arg_kind_t kind = arg_kind(s.conv);
+        if (kind == ARG_NONE)
+        {
+            put(line, "%", 1);
+            continue;
+        }
+        if (kind == ARG_INVALID || arg + spec_args(&s) > r->n_args)
+        {
+            put(line, q, (int)(s.end - q));
+            arg = r->n_args;
+            continue;
+        }
+        char spec[32];
+        build_spec(&s, r, &arg, spec, sizeof(spec));
+        uint64_t v = r->args[arg++];
+        switch (kind)
+        {
+        case ARG_SIGNED:
+            put_printf(line, spec, (long long)(int64_t)v);
+            break;
+        case ARG_UNSIGNED:
+            if (s.conv == 'c')
+            {
+                put_printf(line, spec, (int)v);
+            }
+            else
+            {
+                put_printf(line, spec, (unsigned long long)v);
+            }
+            break;
+        case ARG_DOUBLE:
+        {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            put_printf(line, spec, d);
+            break;
+        }
+        case ARG_STRING:
+            put_printf(line, spec, v == (uint64_t)-1 ? "" : r->str + v);
+            break;
+        default:
+            put_printf(line, spec, (void *)(uintptr_t)v);
+            break;
+        }
+    }
+    if (r->suppressed > 0)
+    {
+        put_printf(line, " (%u suppressed)", r->suppressed);
+    }
+    put(line, "\n", 1);
+}
+
+static void write_out(line_t *out, const char *s, int n)
+{
+    if (out->len + n > out->size)
+    {
+        fwrite(out->buf, 1, out->len, stdout);
+        out->len = 0;
+    }
+    if (n > out->size)
+    {
+        fwrite(s, 1, n, stdout);
+        return;
+    }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
+
+// Writes out every record queued so far, merged across threads by time
+static void drain()
+{
+    char out_buf[ASYNC_LOG_OUT_BYTES];
+    char line_buf[ASYNC_LOG_LINE_BYTES];
+    line_t out = {out_buf, sizeof(out_buf), 0};
+
+    pthread_mutex_lock(&log_lock);
+    while (true)
+    {
+        log_ring_t *first = NULL;
+        for (log_ring_t *ring = log_state.rings; ring != NULL; ring = ring->next)
+        {
+            if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+            {
+                continue;
+            }
+            if (first == NULL || ring->records[ring->tail % ASYNC_LOG_RING_SIZE].time_ns <
+                                     first->records[first->tail % ASYNC_LOG_RING_SIZE].time_ns)
+            {
+                first = ring;
+            }
+        }
+        if (first == NULL)
+        {
+            break;
+        }
+        line_t line = {line_buf, sizeof(line_buf), 0};
+        format_record(&first->records[first->tail % ASYNC_LOG_RING_SIZE], &line);
+        __atomic_store_n(&first->tail, first->tail + 1, __ATOMIC_RELEASE);
+        write_out(&out, line.buf, line.len);
+    }
+
+    uint64_t dropped = __atomic_load_n(&log_state.dropped, __ATOMIC_RELAXED);
+    if (dropped != log_state.dropped_reported)
+    {
+        line_t line = {line_buf, sizeof(line_buf), 0};
+        put_printf(&line, "[W %.3f] log: %llu records dropped\n", now_ns() / 1e9,
+                   (unsigned long long)(dropped - log_state.dropped_reported));
+        write_out(&out, line.buf, line.len);
+        log_state.dropped_reported = dropped;
+    }
+
+    // rings of exited threads, once drained
+    for (log_ring_t **link = &log_state.rings; *link != NULL;)
+    {
+        log_ring_t *ring = *link;
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+        {
+            *link = ring->next;
+            free(ring);
+        }
+        else
+        {
+            link = &ring->next;
+        }
+    }
+    pthread_mutex_unlock(&log_lock);
+
+    if (out.len > 0)
+    {
+        fwrite(out.buf, 1, out.len, stdout);
+        fflush(stdout);
+    }
+}
+
+static void *log_main(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&log_state.stop, __ATOMIC_ACQUIRE))
+    {
+        drain();
+        usleep(ASYNC_LOG_FLUSH_MS * 1000);
+    }
+    drain();
+    return NULL;
+}
+
+static void orphan_ring(void *arg)
+{
+    __atomic_store_n(&((log_ring_t *)arg)->orphaned, true, __ATOMIC_RELEASE);
+}
+
+static void create_key() { pthread_key_create(&log_state.key, orphan_ring); }
+
+// The calling thread's ring, registered on its first record
+static log_ring_t *get_thread_ring()
+{
+    if (thread_ring != NULL)
+    {
+        return thread_ring;
+    }
+    pthread_once(&log_key_once, create_key);
+    log_ring_t *ring = (log_ring_t *)calloc(1, sizeof(log_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&log_lock);
+    ring->next = log_state.rings;
+    log_state.rings = ring;
+    pthread_mutex_unlock(&log_lock);
+    pthread_setspecific(log_state.key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/*-------------------------------------------
+                  Public
+-------------------------------------------*/
+
+static void log_vwrite(int level, uint32_t suppressed, const char *fmt, va_list *ap)
+{
+    uint64_t time_ns = now_ns();
+    log_ring_t *ring = __atomic_load_n(&log_state.running, __ATOMIC_ACQUIRE) ? get_thread_ring() : NULL;
+    if (ring == NULL)
+    {
+        // not started, format it here
+        log_record_t r;
+        r.time_ns = time_ns;
+        r.fmt = fmt;
+        r.level = level;
+        r.suppressed = suppressed;
+        capture_args(&r, fmt, ap);
+        char line_buf[ASYNC_LOG_LINE_BYTES];
+        line_t line = {line_buf, sizeof(line_buf), 0};
+        format_record(&r, &line);
+        fwrite(line.buf, 1, line.len, stdout);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= ASYNC_LOG_RING_SIZE)
+    {
+        __atomic_fetch_add(&log_state.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    log_record_t *r = &ring->records[head % ASYNC_LOG_RING_SIZE];
+    r->time_ns = time_ns;
+    r->fmt = fmt;
+    r->level = level;
+    r->suppressed = suppressed;
+    capture_args(r, fmt, ap);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void async_log_write(int level, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, 0, fmt, &ap);
+    va_end(ap);
+}
+
+bool async_log_rate_pass(async_log_rate_t *rate, int interval_ms, uint32_t *suppressed)
+{
+    uint64_t now = now_ns();
+    uint64_t next = __atomic_load_n(&rate->next_ns, __ATOMIC_RELAXED);
+    if (now < next || !__atomic_compare_exchange_n(&rate->next_ns, &next, now + interval_ms * 1000000ull, false,
+                                                   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_fetch_add(&rate->suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    uint32_t n = __atomic_exchange_n(&rate->suppressed, 0, __ATOMIC_RELAXED);
+    if (suppressed != NULL)
+    {
+        *suppressed = n;
+    }
+    return true;
+}
+
+void async_log_write_limited(async_log_rate_t *rate, int interval_ms, int level, const char *fmt, ...)
+{
+    uint32_t suppressed;
+    if (!async_log_rate_pass(rate, interval_ms, &suppressed))
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, suppressed, fmt, &ap);
+    va_end(ap);
+}
+
+int async_log_start()
+{
+    if (__atomic_load_n(&log_state.running, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+    fflush(stdout);
+    log_state.stop = false;
+    if (pthread_create(&log_state.thread, NULL, log_main, NULL) != 0)
+    {
+        printf("async_log_start: create thread fail!\n");
+        return -1;
+    }
+    __atomic_store_n(&log_state.running, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void async_log_stop()
+{
+    if (!__atomic_load_n(&log_state.running, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    // later calls print directly, the thread writes out what is queued
+    __atomic_store_n(&log_state.running, false, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_state.stop, true, __ATOMIC_RELEASE);
+    pthread_join(log_state.thread, NULL);
+}
+
+void async_log_set_level(int level) { async_log_level = level; }
+
+uint64_t async_log_dropped() { return __atomic_load_n(&log_state.dropped, __ATOMIC_RELAXED); }
@@ -0,0 +1,97 @@
+#ifndef _RKNN_YOLOV8_DEMO_ASYNC_LOG_H_
+#define _RKNN_YOLOV8_DEMO_ASYNC_LOG_H_
+
+#include <stdint.h>
+
+// Logging off the frame path. A call copies the format pointer and its
+// arguments into a fixed-size record in a lock-free ring owned by the
+// calling thread, a background thread formats the records and writes them
+// to stdout. Nothing is formatted, locked or written by the caller; when
+// its ring is full the record is dropped and counted.
+//
+// The format must be a string literal (only its pointer is kept). %s
+// arguments are copied, up to ASYNC_LOG_STR_BYTES per record. %n and
+// more than ASYNC_LOG_MAX_ARGS arguments are not supported. A newline is
+// appended to every record.
+//
+// Before async_log_start and after async_log_stop calls print synchronously.
+
+#define ASYNC_LOG_DEBUG 0
+#define ASYNC_LOG_INFO 1
+#define ASYNC_LOG_WARN 2
+#define ASYNC_LOG_ERROR 3
+
+// Records below this level are compiled out, arguments included
+// (CMake Debug builds keep ASYNC_LOG_DEBUG)
+#ifndef ASYNC_LOG_COMPILE_LEVEL
+#define ASYNC_LOG_COMPILE_LEVEL ASYNC_LOG_INFO
+#endif
+
+#define ASYNC_LOG_MAX_ARGS 8
+#define ASYNC_LOG_STR_BYTES 40
+#define ASYNC_LOG_RING_SIZE 256 // records per thread, power of two
+#define ASYNC_LOG_FLUSH_MS 10   // background thread wake-up period
+
+// Per call site state of LOG_EVERY_MS / async_log_rate_pass, zero initialised
+typedef struct {
+    uint64_t next_ns;
+    uint32_t suppressed;
+} async_log_rate_t;
+
+// Starts the background thread. Returns 0, -1 if it cannot be started (the
+// calls keep printing synchronously then).
+int async_log_start();
+// Writes out what is queued and stops the background thread.
+void async_log_stop();
+
+// Runtime threshold on top of ASYNC_LOG_COMPILE_LEVEL, which is also the default
+void async_log_set_level(int level);
+extern int async_log_level;
+
+// Records dropped on full rings so far
+uint64_t async_log_dropped();
+
+void async_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// True at most once per interval_ms for this rate, *suppressed gets the
+// number of refusals since the last pass. For rate limiting a group of
+// records; LOG_EVERY_MS covers a single one.
+bool async_log_rate_pass(async_log_rate_t *rate, int interval_ms, uint32_t *suppressed);
+// async_log_write behind async_log_rate_pass, the record notes how many
+// were suppressed before it
+void async_log_write_limited(async_log_rate_t *rate, int interval_ms, int level, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+
+#define LOG_AT(level, ...)                                                         \
+    do                                                                             \
+    {                                                                              \
+        if ((level) >= ASYNC_LOG_COMPILE_LEVEL && (level) >= async_log_level)      \
+        {                                                                          \
+            async_log_write((level), __VA_ARGS__);                                 \
+        }                                                                          \
+    } while (0)
+
+// At most one record per interval_ms from this call site
+#define LOG_EVERY_MS(level, interval_ms, ...)                                      \
+    do                                                                             \
+    {                                                                              \
+        static async_log_rate_t log_rate_;                                         \
+        if ((level) >= ASYNC_LOG_COMPILE_LEVEL && (level) >= async_log_level)      \
+        {                                                                          \
+            async_log_write_limited(&log_rate_, (interval_ms), (level), __VA_ARGS__); \
+        }                                                                          \
+    } while (0)
+
+#if ASYNC_LOG_COMPILE_LEVEL <= ASYNC_LOG_DEBUG
+#define LOGD(...) LOG_AT(ASYNC_LOG_DEBUG, __VA_ARGS__)
+#else
+#define LOGD(...) \
+    do            \
+    {             \
+    } while (0)
+#endif
+#define LOGI(...) LOG_AT(ASYNC_LOG_INFO, __VA_ARGS__)
+#define LOGW(...) LOG_AT(ASYNC_LOG_WARN, __VA_ARGS__)
+#define LOGE(...) LOG_AT(ASYNC_LOG_ERROR, __VA_ARGS__)
+
+#endif //_RKNN_YOLOV8_DEMO_ASYNC_LOG_H_
@@ -0,0 +1,166 @@
+#include "avi_writer.h"
+
+#include <string.h>
+
+// RIFF AVI with one MJPG video stream: hdrl (avih, strl (strh, strf)),
+// movi of '00dc' chunks, idx1
+#define AVI_HEADER_SIZE 224
+#define AVI_TOTAL_FRAMES_POS 48    // avih dwTotalFrames
+#define AVI_AVIH_BUFFER_POS 60     // avih dwSuggestedBufferSize
+#define AVI_STRH_LENGTH_POS 140    // strh dwLength
+#define AVI_STRH_BUFFER_POS 144    // strh dwSuggestedBufferSize
+#define AVI_MOVI_SIZE_POS 216
+#define AVI_MOVI_POS 220
+#define AVIF_HASINDEX 0x10
+#define AVIIF_KEYFRAME 0x10
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = v >> 24;
+}
+
+static void put_fourcc(uint8_t *p, const char *fourcc) { memcpy(p, fourcc, 4); }
+
+static bool write_u32_at(FILE *fp, long pos, uint32_t v)
+{
+    uint8_t b[4];
+    put_u32(b, v);
+    return fseek(fp, pos, SEEK_SET) == 0 && fwrite(b, 1, 4, fp) == 4;
+}
+
+int avi_writer_open(avi_writer_t *avi, const char *path, int width, int height, int fps)
+{
+    avi->fp = fopen(path, "wb");
+    if (avi->fp == NULL)
+    {
+        printf("avi_writer: open %s fail!\n", path);
+        return -1;
+    }
+    avi->width = width;
+    avi->height = height;
+    avi->fps = fps > 0 ? fps : 1;
+    avi->n_frames = 0;
+    avi->max_frame_size = 0;
+    avi->movi_pos = AVI_MOVI_POS;
+    avi->index.clear();
+
+    // sizes and counts are patched by avi_writer_close
+    uint8_t h[AVI_HEADER_SIZE];
+    memset(h, 0, sizeof(h));
+    put_fourcc(h + 0, "RIFF");
+    put_fourcc(h + 8, "AVI ");
+    put_fourcc(h + 12, "LIST");
+    put_u32(h + 16, 192);
+    put_fourcc(h + 20, "hdrl");
+
+    put_fourcc(h + 24, "avih");
+    put_u32(h + 28, 56);
+    put_u32(h + 32, 1000000 / avi->fps);
+    put_u32(h + 44, AVIF_HASINDEX);
+    put_u32(h + 56, 1); // streams
+    put_u32(h + 64, width);
+    put_u32(h + 68, height);
+
+    put_fourcc(h + 88, "LIST");
+    put_u32(h + 92, 116);
+    put_fourcc(h + 96, "strl");
+    put_fourcc(h + 100, "strh");
+    put_u32(h + 104, 56);
+    put_fourcc(h + 108, "vids");
+    put_fourcc(h + 112, "MJPG");
+    put_u32(h + 128, 1);          // dwScale
+    put_u32(h + 132, avi->fps);   // dwRate
+    put_u32(h + 148, 0xffffffff); // dwQuality, default
+    put_u16(h + 160, width);      // rcFrame right, bottom
+    put_u16(h + 162, height);
+
+    put_fourcc(h + 164, "strf");
+    put_u32(h + 168, 40);
+    put_u32(h + 172, 40); // biSize
+    put_u32(h + 176, width);
+    put_u32(h + 180, height);
+    put_u16(h + 184, 1);  // biPlanes
+    put_u16(h + 186, 24); // biBitCount
+    put_fourcc(h + 188, "MJPG");
+    put_u32(h + 192, width * height * 3);
+
+    put_fourcc(h + 212, "LIST");
+    put_fourcc(h + 220, "movi");
+    if (fwrite(h, 1, sizeof(h), avi->fp) != sizeof(h))
+    {
+        fclose(avi->fp);
+        avi->fp = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int avi_writer_add_frame(avi_writer_t *avi, const void *jpeg, uint32_t size)
+{
+    if (avi->fp == NULL)
+    {
+        return -1;
+    }
+    long pos = ftell(avi->fp);
+    uint8_t chunk[8];
+    put_fourcc(chunk, "00dc");
+    put_u32(chunk + 4, size);
+    static const uint8_t pad = 0;
+    if (fwrite(chunk, 1, 8, avi->fp) != 8 || fwrite(jpeg, 1, size, avi->fp) != size ||
+        ((size & 1) && fwrite(&pad, 1, 1, avi->fp) != 1))
+    {
+        return -1;
+    }
+    avi->index.push_back((uint32_t)(pos - avi->movi_pos));
+    avi->index.push_back(size);
+    avi->n_frames++;
+    if (size > avi->max_frame_size)
+    {
+        avi->max_frame_size = size;
+    }
+    return 0;
+}
+
+int avi_writer_close(avi_writer_t *avi)
+{
+    if (avi->fp == NULL)
+    {
+        return -1;
+    }
+    FILE *fp = avi->fp;
+    avi->fp = NULL;
+
+    long movi_end = ftell(fp);
+    uint8_t entry[16];
+    put_fourcc(entry, "idx1");
+    put_u32(entry + 4, avi->n_frames * 16);
+    bool ok = fwrite(entry, 1, 8, fp) == 8;
+    for (uint32_t i = 0; ok && i < avi->n_frames; i++)
+    {
+        put_fourcc(entry, "00dc");
+        put_u32(entry + 4, AVIIF_KEYFRAME);
+        put_u32(entry + 8, avi->index[i * 2]);
+        put_u32(entry + 12, avi->index[i * 2 + 1]);
+        ok = fwrite(entry, 1, 16, fp) == 16;
+    }
+    long file_end = ftell(fp);
+
+    ok = ok && write_u32_at(fp, 4, (uint32_t)(file_end - 8));
+    ok = ok && write_u32_at(fp, AVI_TOTAL_FRAMES_POS, avi->n_frames);
+    ok = ok && write_u32_at(fp, AVI_AVIH_BUFFER_POS, avi->max_frame_size);
+    ok = ok && write_u32_at(fp, AVI_STRH_LENGTH_POS, avi->n_frames);
+    ok = ok && write_u32_at(fp, AVI_STRH_BUFFER_POS, avi->max_frame_size);
+    ok = ok && write_u32_at(fp, AVI_MOVI_SIZE_POS, (uint32_t)(movi_end - AVI_MOVI_POS));
+    ok = fclose(fp) == 0 && ok;
+    avi->index.clear();
+    return ok ? 0 : -1;
+}
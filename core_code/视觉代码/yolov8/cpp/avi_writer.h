@@ -0,0 +1,27 @@
+#ifndef _RKNN_YOLOV8_DEMO_AVI_WRITER_H_
+#define _RKNN_YOLOV8_DEMO_AVI_WRITER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <vector>
+
+// Motion JPEG AVI from frames that are already JPEG, nothing is decoded or
+// re-encoded. The header sizes and the index are written by avi_writer_close.
+typedef struct {
+    FILE *fp;
+    int width;
+    int height;
+    int fps;
+    uint32_t n_frames;
+    uint32_t max_frame_size;
+    long movi_pos;                // 'movi' fourcc, idx1 offsets are relative to it
+    std::vector<uint32_t> index;  // offset and size per frame
+} avi_writer_t;
+
+int avi_writer_open(avi_writer_t *avi, const char *path, int width, int height, int fps);
+int avi_writer_add_frame(avi_writer_t *avi, const void *jpeg, uint32_t size);
+// Returns 0 once the file is complete, the writer can be opened again.
+int avi_writer_close(avi_writer_t *avi);
+
+#endif //_RKNN_YOLOV8_DEMO_AVI_WRITER_H_
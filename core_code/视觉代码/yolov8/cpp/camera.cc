@@ -0,0 +1,142 @@
+#include "camera.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool is_number(const char *s)
+{
+    if (*s == '\0')
+    {
+        return false;
+    }
+    for (; *s != '\0'; s++)
+    {
+        if (*s < '0' || *s > '9')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int camera_parse_list(const char *list, camera_t *cameras, int max_cameras)
+{
+    int n = 0;
+    const char *p = list;
+    while (true)
+    {
+        const char *end = strchr(p, ',');
+        size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+        if (len == 0 || len >= CAMERA_NAME_MAX || n == max_cameras)
+        {
+            printf("bad camera list \"%s\"\n", list);
+            return -1;
+        }
+        camera_t *cam = &cameras[n];
+        memset(cam, 0, sizeof(camera_t));
+        cam->id = n;
+        memcpy(cam->name, p, len);
+        cam->name[len] = '\0';
+
+        char *at = strrchr(cam->name, '@');
+        if (at != NULL)
+        {
+            char *fps_end;
+            cam->fps_target = strtof(at + 1, &fps_end);
+            if (fps_end == at + 1 || *fps_end != '\0' || cam->fps_target <= 0)
+            {
+                printf("bad frame rate in \"%s\"\n", cam->name);
+                return -1;
+            }
+            *at = '\0';
+        }
+        cam->is_file = !is_number(cam->name);
+        n++;
+        if (end == NULL)
+        {
+            return n;
+        }
+        p = end + 1;
+    }
+}
+
+int camera_open(camera_t *cam, int width, int height)
+{
+    if (cam->is_file)
+    {
+        cam->cap = new cv::VideoCapture(std::string(cam->name));
+    }
+    else
+    {
+        cam->cap = new cv::VideoCapture(atoi(cam->name));
+    }
+    if (!cam->cap->isOpened())
+    {
+        printf("Error: Could not open camera %s\n", cam->name);
+        camera_close(cam);
+        return -1;
+    }
+    if (cam->is_file)
+    {
+        double fps = cam->cap->get(cv::CAP_PROP_FPS);
+        cam->frame_us = fps > 0 ? (int64_t)(1000000 / fps) : 0;
+        cam->next_read_us = now_us();
+    }
+    else
+    {
+        cam->cap->set(cv::CAP_PROP_FRAME_WIDTH, width);
+        cam->cap->set(cv::CAP_PROP_FRAME_HEIGHT, height);
+    }
+    return 0;
+}
+
+bool camera_read(camera_t *cam, cv::Mat &image)
+{
+    if (!cam->is_file)
+    {
+        return cam->cap->read(image);
+    }
+
+    // a file is decoded as fast as it can be, hold it to its frame rate
+    if (cam->frame_us > 0)
+    {
+        int64_t now = now_us();
+        if (cam->next_read_us > now)
+        {
+            usleep(cam->next_read_us - now);
+        }
+        else
+        {
+            cam->next_read_us = now;
+        }
+        cam->next_read_us += cam->frame_us;
+    }
+    if (cam->cap->read(image))
+    {
+        return true;
+    }
+    cam->cap->set(cv::CAP_PROP_POS_FRAMES, 0);
+    return cam->cap->read(image);
+}
+
+void camera_close(camera_t *cam)
+{
+    if (cam->cap != NULL)
+    {
+        cam->cap->release();
+        delete cam->cap;
+        cam->cap = NULL;
+    }
+}
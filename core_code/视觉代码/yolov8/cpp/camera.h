@@ -0,0 +1,35 @@
+#ifndef _RKNN_YOLOV8_DEMO_CAMERA_H_
+#define _RKNN_YOLOV8_DEMO_CAMERA_H_
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+// Video sources of one process. On the command line a comma separated list,
+// each a V4L2 device number or a video file, optionally followed by @fps,
+// the rate its frames are sent to the NPU at, e.g. "0,1@15,pool.mp4@10".
+// Files stand in for cameras: they loop and are read at their own frame
+// rate.
+#define CAMERA_MAX 8
+#define CAMERA_NAME_MAX 128
+
+typedef struct {
+    int id;                  // position in the list, tags the results
+    char name[CAMERA_NAME_MAX];
+    float fps_target;        // 0: every frame the NPU can take
+    bool is_file;
+    cv::VideoCapture *cap;
+    int64_t frame_us;        // files: time between frames
+    int64_t next_read_us;    // files: when the next frame is due
+} camera_t;
+
+// Returns the number of cameras, -1 on a malformed list.
+int camera_parse_list(const char *list, camera_t *cameras, int max_cameras);
+
+int camera_open(camera_t *cam, int width, int height);
+// Next frame, blocking. Files start over at their end. False once the
+// source fails.
+bool camera_read(camera_t *cam, cv::Mat &image);
+void camera_close(camera_t *cam);
+
+#endif //_RKNN_YOLOV8_DEMO_CAMERA_H_
@@ -0,0 +1,235 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct output_capture
+{
+    FILE *fp;
+    uint32_t frame_id;
+    output_capture_header_t header; // valid once frame_id > 0
+};
+
+output_capture_platform_t output_capture_platform()
+{
+#if defined(RV1106_1103)
+    return OUTPUT_CAPTURE_RV1106_1103;
+#elif defined(RKNPU1)
+    return OUTPUT_CAPTURE_RKNPU1;
+#else
+    return OUTPUT_CAPTURE_RKNPU2;
+#endif
+}
+
+static void fill_capture_attr(output_capture_attr_t *dst, const rknn_tensor_attr *src)
+{
+    memset(dst, 0, sizeof(output_capture_attr_t));
+    dst->n_dims = src->n_dims < OUTPUT_CAPTURE_MAX_DIMS ? src->n_dims : OUTPUT_CAPTURE_MAX_DIMS;
+    for (uint32_t i = 0; i < dst->n_dims; i++)
+    {
+        dst->dims[i] = src->dims[i];
+    }
+    dst->fmt = src->fmt;
+    dst->type = src->type;
+    dst->zp = src->zp;
+    dst->scale = src->scale;
+    dst->size = src->size;
+}
+
+// Describe output idx the way post_process receives it
+static const void *get_capture_output(rknn_app_context_t *app_ctx, void *outputs, int idx, output_capture_attr_t *buf)
+{
+#if defined(RV1106_1103)
+    rknn_tensor_mem *mem = ((rknn_tensor_mem **)outputs)[idx];
+    fill_capture_attr(buf, &app_ctx->output_attrs[idx]);
+    buf->size = mem->size;
+    return mem->virt_addr;
+#else
+    rknn_output *out = &((rknn_output *)outputs)[idx];
+#if defined(ZERO_COPY)
+    fill_capture_attr(buf, &app_ctx->output_native_attrs[idx]);
+#else
+    fill_capture_attr(buf, &app_ctx->output_attrs[idx]);
+#if !defined(RKNPU1)
+    buf->fmt = RKNN_TENSOR_NCHW;
+#endif
+    if (!app_ctx->is_quant)
+    {
+        buf->type = RKNN_TENSOR_FLOAT32;
+    }
+#endif
+    buf->size = out->size;
+    return out->buf;
+#endif
+}
+
+output_capture_t *output_capture_open(const char *path)
+{
+    output_capture_t *cap = (output_capture_t *)calloc(1, sizeof(output_capture_t));
+    if (cap == NULL)
+    {
+        return NULL;
+    }
+    cap->fp = fopen(path, "wb");
+    if (cap->fp == NULL)
+    {
+        printf("open capture file %s fail!\n", path);
+        free(cap);
+        return NULL;
+    }
+    return cap;
+}
+
+int output_capture_write(output_capture_t *cap, rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_box,
+                         float conf_threshold, float nms_threshold, object_detect_result_list *od_results)
+{
+    int n_output = app_ctx->io_num.n_output;
+    if (n_output > OUTPUT_CAPTURE_MAX_OUTPUTS)
+    {
+        printf("capture supports at most %d outputs, model has %d\n", OUTPUT_CAPTURE_MAX_OUTPUTS, n_output);
+        return -1;
+    }
+
+    output_capture_attr_t bufs[OUTPUT_CAPTURE_MAX_OUTPUTS];
+    const void *data[OUTPUT_CAPTURE_MAX_OUTPUTS];
+    for (int i = 0; i < n_output; i++)
+    {
+        data[i] = get_capture_output(app_ctx, outputs, i, &bufs[i]);
+    }
+
+    output_capture_header_t *hdr = &cap->header;
+    if (cap->frame_id == 0)
+    {
+        memset(hdr, 0, sizeof(output_capture_header_t));
+        hdr->magic = OUTPUT_CAPTURE_MAGIC;
+        hdr->version = OUTPUT_CAPTURE_VERSION;
+        hdr->platform = output_capture_platform();
+        hdr->n_output = n_output;
+        hdr->model_width = app_ctx->model_width;
+        hdr->model_height = app_ctx->model_height;
+        hdr->model_channel = app_ctx->model_channel;
+        hdr->is_quant = app_ctx->is_quant;
+        for (int i = 0; i < n_output; i++)
+        {
+            fill_capture_attr(&hdr->attrs[i], &app_ctx->output_attrs[i]);
+            hdr->bufs[i] = bufs[i];
+        }
+        if (fwrite(hdr, sizeof(output_capture_header_t), 1, cap->fp) != 1)
+        {
+            printf("write capture header fail!\n");
+            return -1;
+        }
+    }
+    for (int i = 0; i < n_output; i++)
+    {
+        if (bufs[i].size != hdr->bufs[i].size)
+        {
+            printf("capture output %d size changed: %u -> %u\n", i, hdr->bufs[i].size, bufs[i].size);
+            return -1;
+        }
+    }
+
+    output_capture_frame_t frame;
+    memset(&frame, 0, sizeof(output_capture_frame_t));
+    frame.magic = OUTPUT_CAPTURE_FRAME_MAGIC;
+    frame.frame_id = cap->frame_id;
+    frame.x_pad = letter_box->x_pad;
+    frame.y_pad = letter_box->y_pad;
+    frame.scale = letter_box->scale;
+    frame.conf_threshold = conf_threshold;
+    frame.nms_threshold = nms_threshold;
+    frame.det_count = od_results->count;
+
+    output_capture_det_t dets[OBJ_NUMB_MAX_SIZE];
+    for (int i = 0; i < od_results->count; i++)
+    {
+        object_detect_result *det = &od_results->results[i];
+        dets[i].left = det->box.left;
+        dets[i].top = det->box.top;
+        dets[i].right = det->box.right;
+        dets[i].bottom = det->box.bottom;
+        dets[i].prop = det->prop;
+        dets[i].cls_id = det->cls_id;
+    }
+
+    bool ok = fwrite(&frame, sizeof(frame), 1, cap->fp) == 1 &&
+              fwrite(dets, sizeof(output_capture_det_t), frame.det_count, cap->fp) == frame.det_count;
+    for (int i = 0; i < n_output && ok; i++)
+    {
+        ok = fwrite(data[i], 1, bufs[i].size, cap->fp) == bufs[i].size;
+    }
+    if (!ok)
+    {
+        printf("write capture frame %u fail!\n", cap->frame_id);
+        return -1;
+    }
+    cap->frame_id++;
+    return 0;
+}
+
+void output_capture_close(output_capture_t *cap)
+{
+    if (cap == NULL)
+    {
+        return;
+    }
+    fclose(cap->fp);
+    free(cap);
+}
+
+int output_capture_read_header(FILE *fp, output_capture_header_t *hdr)
+{
+    if (fread(hdr, sizeof(output_capture_header_t), 1, fp) != 1 || hdr->magic != OUTPUT_CAPTURE_MAGIC)
+    {
+        printf("not an output capture file\n");
+        return -1;
+    }
+    if (hdr->version != OUTPUT_CAPTURE_VERSION)
+    {
+        printf("unsupported capture version %u\n", hdr->version);
+        return -1;
+    }
+    if (hdr->n_output == 0 || hdr->n_output > OUTPUT_CAPTURE_MAX_OUTPUTS)
+    {
+        printf("bad capture output num %u\n", hdr->n_output);
+        return -1;
+    }
+    for (uint32_t i = 0; i < hdr->n_output; i++)
+    {
+        if (hdr->bufs[i].size == 0)
+        {
+            printf("capture output %u is empty\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int output_capture_read_frame(FILE *fp, const output_capture_header_t *hdr, output_capture_frame_t *frame,
+                              output_capture_det_t *dets, void **bufs)
+{
+    size_t n = fread(frame, sizeof(output_capture_frame_t), 1, fp);
+    if (n != 1)
+    {
+        return feof(fp) ? 0 : -1;
+    }
+    if (frame->magic != OUTPUT_CAPTURE_FRAME_MAGIC || frame->det_count > OBJ_NUMB_MAX_SIZE)
+    {
+        printf("corrupt capture frame\n");
+        return -1;
+    }
+    if (fread(dets, sizeof(output_capture_det_t), frame->det_count, fp) != frame->det_count)
+    {
+        printf("truncated capture frame %u\n", frame->frame_id);
+        return -1;
+    }
+    for (uint32_t i = 0; i < hdr->n_output; i++)
+    {
+        if (fread(bufs[i], 1, hdr->bufs[i].size, fp) != hdr->bufs[i].size)
+        {
+            printf("truncated capture frame %u\n", frame->frame_id);
+            return -1;
+        }
+    }
+    return 1;
+}
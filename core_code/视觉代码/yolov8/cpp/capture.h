@@ -0,0 +1,92 @@
+#ifndef _RKNN_YOLOV8_DEMO_CAPTURE_H_
+#define _RKNN_YOLOV8_DEMO_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "yolov8.h"
+
+// Record of the raw output tensors handed to post_process, replayed off the
+// board by replay.cc. Host byte order, one file header followed by frames:
+//
+//   output_capture_header_t
+//   output_capture_frame_t, det_count * output_capture_det_t,
+//   then the bytes of every output in index order (bufs[i].size each)
+//   ...
+#define OUTPUT_CAPTURE_MAGIC 0x43385659       // "YV8C"
+#define OUTPUT_CAPTURE_FRAME_MAGIC 0x454d5246 // "FRME"
+#define OUTPUT_CAPTURE_VERSION 1
+#define OUTPUT_CAPTURE_MAX_OUTPUTS 9
+#define OUTPUT_CAPTURE_MAX_DIMS 16
+
+// post_process reads the outputs differently per platform, a capture only
+// replays on a build for the same one
+typedef enum {
+    OUTPUT_CAPTURE_RKNPU2 = 0,
+    OUTPUT_CAPTURE_RV1106_1103 = 1,
+    OUTPUT_CAPTURE_RKNPU1 = 2,
+} output_capture_platform_t;
+
+typedef struct {
+    uint32_t n_dims;
+    uint32_t dims[OUTPUT_CAPTURE_MAX_DIMS];
+    uint32_t fmt;   // rknn_tensor_format
+    uint32_t type;  // rknn_tensor_type
+    int32_t zp;
+    float scale;
+    uint32_t size;
+} output_capture_attr_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t platform;
+    uint32_t n_output;
+    int32_t model_width;
+    int32_t model_height;
+    int32_t model_channel;
+    uint32_t is_quant;
+    output_capture_attr_t attrs[OUTPUT_CAPTURE_MAX_OUTPUTS]; // app_ctx->output_attrs
+    output_capture_attr_t bufs[OUTPUT_CAPTURE_MAX_OUTPUTS];  // the captured bytes: layout, type, size
+} output_capture_header_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t frame_id;
+    int32_t x_pad;
+    int32_t y_pad;
+    float scale;
+    float conf_threshold;
+    float nms_threshold;
+    uint32_t det_count;
+} output_capture_frame_t;
+
+// detections post_process produced on the board, the golden output
+typedef struct {
+    int32_t left;
+    int32_t top;
+    int32_t right;
+    int32_t bottom;
+    float prop;
+    int32_t cls_id;
+} output_capture_det_t;
+
+typedef struct output_capture output_capture_t;
+
+output_capture_platform_t output_capture_platform();
+
+// Writer, called by inference_yolov8_model after post_process when
+// app_ctx->capture is set. The file header goes out with the first frame.
+output_capture_t *output_capture_open(const char *path);
+int output_capture_write(output_capture_t *cap, rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_box,
+                         float conf_threshold, float nms_threshold, object_detect_result_list *od_results);
+void output_capture_close(output_capture_t *cap);
+
+// Reader. Returns 0 on success, read_frame returns 1 for a frame, 0 at the
+// end of the file and -1 on errors. bufs[i] must hold hdr->bufs[i].size bytes,
+// dets OBJ_NUMB_MAX_SIZE entries.
+int output_capture_read_header(FILE *fp, output_capture_header_t *hdr);
+int output_capture_read_frame(FILE *fp, const output_capture_header_t *hdr, output_capture_frame_t *frame,
+                              output_capture_det_t *dets, void **bufs);
+
+#endif //_RKNN_YOLOV8_DEMO_CAPTURE_H_
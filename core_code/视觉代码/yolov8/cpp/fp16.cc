@@ -0,0 +1,62 @@
+#include "fp16.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+float half_to_float_c(fp16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t bits;
+
+    if (exp == 0x1f)
+    {
+        // inf / NaN, NaNs come out quiet like the hardware conversion
+        bits = sign | 0x7f800000 | (mant << 13) | (mant != 0 ? 0x400000 : 0);
+    }
+    else if (exp != 0)
+    {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    else if (mant == 0)
+    {
+        bits = sign;
+    }
+    else
+    {
+        // subnormal, normalise the mantissa
+        exp = 113;
+        while ((mant & 0x400) == 0)
+        {
+            mant <<= 1;
+            exp--;
+        }
+        bits = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+void half_to_float_n(const fp16_t *src, float *dst, int n)
+{
+    int i = 0;
+#if defined(__aarch64__) && defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4)
+    {
+        vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+    }
+#elif defined(__F16C__)
+    for (; i + 8 <= n; i += 8)
+    {
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[i] = half_to_float(src[i]);
+    }
+}
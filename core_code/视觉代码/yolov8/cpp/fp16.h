@@ -0,0 +1,34 @@
+#ifndef _RKNN_YOLOV8_DEMO_FP16_H_
+#define _RKNN_YOLOV8_DEMO_FP16_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+// IEEE 754 half stored as raw bits, the element type of native fp16 outputs.
+typedef uint16_t fp16_t;
+
+// Bit exact software conversion, handles subnormals, inf and NaN.
+float half_to_float_c(fp16_t h);
+
+// half_to_float for n contiguous values: NEON vcvt on aarch64, F16C on x86,
+// half_to_float_c elsewhere.
+void half_to_float_n(const fp16_t *src, float *dst, int n);
+
+static inline float half_to_float(fp16_t h)
+{
+#if defined(__aarch64__)
+    __fp16 v;
+    memcpy(&v, &h, sizeof(v));
+    return (float)v;
+#elif defined(__F16C__)
+    return _cvtsh_ss(h);
+#else
+    return half_to_float_c(h);
+#endif
+}
+
+#endif //_RKNN_YOLOV8_DEMO_FP16_H_
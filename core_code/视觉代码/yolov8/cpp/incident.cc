@@ -0,0 +1,463 @@
+#include "incident.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "async_log.h"
+#include "avi_writer.h"
+#include "spsc_ring.h"
+
+#define INCIDENT_NICE 10 // added to the encoder and writer threads' nice value
+
+// A frame on its way to the encoder
+typedef struct {
+    cv::Mat image; // the caller's pixels, not a copy
+    object_detect_result_list od_results;
+    uint64_t time_ns;
+    incident_done_fn done;
+    void *user;
+} incident_job_t;
+
+// A frame in the buffer: its detections, then its JPEG, at offset
+typedef struct {
+    uint64_t time_ns;
+    size_t offset;
+    int n_det;
+    uint32_t jpeg_size;
+    int width;
+    int height;
+} frame_entry_t;
+
+struct incident_recorder
+{
+    incident_config_t config;
+    uint64_t interval_ns;
+    uint64_t next_due_ns;     // submit only
+    uint64_t trigger_ns;      // latest trigger, atomic
+    uint64_t handled_ns;      // encoder only, latest trigger acted on
+    incident_job_t *jobs;     // INCIDENT_QUEUE_SIZE + 1, one being encoded
+    spsc_ring_t *queued;      // submit -> encoder
+    spsc_ring_t *free_jobs;   // encoder -> submit
+    pthread_t encoder;
+    pthread_t writer;
+    bool encoder_started;
+    bool writer_started;
+
+    // everything below is under lock
+    pthread_mutex_t lock;
+    pthread_cond_t cond;      // writer waits for frames and the end of a clip
+    unsigned char *buffer;
+    frame_entry_t entries[INCIDENT_MAX_FRAMES];
+    uint64_t first;           // oldest entry held, entries grow without wrapping
+    uint64_t next;
+    size_t write_off;         // end of the newest entry
+    uint64_t overruns;
+
+    // The clip being recorded. Entries from clip_next on are pinned until
+    // the writer has them, the encoder skips frames rather than evict them.
+    bool clip_active;         // until the writer has closed its files
+    bool clip_closed;         // no more entries join, the clip ends at clip_stop
+    uint64_t clip_next;
+    uint64_t clip_stop;
+    uint64_t clip_end_ns;
+    int clip_id;
+    bool stop;                // no more frames, the writer exits once idle
+};
+
+static void lower_priority()
+{
+#if defined(__linux__)
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), INCIDENT_NICE);
+#endif
+}
+
+/*-------------------------------------------
+                  Frame buffer
+-------------------------------------------*/
+
+// Offset for size more bytes after the newest entry, wrapping to the start
+// of the buffer when the end is too short. False if it does not fit yet.
+static bool find_space(incident_recorder_t *rec, size_t size, size_t *offset)
+{
+    size_t capacity = rec->config.buffer_bytes;
+    if (rec->first == rec->next)
+    {
+        rec->write_off = 0;
+        *offset = 0;
+        return size <= capacity;
+    }
+    size_t tail = rec->entries[rec->first % INCIDENT_MAX_FRAMES].offset;
+    if (rec->write_off > tail)
+    {
+        // used [tail, write_off)
+        if (size <= capacity - rec->write_off)
+        {
+            *offset = rec->write_off;
+            return true;
+        }
+        *offset = 0;
+        return size <= tail;
+    }
+    // wrapped, used [tail, end) and [0, write_off)
+    *offset = rec->write_off;
+    return size <= tail - rec->write_off;
+}
+
+static bool can_evict(incident_recorder_t *rec)
+{
+    return rec->first != rec->next && !(rec->clip_active && rec->first >= rec->clip_next);
+}
+
+static void append_frame(incident_recorder_t *rec, const incident_job_t *job, const std::vector<unsigned char> &jpeg,
+                         int width, int height)
+{
+    size_t det_bytes = job->od_results.count * sizeof(object_detect_result);
+    size_t size = det_bytes + jpeg.size();
+    size_t offset = 0;
+    while (rec->next - rec->first == INCIDENT_MAX_FRAMES || !find_space(rec, size, &offset))
+    {
+        if (!can_evict(rec) || size > rec->config.buffer_bytes)
+        {
+            rec->overruns++;
+            return;
+        }
+        rec->first++;
+    }
+    memcpy(rec->buffer + offset, job->od_results.results, det_bytes);
+    memcpy(rec->buffer + offset + det_bytes, jpeg.data(), jpeg.size());
+    frame_entry_t *e = &rec->entries[rec->next % INCIDENT_MAX_FRAMES];
+    e->time_ns = job->time_ns;
+    e->offset = offset;
+    e->n_det = job->od_results.count;
+    e->jpeg_size = (uint32_t)jpeg.size();
+    e->width = width;
+    e->height = height;
+    rec->write_off = offset + size;
+    rec->next++;
+}
+
+// Start a clip on a new trigger, or extend the running one
+static void handle_trigger(incident_recorder_t *rec)
+{
+    uint64_t t = __atomic_load_n(&rec->trigger_ns, __ATOMIC_ACQUIRE);
+    if (t <= rec->handled_ns)
+    {
+        return;
+    }
+    uint64_t post_ns = rec->config.post_seconds * 1000000000ull;
+    uint64_t pre_ns = rec->config.pre_seconds * 1000000000ull;
+    if (rec->clip_active)
+    {
+        if (!rec->clip_closed)
+        {
+            rec->handled_ns = t;
+            rec->clip_end_ns = t + post_ns > rec->clip_end_ns ? t + post_ns : rec->clip_end_ns;
+        }
+        // else a new clip once the writer is done with this one
+        return;
+    }
+    rec->handled_ns = t;
+    rec->clip_active = true;
+    rec->clip_closed = false;
+    rec->clip_id++;
+    rec->clip_end_ns = t + post_ns;
+    uint64_t start_ns = t > pre_ns ? t - pre_ns : 0;
+    rec->clip_next = rec->first;
+    while (rec->clip_next < rec->next && rec->entries[rec->clip_next % INCIDENT_MAX_FRAMES].time_ns < start_ns)
+    {
+        rec->clip_next++;
+    }
+}
+
+static void *encoder_main(void *arg)
+{
+    incident_recorder_t *rec = (incident_recorder_t *)arg;
+    lower_priority();
+    std::vector<unsigned char> jpeg; // grows to the largest frame once
+    std::vector<int> params;
+    params.push_back(cv::IMWRITE_JPEG_QUALITY);
+    params.push_back(rec->config.jpeg_quality);
+
+    void *item;
+    while (spsc_ring_pop(rec->queued, &item, -1) == 0)
+    {
+        incident_job_t *job = (incident_job_t *)item;
+        bool encoded = cv::imencode(".jpg", job->image, jpeg, params);
+        int width = job->image.cols;
+        int height = job->image.rows;
+        job->image.release();
+        if (job->done != NULL)
+        {
+            job->done(job->user);
+        }
+
+        pthread_mutex_lock(&rec->lock);
+        handle_trigger(rec);
+        if (rec->clip_active && !rec->clip_closed && job->time_ns > rec->clip_end_ns)
+        {
+            rec->clip_closed = true;
+            rec->clip_stop = rec->next;
+        }
+        if (encoded)
+        {
+            append_frame(rec, job, jpeg, width, height);
+        }
+        pthread_cond_signal(&rec->cond);
+        pthread_mutex_unlock(&rec->lock);
+
+        spsc_ring_push(rec->free_jobs, job, NULL);
+    }
+
+    pthread_mutex_lock(&rec->lock);
+    if (rec->clip_active && !rec->clip_closed)
+    {
+        rec->clip_closed = true;
+        rec->clip_stop = rec->next;
+    }
+    rec->stop = true;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->lock);
+    return NULL;
+}
+
+/*-------------------------------------------
+                  Clip writer
+-------------------------------------------*/
+
+static void write_detections(FILE *csv, uint32_t frame, const frame_entry_t *e, const object_detect_result *dets)
+{
+    double time_s = e->time_ns / 1e9;
+    if (e->n_det == 0)
+    {
+        fprintf(csv, "%u,%.3f,-1,,0,0,0,0,0\n", frame, time_s);
+        return;
+    }
+    for (int i = 0; i < e->n_det; i++)
+    {
+        const object_detect_result *d = &dets[i];
+        fprintf(csv, "%u,%.3f,%d,%s,%.3f,%d,%d,%d,%d\n", frame, time_s, d->cls_id, coco_cls_to_name(d->cls_id), d->prop,
+                d->box.left, d->box.top, d->box.right, d->box.bottom);
+    }
+}
+
+static void *writer_main(void *arg)
+{
+    incident_recorder_t *rec = (incident_recorder_t *)arg;
+    lower_priority();
+    avi_writer_t avi;
+    avi.fp = NULL;
+    FILE *csv = NULL;
+    bool opened = false;
+    char avi_path[64];
+
+    pthread_mutex_lock(&rec->lock);
+    while (true)
+    {
+        if (!rec->clip_active)
+        {
+            if (rec->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&rec->cond, &rec->lock);
+            continue;
+        }
+
+        uint64_t limit = rec->clip_closed ? rec->clip_stop : rec->next;
+        if (rec->clip_next < limit)
+        {
+            // pinned, the encoder leaves its bytes alone until clip_next moves
+            frame_entry_t e = rec->entries[rec->clip_next % INCIDENT_MAX_FRAMES];
+            int clip_id = rec->clip_id;
+            pthread_mutex_unlock(&rec->lock);
+
+            if (!opened)
+            {
+                opened = true;
+                char csv_path[64];
+                snprintf(avi_path, sizeof(avi_path), "%s_%04d.avi", rec->config.name, clip_id);
+                snprintf(csv_path, sizeof(csv_path), "%s_%04d.csv", rec->config.name, clip_id);
+                avi_writer_open(&avi, avi_path, e.width, e.height, rec->config.fps);
+                csv = fopen(csv_path, "w");
+                if (csv != NULL)
+                {
+                    fprintf(csv, "frame,time_s,cls_id,class,prop,left,top,right,bottom\n");
+                }
+            }
+            const unsigned char *data = rec->buffer + e.offset;
+            size_t det_bytes = e.n_det * sizeof(object_detect_result);
+            if (csv != NULL)
+            {
+                write_detections(csv, avi.n_frames, &e, (const object_detect_result *)data);
+            }
+            if (avi.fp != NULL && avi_writer_add_frame(&avi, data + det_bytes, e.jpeg_size) != 0)
+            {
+                LOGE("incident: write %s fail!", avi_path);
+                avi_writer_close(&avi);
+            }
+
+            pthread_mutex_lock(&rec->lock);
+            rec->clip_next++;
+            continue;
+        }
+        if (!rec->clip_closed)
+        {
+            pthread_cond_wait(&rec->cond, &rec->lock);
+            continue;
+        }
+
+        // the clip is complete
+        pthread_mutex_unlock(&rec->lock);
+        if (opened)
+        {
+            uint32_t n_frames = avi.n_frames;
+            if (avi.fp != NULL && avi_writer_close(&avi) == 0)
+            {
+                LOGI("incident clip %s: %u frames", avi_path, n_frames);
+            }
+            if (csv != NULL)
+            {
+                fclose(csv);
+                csv = NULL;
+            }
+            opened = false;
+        }
+        pthread_mutex_lock(&rec->lock);
+        rec->clip_active = false;
+    }
+    pthread_mutex_unlock(&rec->lock);
+    return NULL;
+}
+
+/*-------------------------------------------
+                  Public
+-------------------------------------------*/
+
+incident_recorder_t *incident_recorder_create(const incident_config_t *config)
+{
+    if (config->buffer_bytes == 0 || config->fps < 1 || config->pre_seconds < 0 || config->post_seconds < 0)
+    {
+        return NULL;
+    }
+    incident_recorder_t *rec = new incident_recorder_t();
+    rec->config = *config;
+    rec->interval_ns = 1000000000ull / config->fps;
+    pthread_mutex_init(&rec->lock, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    rec->buffer = (unsigned char *)malloc(config->buffer_bytes);
+    rec->jobs = new incident_job_t[INCIDENT_QUEUE_SIZE + 1];
+    rec->queued = spsc_ring_create(INCIDENT_QUEUE_SIZE + 1, SPSC_RING_BLOCK);
+    rec->free_jobs = spsc_ring_create(INCIDENT_QUEUE_SIZE + 1, SPSC_RING_BLOCK);
+    if (rec->buffer == NULL || rec->queued == NULL || rec->free_jobs == NULL)
+    {
+        printf("incident: out of memory\n");
+        incident_recorder_destroy(rec);
+        return NULL;
+    }
+    // INCIDENT_QUEUE_SIZE waiting and one with the encoder
+    for (int i = 0; i < INCIDENT_QUEUE_SIZE + 1; i++)
+    {
+        spsc_ring_push(rec->free_jobs, &rec->jobs[i], NULL);
+    }
+
+    rec->writer_started = pthread_create(&rec->writer, NULL, writer_main, rec) == 0;
+    rec->encoder_started = rec->writer_started && pthread_create(&rec->encoder, NULL, encoder_main, rec) == 0;
+    if (!rec->encoder_started)
+    {
+        printf("incident: pthread_create fail!\n");
+        incident_recorder_destroy(rec);
+        return NULL;
+    }
+    return rec;
+}
+
+void incident_recorder_destroy(incident_recorder_t *rec)
+{
+    if (rec == NULL)
+    {
+        return;
+    }
+    if (rec->queued != NULL)
+    {
+        spsc_ring_close(rec->queued);
+    }
+    if (rec->encoder_started)
+    {
+        pthread_join(rec->encoder, NULL);
+    }
+    else
+    {
+        pthread_mutex_lock(&rec->lock);
+        rec->stop = true;
+        pthread_cond_signal(&rec->cond);
+        pthread_mutex_unlock(&rec->lock);
+    }
+    if (rec->writer_started)
+    {
+        pthread_join(rec->writer, NULL);
+    }
+    spsc_ring_destroy(rec->queued);
+    spsc_ring_destroy(rec->free_jobs);
+    delete[] rec->jobs;
+    free(rec->buffer);
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->lock);
+    delete rec;
+}
+
+int incident_recorder_submit(incident_recorder_t *rec, const cv::Mat &image, const object_detect_result_list *od_results,
+                             uint64_t time_ns, incident_done_fn done, void *user)
+{
+    // frames with detections go in regardless, the clip should show them
+    if (time_ns < rec->next_due_ns && od_results->count == 0)
+    {
+        return 1;
+    }
+    void *item;
+    if (spsc_ring_pop(rec->free_jobs, &item, 0) != 0)
+    {
+        return 1;
+    }
+    incident_job_t *job = (incident_job_t *)item;
+    job->image = image; // header only, the pixels are shared
+    job->od_results.id = od_results->id;
+    job->od_results.count = od_results->count;
+    memcpy(job->od_results.results, od_results->results, od_results->count * sizeof(object_detect_result));
+    job->time_ns = time_ns;
+    job->done = done;
+    job->user = user;
+    // a free job means room in queued, this does not wait
+    spsc_ring_push(rec->queued, job, NULL);
+
+    rec->next_due_ns += rec->interval_ns;
+    if (rec->next_due_ns <= time_ns)
+    {
+        rec->next_due_ns = time_ns + rec->interval_ns;
+    }
+    return 0;
+}
+
+void incident_recorder_trigger(incident_recorder_t *rec, uint64_t time_ns)
+{
+    uint64_t t = __atomic_load_n(&rec->trigger_ns, __ATOMIC_RELAXED);
+    while (t < time_ns &&
+           !__atomic_compare_exchange_n(&rec->trigger_ns, &t, time_ns, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+uint64_t incident_recorder_overruns(incident_recorder_t *rec)
+{
+    pthread_mutex_lock(&rec->lock);
+    uint64_t overruns = rec->overruns;
+    pthread_mutex_unlock(&rec->lock);
+    return overruns;
+}
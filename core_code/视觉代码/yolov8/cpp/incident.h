@@ -0,0 +1,63 @@
+#ifndef _RKNN_YOLOV8_DEMO_INCIDENT_H_
+#define _RKNN_YOLOV8_DEMO_INCIDENT_H_
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+#include "yolov8.h"
+
+// Incident clips: the last pre_seconds of frames are kept JPEG compressed,
+// with their detections, in a fixed size buffer. A trigger writes them and
+// the following post_seconds to <name>_NNNN.avi (MJPEG) and
+// <name>_NNNN.csv (detections per frame). Encoding and writing run on two
+// low priority threads; submit and trigger never block, frames the encoder
+// cannot keep up with are skipped.
+#ifndef INCIDENT_BUFFER_MB
+#define INCIDENT_BUFFER_MB 16
+#endif
+#ifndef INCIDENT_PRE_SECONDS
+#define INCIDENT_PRE_SECONDS 5
+#endif
+#ifndef INCIDENT_POST_SECONDS
+#define INCIDENT_POST_SECONDS 5
+#endif
+#ifndef INCIDENT_FPS
+#define INCIDENT_FPS 10
+#endif
+#define INCIDENT_JPEG_QUALITY 80
+#define INCIDENT_MAX_FRAMES 512 // frames held at once, at most
+#define INCIDENT_QUEUE_SIZE 2   // frames waiting for the encoder
+#define INCIDENT_NAME_MAX 32
+
+typedef struct {
+    char name[INCIDENT_NAME_MAX]; // file name prefix, "incident"
+    size_t buffer_bytes; // JPEGs and detections, the whole frame memory
+    int pre_seconds;
+    int post_seconds;
+    int fps;             // frames kept per second, plus those with detections
+    int jpeg_quality;
+} incident_config_t;
+
+typedef struct incident_recorder incident_recorder_t;
+
+// done(user) is called on the encoder thread once image is no longer read
+typedef void (*incident_done_fn)(void *user);
+
+incident_recorder_t *incident_recorder_create(const incident_config_t *config);
+// Finishes the clip being recorded, if any, then stops the threads.
+void incident_recorder_destroy(incident_recorder_t *rec);
+
+// Offer a frame. time_ns orders frames and triggers (one clock for both).
+// Returns 0 if taken, image must then not be written until done(user), and
+// 1 if skipped (not due yet, or the encoder is busy; done is not called).
+int incident_recorder_submit(incident_recorder_t *rec, const cv::Mat &image, const object_detect_result_list *od_results,
+                             uint64_t time_ns, incident_done_fn done, void *user);
+
+// An event at time_ns: starts a clip, or extends the one being recorded.
+void incident_recorder_trigger(incident_recorder_t *rec, uint64_t time_ns);
+
+// Frames skipped because the buffer was held by a clip being written
+uint64_t incident_recorder_overruns(incident_recorder_t *rec);
+
+#endif //_RKNN_YOLOV8_DEMO_INCIDENT_H_
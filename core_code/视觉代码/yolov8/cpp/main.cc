@@ -24,7 +24,20 @@
 #include "image_utils.h"
 #include "file_utils.h"
 #include "image_drawing.h"
+#include "async_log.h"
+#include "camera.h"
+#include "capture.h"
+#include "incident.h"
+#include "npu_pool.h"
+#include "snapshot.h"
+#include "spsc_ring.h"
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
 #include <opencv2/opencv.hpp> // 添加 OpenCV 库
 #if defined(RV1106_1103) 
     #include "dma_alloc.hpp"
@@ -149,118 +162,619 @@ int main(int argc, char **argv)
     return 0;
 }
 */
+
+// Capture, preprocess and NPU run on their own threads, the main thread
+// reports results. Stages hand frames on through spsc rings, so the camera
+// reads frame N+1 and the report of frame N-1 happens while the NPU runs N.
+// With several cameras each has its own capture thread and ring, and the
+// preprocess stage schedules them round robin onto the one NPU pool.
+#define PIPELINE_RING_SIZE 2
+// 1: when the NPU falls behind the camera the oldest waiting frame is
+// dropped, so latency stays bounded. 0: the camera is throttled instead.
+#ifndef PIPELINE_LATEST_FRAME_WINS
+#define PIPELINE_LATEST_FRAME_WINS 1
+#endif
+#define PIPELINE_NPU_POLL_US 1000 // input wait while results are outstanding
+#define PIPELINE_FPS_LOG_MS 1000  // FPS line at most once a second
+
+typedef struct {
+    cv::Mat image;             // BGR from the camera
+    image_buffer_t src_image;  // wraps image for the NPU
+    int camera;                // pipeline_camera_t::cam.id
+    uint64_t seq;              // per camera
+    struct timeval capture_time;
+    int ret;
+    object_detect_result_list od_results;
+    uint64_t allocs;           // npu_pool_result_t::allocs
+    int refs;                  // stages and snapshots holding the frame, 0 when free
+} pipeline_frame_t;
+
+struct pipeline;
+
+typedef struct {
+    struct pipeline *pipe;
+    camera_t cam;
+    spsc_ring_t *captured;      // capture -> preprocess
+    int64_t next_due_us;        // preprocess: no frame goes to the NPU before
+    // main thread
+    incident_recorder_t *incidents;
+    int saved;
+    int inferred;               // since the last FPS line
+} pipeline_camera_t;
+
+typedef struct pipeline {
+    pipeline_camera_t cameras[CAMERA_MAX];
+    int n_cameras;
+    npu_pool_t *pool;
+    std::vector<pipeline_frame_t> frames;
+    sem_t captured_items;       // one token per push or close of any captured ring, wakes the scheduler
+    spsc_ring_t *preprocessed;  // preprocess -> NPU
+    spsc_ring_t *detected;      // NPU -> main thread, never drops
+} pipeline_t;
+
+static int64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static pipeline_frame_t *acquire_frame(pipeline_t *pipe)
+{
+    // every stage and ring slot can hold a frame at once, so one is always
+    // free; the wait only covers the release racing with the scan
+    while (true)
+    {
+        for (size_t i = 0; i < pipe->frames.size(); i++)
+        {
+            pipeline_frame_t *frame = &pipe->frames[i];
+            int free_refs = 0;
+            if (__atomic_compare_exchange_n(&frame->refs, &free_refs, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            {
+                return frame;
+            }
+        }
+        usleep(1000);
+    }
+}
+
+static void release_frame(pipeline_frame_t *frame)
+{
+    if (frame != NULL)
+    {
+        __atomic_fetch_sub(&frame->refs, 1, __ATOMIC_RELEASE);
+    }
+}
+
+// snapshot_done_fn / incident_done_fn, the encoder is done reading the frame
+static void release_encoded_frame(void *user) { release_frame((pipeline_frame_t *)user); }
+
+// End of a camera's stream, the scheduler notices on its next pass
+static void close_captured(pipeline_camera_t *camera)
+{
+    spsc_ring_close(camera->captured);
+    sem_post(&camera->pipe->captured_items);
+}
+
+// Returns -1 if the ring is closed, the frame is released then
+static int push_frame(spsc_ring_t *ring, pipeline_frame_t *frame)
+{
+    void *dropped = NULL;
+    int ret = spsc_ring_push(ring, frame, &dropped);
+    if (ret != 0)
+    {
+        release_frame(frame);
+    }
+    release_frame((pipeline_frame_t *)dropped);
+    return ret;
+}
+
+static void *capture_main(void *arg)
+{
+    pipeline_camera_t *camera = (pipeline_camera_t *)arg;
+    uint64_t seq = 0;
+    while (true)
+    {
+        pipeline_frame_t *frame = acquire_frame(camera->pipe);
+        if (!camera_read(&camera->cam, frame->image))
+        {
+            printf("Error: Failed to read frame from camera %s\n", camera->cam.name);
+            release_frame(frame);
+            break;
+        }
+        gettimeofday(&frame->capture_time, NULL);
+        frame->camera = camera->cam.id;
+        frame->seq = seq++;
+        if (push_frame(camera->captured, frame) != 0)
+        {
+            break;
+        }
+        sem_post(&camera->pipe->captured_items);
+    }
+    close_captured(camera);
+    return NULL;
+}
+
+typedef struct {
+    int next;                   // camera asked first
+    int n_open;
+    bool open[CAMERA_MAX];
+} pipeline_sched_t;
+
+// Scheduler sleep until a camera pushes or closes, or until deadline_us
+// (now_us() clock, < 0 none) when a camera's next frame falls due
+static void wait_captured(pipeline_t *pipe, int64_t deadline_us)
+{
+    int ret;
+    if (deadline_us < 0)
+    {
+        do
+        {
+            ret = sem_wait(&pipe->captured_items);
+        } while (ret != 0 && errno == EINTR);
+        return;
+    }
+    int64_t wait_us = deadline_us - now_us();
+    if (wait_us <= 0)
+    {
+        return;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_us / 1000000;
+    deadline.tv_nsec += (wait_us % 1000000) * 1000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    do
+    {
+        ret = sem_timedwait(&pipe->captured_items, &deadline);
+    } while (ret != 0 && errno == EINTR);
+}
+
+// Next camera frame for the NPU: cameras take turns, starting after the one
+// served last, and one with a frame rate target only when its frame is due.
+// Between frames it sleeps on captured_items, not in a poll. Returns NULL
+// once every camera has stopped.
+static pipeline_frame_t *schedule_frame(pipeline_t *pipe, pipeline_sched_t *sched)
+{
+    while (sched->n_open > 0)
+    {
+        int64_t now = now_us();
+        int64_t next_due = -1;
+        for (int i = 0; i < pipe->n_cameras; i++)
+        {
+            int c = (sched->next + i) % pipe->n_cameras;
+            pipeline_camera_t *camera = &pipe->cameras[c];
+            if (!sched->open[c])
+            {
+                continue;
+            }
+            if (now < camera->next_due_us)
+            {
+                next_due = next_due < 0 || camera->next_due_us < next_due ? camera->next_due_us : next_due;
+                continue;
+            }
+            void *item;
+            int ret = spsc_ring_pop(camera->captured, &item, 0);
+            if (ret < 0)
+            {
+                sched->open[c] = false;
+                sched->n_open--;
+                continue;
+            }
+            if (ret > 0)
+            {
+                continue;
+            }
+            if (camera->cam.fps_target > 0)
+            {
+                // keep the cadence, but a camera that was late gets no burst
+                int64_t interval = (int64_t)(1000000 / camera->cam.fps_target);
+                camera->next_due_us = (now - camera->next_due_us < interval ? camera->next_due_us : now) + interval;
+            }
+            sched->next = c + 1;
+            return (pipeline_frame_t *)item;
+        }
+        if (sched->n_open > 0)
+        {
+            // tokens of frames already taken or dropped only cost a rescan
+            wait_captured(pipe, next_due);
+        }
+    }
+    return NULL;
+}
+
+static void *preprocess_main(void *arg)
+{
+    pipeline_t *pipe = (pipeline_t *)arg;
+    pipeline_sched_t sched;
+    sched.next = 0;
+    sched.n_open = pipe->n_cameras;
+    for (int c = 0; c < pipe->n_cameras; c++)
+    {
+        sched.open[c] = true;
+    }
+    pipeline_frame_t *frame;
+    while ((frame = schedule_frame(pipe, &sched)) != NULL)
+    {
+
+        // no cvtColor: the letterbox kernel swaps channels while it resizes
+        image_buffer_t *src_image = &frame->src_image;
+        memset(src_image, 0, sizeof(image_buffer_t));
+        src_image->virt_addr = frame->image.data;
+        src_image->width = frame->image.cols;
+        src_image->height = frame->image.rows;
+        src_image->width_stride = (int)(frame->image.step[0] / 3);
+        src_image->format = IMAGE_FORMAT_BGR888;
+
+        push_frame(pipe->preprocessed, frame);
+    }
+    spsc_ring_close(pipe->preprocessed);
+    return NULL;
+}
+
+static void *npu_main(void *arg)
+{
+    pipeline_t *pipe = (pipeline_t *)arg;
+    int depth = npu_pool_depth(pipe->pool);
+    bool input_open = true;
+    npu_pool_result_t result;
+    void *item;
+
+    while (true)
+    {
+        // keep every context busy: fill the pool before waiting on a result
+        int pending = npu_pool_pending(pipe->pool);
+        if (input_open && pending < depth)
+        {
+            int ret = spsc_ring_pop(pipe->preprocessed, &item, pending == 0 ? -1 : PIPELINE_NPU_POLL_US);
+            if (ret == 0)
+            {
+                pipeline_frame_t *frame = (pipeline_frame_t *)item;
+                npu_pool_submit(pipe->pool, &frame->src_image, frame);
+                continue;
+            }
+            input_open = ret > 0;
+        }
+
+        // results come back in camera order, -1 once the input closed and
+        // everything in flight is done
+        int ret = npu_pool_get_result(pipe->pool, &result, !input_open || pending == depth);
+        if (ret < 0)
+        {
+            break;
+        }
+        if (ret > 0)
+        {
+            continue;
+        }
+        pipeline_frame_t *frame = (pipeline_frame_t *)result.user;
+        frame->ret = result.ret;
+        frame->allocs = result.allocs;
+        memcpy(&frame->od_results, &result.od_results, sizeof(object_detect_result_list));
+        push_frame(pipe->detected, frame);
+    }
+    spsc_ring_close(pipe->detected);
+    return NULL;
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    if (argc != 3 && argc != 4)
     {
-        printf("Usage: %s <model_path> <camera_id>\n", argv[0]);
+        printf("Usage: %s <model_path> <cameras> [capture_file]\n", argv[0]);
         printf("Example: %s model/yolov8.rknn 0\n", argv[0]);
+        printf("         %s model/yolov8.rknn 0,1@15,pool.mp4@10\n", argv[0]);
+        printf("cameras are V4L2 device numbers or looping video files, @fps caps the NPU rate of one\n");
+        printf("capture_file records the model outputs of every frame for replay\n");
         return -1;
     }
 
     const char *model_path = argv[1];
-    int camera_id = atoi(argv[2]);
+    const char *capture_path = argc == 4 ? argv[3] : NULL;
 
-    // 初始化摄像头
-    cv::VideoCapture cap(camera_id);
-    if (!cap.isOpened())
+    pipeline_t pipe;
+    camera_t cameras[CAMERA_MAX];
+    int n_cameras = camera_parse_list(argv[2], cameras, CAMERA_MAX);
+    if (n_cameras < 0)
     {
-        printf("Error: Could not open camera %d\n", camera_id);
         return -1;
     }
 
-    // 设置摄像头分辨率
+    // 初始化摄像头, 设置摄像头分辨率
     int model_width = 640;
     int model_height = 640;
-    cap.set(cv::CAP_PROP_FRAME_WIDTH, model_width);
-    cap.set(cv::CAP_PROP_FRAME_HEIGHT, model_height);
+    for (int c = 0; c < n_cameras; c++)
+    {
+        pipeline_camera_t *camera = &pipe.cameras[c];
+        camera->pipe = &pipe;
+        camera->cam = cameras[c];
+        camera->captured = NULL;
+        camera->next_due_us = 0;
+        camera->incidents = NULL;
+        camera->saved = 0;
+        camera->inferred = 0;
+        if (camera_open(&camera->cam, model_width, model_height) != 0)
+        {
+            for (int i = 0; i < c; i++)
+            {
+                camera_close(&pipe.cameras[i].cam);
+            }
+            return -1;
+        }
+    }
+    pipe.n_cameras = n_cameras;
 
-    // 初始化模型
-    rknn_app_context_t rknn_app_ctx;
-    memset(&rknn_app_ctx, 0, sizeof(rknn_app_context_t));
-    int ret = init_yolov8_model(model_path, &rknn_app_ctx);
-    if (ret != 0)
+    // 初始化模型, NPU_POOL_WORKERS 个 context 分别跑在不同的 NPU 核上
+    npu_pool_t *pool = npu_pool_create(model_path, NPU_POOL_WORKERS, NPU_POOL_DISPATCH);
+    if (pool == NULL)
     {
-        printf("init_yolov8_model fail! ret=%d\n", ret);
+        printf("npu_pool_create fail!\n");
+        for (int c = 0; c < pipe.n_cameras; c++)
+        {
+            camera_close(&pipe.cameras[c].cam);
+        }
         return -1;
     }
+    if (capture_path != NULL)
+    {
+        // the capture file is written by a single context
+        rknn_app_context_t *app_ctx = npu_pool_context(pool, 0);
+        if (npu_pool_workers(pool) == 1 && app_ctx->batch == 1)
+        {
+            app_ctx->capture = output_capture_open(capture_path);
+        }
+        if (app_ctx->capture == NULL)
+        {
+            printf("capture_file needs NPU_POOL_WORKERS=1 and a batch-1 model\n");
+            npu_pool_destroy(pool);
+            for (int c = 0; c < pipe.n_cameras; c++)
+            {
+                camera_close(&pipe.cameras[c].cam);
+            }
+            return -1;
+        }
+    }
 
     init_post_process();
 
-    cv::Mat frame;
-    struct timeval start_time, end_time;
-    float fps = 0;
-    int frame_count = 0;
+    spsc_ring_policy_t policy = PIPELINE_LATEST_FRAME_WINS ? SPSC_RING_DROP_OLDEST : SPSC_RING_BLOCK;
+    pipe.pool = pool;
+    // with several cameras the scheduler decides which frame the NPU takes
+    // next, so its ring must not evict one; the camera rings drop instead
+    sem_init(&pipe.captured_items, 0, 0);
+    pipe.preprocessed = spsc_ring_create(PIPELINE_RING_SIZE, pipe.n_cameras > 1 ? SPSC_RING_BLOCK : policy);
+    pipe.detected = spsc_ring_create(PIPELINE_RING_SIZE, SPSC_RING_BLOCK);
+    // the buffer budget is split between the cameras' incident recorders
+    incident_config_t incident_config;
+    incident_config.buffer_bytes = ((size_t)INCIDENT_BUFFER_MB << 20) / pipe.n_cameras;
+    incident_config.pre_seconds = INCIDENT_PRE_SECONDS;
+    incident_config.post_seconds = INCIDENT_POST_SECONDS;
+    incident_config.fps = INCIDENT_FPS;
+    incident_config.jpeg_quality = INCIDENT_JPEG_QUALITY;
+    bool cameras_ready = true;
+    for (int c = 0; c < pipe.n_cameras; c++)
+    {
+        pipeline_camera_t *camera = &pipe.cameras[c];
+        camera->captured = spsc_ring_create(PIPELINE_RING_SIZE, policy);
+        if (pipe.n_cameras > 1)
+        {
+            snprintf(incident_config.name, sizeof(incident_config.name), "incident_cam%d", c);
+        }
+        else
+        {
+            snprintf(incident_config.name, sizeof(incident_config.name), "incident");
+        }
+        camera->incidents = incident_recorder_create(&incident_config);
+        cameras_ready = cameras_ready && camera->captured != NULL && camera->incidents != NULL;
+    }
+    // one frame in each stage, each ring slot, each frame in flight on the
+    // NPU and each snapshot or incident frame queued or being encoded
+    pipe.frames.resize(3 + pipe.n_cameras + (2 + pipe.n_cameras) * PIPELINE_RING_SIZE + npu_pool_depth(pool) +
+                       SNAPSHOT_QUEUE_SIZE + SNAPSHOT_THREADS + pipe.n_cameras * (INCIDENT_QUEUE_SIZE + 1));
+    for (size_t i = 0; i < pipe.frames.size(); i++)
+    {
+        pipe.frames[i].refs = 0;
+    }
+    snapshot_writer_t *snapshots = snapshot_writer_create(SNAPSHOT_THREADS, SNAPSHOT_QUEUE_SIZE, SNAPSHOT_JPEG_QUALITY);
 
-    // 添加结果保存功能
-    int save_count = 0;
-    const int SAVE_INTERVAL = 30; // 每30帧保存一次
+    // per frame output goes through the log thread from here on
+    async_log_start();
 
-    while (true)
+    pthread_t capture_threads[CAMERA_MAX], preprocess_thread, npu_thread;
+    int n_started = 0;
+    if (cameras_ready && pipe.preprocessed != NULL && pipe.detected != NULL && snapshots != NULL)
     {
-        gettimeofday(&start_time, NULL);
-
-        if (!cap.read(frame))
+        n_started += pthread_create(&npu_thread, NULL, npu_main, &pipe) == 0;
+        n_started += n_started == 1 && pthread_create(&preprocess_thread, NULL, preprocess_main, &pipe) == 0;
+        for (int c = 0; c < pipe.n_cameras && n_started == 2 + c; c++)
         {
-            printf("Error: Failed to read frame\n");
-            break;
+            n_started += pthread_create(&capture_threads[c], NULL, capture_main, &pipe.cameras[c]) == 0;
+        }
+    }
+    if (n_started != 2 + pipe.n_cameras)
+    {
+        printf("start pipeline fail!\n");
+        // unwind the stages that did start: closed camera rings stop the
+        // cameras and then the scheduler, a closed result ring makes the NPU
+        // stage discard what is still in flight
+        if (n_started > 0)
+        {
+            for (int c = 0; c < pipe.n_cameras; c++)
+            {
+                close_captured(&pipe.cameras[c]);
+            }
+            if (n_started == 1)
+            {
+                spsc_ring_close(pipe.preprocessed);
+            }
+            spsc_ring_close(pipe.detected);
+        }
+        for (int c = 0; c < n_started - 2; c++)
+        {
+            pthread_join(capture_threads[c], NULL);
+        }
+        if (n_started > 1)
+        {
+            pthread_join(preprocess_thread, NULL);
         }
+        if (n_started > 0)
+        {
+            pthread_join(npu_thread, NULL);
+        }
+        for (int c = 0; c < pipe.n_cameras; c++)
+        {
+            spsc_ring_destroy(pipe.cameras[c].captured);
+            incident_recorder_destroy(pipe.cameras[c].incidents);
+            camera_close(&pipe.cameras[c].cam);
+        }
+        spsc_ring_destroy(pipe.preprocessed);
+        spsc_ring_destroy(pipe.detected);
+        sem_destroy(&pipe.captured_items);
+        snapshot_writer_destroy(snapshots);
+        npu_pool_destroy(pool);
+        deinit_post_process();
+        async_log_stop();
+        return -1;
+    }
 
-        cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
+    struct timeval start_time, end_time, camera_log_time;
+    float fps = 0;
+    int frame_count = 0;
+    void *item;
 
-        image_buffer_t src_image;
-        memset(&src_image, 0, sizeof(image_buffer_t));
-        src_image.virt_addr = frame.data;
-        src_image.width = frame.cols;
-        src_image.height = frame.rows;
-        src_image.format = IMAGE_FORMAT_RGB888;
+    // 添加结果保存功能
+    const int SAVE_INTERVAL = 30; // 每个摄像头每30帧保存一次
 
-        object_detect_result_list od_results;
-        ret = inference_yolov8_model(&rknn_app_ctx, &src_image, &od_results);
-        if (ret != 0)
+    gettimeofday(&start_time, NULL);
+    camera_log_time = start_time;
+    while (spsc_ring_pop(pipe.detected, &item, -1) == 0)
+    {
+        pipeline_frame_t *frame = (pipeline_frame_t *)item;
+        pipeline_camera_t *camera = &pipe.cameras[frame->camera];
+        if (frame->ret != 0)
         {
-            printf("inference_yolov8_model fail! ret=%d\n", ret);
+            LOGE("inference_yolov8_model fail! camera %d ret=%d", frame->camera, frame->ret);
+            release_frame(frame);
             continue;
         }
+        object_detect_result_list &od_results = frame->od_results;
+#if defined(ALLOC_STATS)
+        // counted on the NPU worker around inference and post_process only
+        LOGI("heap allocations per frame: %llu", (unsigned long long)frame->allocs);
+#endif
 
         // 控制台输出检测结果
-        printf("\n------ Frame %d ------\n", frame_count);
+        LOGI("------ Frame %d, camera %d ------", frame_count, frame->camera);
         for (int i = 0; i < od_results.count; i++)
         {
             object_detect_result *det_result = &(od_results.results[i]);
-            printf("[%s] Box(%d,%d,%d,%d) Conf:%.1f%%\n", 
-                   coco_cls_to_name(det_result->cls_id),
-                   det_result->box.left, det_result->box.top,
-                   det_result->box.right, det_result->box.bottom,
-                   det_result->prop * 100);
+            LOGI("[camera %d] [%s] Box(%d,%d,%d,%d) Conf:%.1f%%",
+                 frame->camera,
+                 coco_cls_to_name(det_result->cls_id),
+                 det_result->box.left, det_result->box.top,
+                 det_result->box.right, det_result->box.bottom,
+                 det_result->prop * 100);
         }
 
-        // 定期保存带标注的图像
-        if (save_count % SAVE_INTERVAL == 0)
+        // any detection of the drowning model is an incident; the recorder
+        // keeps the seconds before it and holds a reference to the frames it
+        // takes until they are encoded
+        uint64_t capture_ns = (uint64_t)frame->capture_time.tv_sec * 1000000000ull +
+                              (uint64_t)frame->capture_time.tv_usec * 1000;
+        if (od_results.count > 0)
+        {
+            incident_recorder_trigger(camera->incidents, capture_ns);
+        }
+        __atomic_fetch_add(&frame->refs, 1, __ATOMIC_RELAXED);
+        if (incident_recorder_submit(camera->incidents, frame->image, &od_results, capture_ns, release_encoded_frame,
+                                     frame) != 0)
+        {
+            release_frame(frame);
+        }
+
+        // 定期保存带标注的图像, encoded on the snapshot threads which hold
+        // a reference to the frame until then; dropped if they are busy
+        if (camera->saved % SAVE_INTERVAL == 0)
         {
-            cv::Mat output_frame;
-            cv::cvtColor(frame, output_frame, cv::COLOR_RGB2BGR);
             char filename[64];
-            sprintf(filename, "result_%04d.jpg", save_count/SAVE_INTERVAL);
-            cv::imwrite(filename, output_frame);
-            printf("Saved result to %s\n", filename);
+            if (pipe.n_cameras > 1)
+            {
+                sprintf(filename, "result_cam%d_%04d.jpg", frame->camera, camera->saved / SAVE_INTERVAL);
+            }
+            else
+            {
+                sprintf(filename, "result_%04d.jpg", camera->saved / SAVE_INTERVAL);
+            }
+            __atomic_fetch_add(&frame->refs, 1, __ATOMIC_RELAXED);
+            if (snapshot_writer_submit(snapshots, frame->image, filename, release_encoded_frame, frame) != 0)
+            {
+                LOGW("snapshot %s dropped", filename);
+                release_frame(frame);
+            }
         }
-        save_count++;
+        camera->saved++;
+        camera->inferred++;
 
-        // 计算帧率
+        // 计算帧率, 两次结果之间的间隔; 延迟从采集到这里
         gettimeofday(&end_time, NULL);
         float time_use = (end_time.tv_sec - start_time.tv_sec) * 1000 + 
                         (end_time.tv_usec - start_time.tv_usec) / 1000.0;
+        float latency = (end_time.tv_sec - frame->capture_time.tv_sec) * 1000 +
+                        (end_time.tv_usec - frame->capture_time.tv_usec) / 1000.0;
+        start_time = end_time;
         fps = 1000.0 / time_use;
-        printf("Current FPS: %.2f\n", fps);
+        uint64_t dropped = spsc_ring_dropped(pipe.preprocessed);
+        for (int c = 0; c < pipe.n_cameras; c++)
+        {
+            dropped += spsc_ring_dropped(pipe.cameras[c].captured);
+        }
+        LOG_EVERY_MS(ASYNC_LOG_INFO, PIPELINE_FPS_LOG_MS, "Current FPS: %.2f, latency %.1f ms, dropped %llu", fps, latency,
+                     (unsigned long long)dropped);
+
+        // the share of the NPU each camera got
+        float camera_log_ms = (end_time.tv_sec - camera_log_time.tv_sec) * 1000 +
+                              (end_time.tv_usec - camera_log_time.tv_usec) / 1000.0;
+        if (pipe.n_cameras > 1 && camera_log_ms >= PIPELINE_FPS_LOG_MS)
+        {
+            for (int c = 0; c < pipe.n_cameras; c++)
+            {
+                LOGI("camera %d (%s): %.2f FPS, dropped %llu", c, pipe.cameras[c].cam.name,
+                     pipe.cameras[c].inferred * 1000.0 / camera_log_ms,
+                     (unsigned long long)spsc_ring_dropped(pipe.cameras[c].captured));
+                pipe.cameras[c].inferred = 0;
+            }
+            camera_log_time = end_time;
+        }
 
+        release_frame(frame);
         frame_count++;
     }
 
-    // 释放资源
-    cap.release();
-    release_yolov8_model(&rknn_app_ctx);
+    // 释放资源, the stages stop one after another once the cameras do
+    for (int c = 0; c < pipe.n_cameras; c++)
+    {
+        pthread_join(capture_threads[c], NULL);
+    }
+    pthread_join(preprocess_thread, NULL);
+    pthread_join(npu_thread, NULL);
+    for (int c = 0; c < pipe.n_cameras; c++)
+    {
+        spsc_ring_destroy(pipe.cameras[c].captured);
+        incident_recorder_destroy(pipe.cameras[c].incidents);
+        camera_close(&pipe.cameras[c].cam);
+    }
+    spsc_ring_destroy(pipe.preprocessed);
+    spsc_ring_destroy(pipe.detected);
+    sem_destroy(&pipe.captured_items);
+    snapshot_writer_destroy(snapshots);
+    output_capture_close(npu_pool_context(pool, 0)->capture);
+    npu_pool_destroy(pool);
     deinit_post_process();
+    async_log_stop();
 
     return 0;
 }
@@ -0,0 +1,307 @@
+#include "nms.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NMS_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define NMS_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define NMS_SSE2
+#endif
+
+int nms_workspace_init(nms_workspace_t *ws, int capacity)
+{
+    memset(ws, 0, sizeof(nms_workspace_t));
+    if (capacity <= 0)
+    {
+        return 0;
+    }
+    ws->capacity = capacity;
+    ws->x1 = (float *)malloc(capacity * sizeof(float));
+    ws->y1 = (float *)malloc(capacity * sizeof(float));
+    ws->x2 = (float *)malloc(capacity * sizeof(float));
+    ws->y2 = (float *)malloc(capacity * sizeof(float));
+    ws->area = (float *)malloc(capacity * sizeof(float));
+    ws->cls = (int *)malloc(capacity * sizeof(int));
+    ws->suppressed = (uint8_t *)malloc(capacity * sizeof(uint8_t));
+    ws->cell_start = (int *)malloc((NMS_GRID_MAX_SIDE * NMS_GRID_MAX_SIDE + 1) * sizeof(int));
+    ws->cell_items = (int *)malloc(capacity * sizeof(int));
+    if (!ws->x1 || !ws->y1 || !ws->x2 || !ws->y2 || !ws->area || !ws->cls || !ws->suppressed ||
+        !ws->cell_start || !ws->cell_items)
+    {
+        printf("nms workspace malloc fail! capacity=%d\n", capacity);
+        nms_workspace_release(ws);
+        return -1;
+    }
+    return 0;
+}
+
+void nms_workspace_release(nms_workspace_t *ws)
+{
+    free(ws->x1);
+    free(ws->y1);
+    free(ws->x2);
+    free(ws->y2);
+    free(ws->area);
+    free(ws->cls);
+    free(ws->suppressed);
+    free(ws->cell_start);
+    free(ws->cell_items);
+    memset(ws, 0, sizeof(nms_workspace_t));
+}
+
+// IoU(i, j) > threshold without the division, same +1 pixel convention as
+// the original CalculateOverlap.
+static inline bool overlap_c(const nms_workspace_t *ws, int i, int j, float threshold)
+{
+    float w = fmaxf(0.f, fminf(ws->x2[i], ws->x2[j]) - fmaxf(ws->x1[i], ws->x1[j]) + 1.0f);
+    float h = fmaxf(0.f, fminf(ws->y2[i], ws->y2[j]) - fmaxf(ws->y1[i], ws->y1[j]) + 1.0f);
+    float inter = w * h;
+    float uni = ws->area[i] + ws->area[j] - inter;
+    return uni > 0.f && inter > threshold * uni;
+}
+
+#if defined(NMS_NEON)
+#define NMS_LANES 4
+static inline uint32_t overlap_lanes(const nms_workspace_t *ws, int i, int j, float threshold)
+{
+    static const uint32_t weights[4] = {1, 2, 4, 8};
+    float32x4_t zero = vdupq_n_f32(0.f);
+    float32x4_t one = vdupq_n_f32(1.f);
+    float32x4_t xx1 = vmaxq_f32(vdupq_n_f32(ws->x1[i]), vld1q_f32(ws->x1 + j));
+    float32x4_t yy1 = vmaxq_f32(vdupq_n_f32(ws->y1[i]), vld1q_f32(ws->y1 + j));
+    float32x4_t xx2 = vminq_f32(vdupq_n_f32(ws->x2[i]), vld1q_f32(ws->x2 + j));
+    float32x4_t yy2 = vminq_f32(vdupq_n_f32(ws->y2[i]), vld1q_f32(ws->y2 + j));
+    float32x4_t w = vmaxq_f32(zero, vaddq_f32(vsubq_f32(xx2, xx1), one));
+    float32x4_t h = vmaxq_f32(zero, vaddq_f32(vsubq_f32(yy2, yy1), one));
+    float32x4_t inter = vmulq_f32(w, h);
+    float32x4_t uni = vsubq_f32(vaddq_f32(vdupq_n_f32(ws->area[i]), vld1q_f32(ws->area + j)), inter);
+    uint32x4_t m = vandq_u32(vcgtq_f32(uni, zero), vcgtq_f32(inter, vmulq_n_f32(uni, threshold)));
+    return vaddvq_u32(vandq_u32(m, vld1q_u32(weights)));
+}
+#elif defined(NMS_AVX2)
+#define NMS_LANES 8
+static inline uint32_t overlap_lanes(const nms_workspace_t *ws, int i, int j, float threshold)
+{
+    __m256 zero = _mm256_setzero_ps();
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256 xx1 = _mm256_max_ps(_mm256_set1_ps(ws->x1[i]), _mm256_loadu_ps(ws->x1 + j));
+    __m256 yy1 = _mm256_max_ps(_mm256_set1_ps(ws->y1[i]), _mm256_loadu_ps(ws->y1 + j));
+    __m256 xx2 = _mm256_min_ps(_mm256_set1_ps(ws->x2[i]), _mm256_loadu_ps(ws->x2 + j));
+    __m256 yy2 = _mm256_min_ps(_mm256_set1_ps(ws->y2[i]), _mm256_loadu_ps(ws->y2 + j));
+    __m256 w = _mm256_max_ps(zero, _mm256_add_ps(_mm256_sub_ps(xx2, xx1), one));
+    __m256 h = _mm256_max_ps(zero, _mm256_add_ps(_mm256_sub_ps(yy2, yy1), one));
+    __m256 inter = _mm256_mul_ps(w, h);
+    __m256 uni = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps(ws->area[i]), _mm256_loadu_ps(ws->area + j)), inter);
+    __m256 m = _mm256_and_ps(_mm256_cmp_ps(uni, zero, _CMP_GT_OQ),
+                             _mm256_cmp_ps(inter, _mm256_mul_ps(uni, _mm256_set1_ps(threshold)), _CMP_GT_OQ));
+    return (uint32_t)_mm256_movemask_ps(m);
+}
+#elif defined(NMS_SSE2)
+#define NMS_LANES 4
+static inline uint32_t overlap_lanes(const nms_workspace_t *ws, int i, int j, float threshold)
+{
+    __m128 zero = _mm_setzero_ps();
+    __m128 one = _mm_set1_ps(1.f);
+    __m128 xx1 = _mm_max_ps(_mm_set1_ps(ws->x1[i]), _mm_loadu_ps(ws->x1 + j));
+    __m128 yy1 = _mm_max_ps(_mm_set1_ps(ws->y1[i]), _mm_loadu_ps(ws->y1 + j));
+    __m128 xx2 = _mm_min_ps(_mm_set1_ps(ws->x2[i]), _mm_loadu_ps(ws->x2 + j));
+    __m128 yy2 = _mm_min_ps(_mm_set1_ps(ws->y2[i]), _mm_loadu_ps(ws->y2 + j));
+    __m128 w = _mm_max_ps(zero, _mm_add_ps(_mm_sub_ps(xx2, xx1), one));
+    __m128 h = _mm_max_ps(zero, _mm_add_ps(_mm_sub_ps(yy2, yy1), one));
+    __m128 inter = _mm_mul_ps(w, h);
+    __m128 uni = _mm_sub_ps(_mm_add_ps(_mm_set1_ps(ws->area[i]), _mm_loadu_ps(ws->area + j)), inter);
+    __m128 m = _mm_and_ps(_mm_cmpgt_ps(uni, zero), _mm_cmpgt_ps(inter, _mm_mul_ps(uni, _mm_set1_ps(threshold))));
+    return (uint32_t)_mm_movemask_ps(m);
+}
+#endif
+
+// Shift every class onto its own x range so a single class agnostic pass
+// never lets boxes of different classes overlap.
+static void apply_class_offset(nms_workspace_t *ws, int count)
+{
+    bool multi_class = false;
+    float min_x1 = ws->x1[0];
+    float max_x2 = ws->x2[0];
+    for (int k = 1; k < count; k++)
+    {
+        multi_class |= ws->cls[k] != ws->cls[0];
+        min_x1 = fminf(min_x1, ws->x1[k]);
+        max_x2 = fmaxf(max_x2, ws->x2[k]);
+    }
+    if (!multi_class)
+    {
+        return;
+    }
+
+    float offset = max_x2 - min_x1 + 2.0f;
+    for (int k = 0; k < count; k++)
+    {
+        ws->x1[k] += ws->cls[k] * offset;
+        ws->x2[k] += ws->cls[k] * offset;
+    }
+}
+
+static void nms_dense(nms_workspace_t *ws, int count, float threshold)
+{
+    apply_class_offset(ws, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        if (ws->suppressed[i])
+        {
+            continue;
+        }
+        int j = i + 1;
+#if defined(NMS_LANES)
+        for (; j + NMS_LANES <= count; j += NMS_LANES)
+        {
+            uint32_t bits = overlap_lanes(ws, i, j, threshold);
+            for (; bits != 0; bits &= bits - 1)
+            {
+                ws->suppressed[j + __builtin_ctz(bits)] = 1;
+            }
+        }
+#endif
+        for (; j < count; j++)
+        {
+            if (overlap_c(ws, i, j, threshold))
+            {
+                ws->suppressed[j] = 1;
+            }
+        }
+    }
+}
+
+static inline int grid_cell(float v, float origin, float cell, int n)
+{
+    int c = (int)((v - origin) / cell);
+    return c < 0 ? 0 : (c >= n ? n - 1 : c);
+}
+
+// Bucket boxes by centre. Box j can only overlap box i when its centre lies
+// within the largest half extent of i's edges, so only those cells are read.
+static void nms_grid(nms_workspace_t *ws, int count, float threshold)
+{
+    float min_cx = 0, max_cx = 0, min_cy = 0, max_cy = 0;
+    float half_w = 0, half_h = 0;
+    for (int k = 0; k < count; k++)
+    {
+        float cx = (ws->x1[k] + ws->x2[k]) * 0.5f;
+        float cy = (ws->y1[k] + ws->y2[k]) * 0.5f;
+        min_cx = k == 0 ? cx : fminf(min_cx, cx);
+        max_cx = k == 0 ? cx : fmaxf(max_cx, cx);
+        min_cy = k == 0 ? cy : fminf(min_cy, cy);
+        max_cy = k == 0 ? cy : fmaxf(max_cy, cy);
+        half_w = fmaxf(half_w, (ws->x2[k] - ws->x1[k]) * 0.5f);
+        half_h = fmaxf(half_h, (ws->y2[k] - ws->y1[k]) * 0.5f);
+    }
+
+    float cell_w = fmaxf(NMS_GRID_CELL, (max_cx - min_cx) / (NMS_GRID_MAX_SIDE - 1));
+    float cell_h = fmaxf(NMS_GRID_CELL, (max_cy - min_cy) / (NMS_GRID_MAX_SIDE - 1));
+    int gx = (int)((max_cx - min_cx) / cell_w) + 1;
+    int gy = (int)((max_cy - min_cy) / cell_h) + 1;
+    gx = gx > NMS_GRID_MAX_SIDE ? NMS_GRID_MAX_SIDE : gx;
+    gy = gy > NMS_GRID_MAX_SIDE ? NMS_GRID_MAX_SIDE : gy;
+
+#define CELL_X(v) grid_cell(v, min_cx, cell_w, gx)
+#define CELL_Y(v) grid_cell(v, min_cy, cell_h, gy)
+
+    // counting sort into cells, items stay in score order inside each cell
+    int *start = ws->cell_start;
+    memset(start, 0, (gx * gy + 1) * sizeof(int));
+    for (int k = 0; k < count; k++)
+    {
+        int cell = CELL_Y((ws->y1[k] + ws->y2[k]) * 0.5f) * gx + CELL_X((ws->x1[k] + ws->x2[k]) * 0.5f);
+        start[cell + 1]++;
+    }
+    for (int c = 0; c < gx * gy; c++)
+    {
+        start[c + 1] += start[c];
+    }
+    for (int k = 0; k < count; k++)
+    {
+        int cell = CELL_Y((ws->y1[k] + ws->y2[k]) * 0.5f) * gx + CELL_X((ws->x1[k] + ws->x2[k]) * 0.5f);
+        // start[cell] is used as the fill cursor and restored below
+        ws->cell_items[start[cell]++] = k;
+    }
+    for (int c = gx * gy; c > 0; c--)
+    {
+        start[c] = start[c - 1];
+    }
+    start[0] = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (ws->suppressed[i])
+        {
+            continue;
+        }
+        int cx0 = CELL_X(ws->x1[i] - half_w - 1.0f);
+        int cx1 = CELL_X(ws->x2[i] + half_w + 1.0f);
+        int cy0 = CELL_Y(ws->y1[i] - half_h - 1.0f);
+        int cy1 = CELL_Y(ws->y2[i] + half_h + 1.0f);
+        for (int cy = cy0; cy <= cy1; cy++)
+        {
+            for (int cx = cx0; cx <= cx1; cx++)
+            {
+                int cell = cy * gx + cx;
+                for (int it = start[cell]; it < start[cell + 1]; it++)
+                {
+                    int j = ws->cell_items[it];
+                    if (j <= i || ws->suppressed[j] || ws->cls[j] != ws->cls[i])
+                    {
+                        continue;
+                    }
+                    if (overlap_c(ws, i, j, threshold))
+                    {
+                        ws->suppressed[j] = 1;
+                    }
+                }
+            }
+        }
+    }
+#undef CELL_X
+#undef CELL_Y
+}
+
+int nms_run(nms_workspace_t *ws, int count, float threshold, nms_mode_t mode)
+{
+    if (count > ws->capacity)
+    {
+        printf("nms count %d exceeds capacity %d\n", count, ws->capacity);
+        count = ws->capacity;
+    }
+    if (count <= 0)
+    {
+        return 0;
+    }
+    memset(ws->suppressed, 0, count * sizeof(uint8_t));
+
+    if (mode == NMS_MODE_AUTO)
+    {
+        mode = count >= NMS_GRID_MIN_BOXES ? NMS_MODE_GRID : NMS_MODE_DENSE;
+    }
+    if (mode == NMS_MODE_GRID)
+    {
+        nms_grid(ws, count, threshold);
+    }
+    else
+    {
+        nms_dense(ws, count, threshold);
+    }
+
+    int kept = 0;
+    for (int k = 0; k < count; k++)
+    {
+        kept += !ws->suppressed[k];
+    }
+    return kept;
+}
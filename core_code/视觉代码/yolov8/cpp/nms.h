@@ -0,0 +1,49 @@
+#ifndef _RKNN_YOLOV8_DEMO_NMS_H_
+#define _RKNN_YOLOV8_DEMO_NMS_H_
+
+#include <stdint.h>
+
+typedef enum {
+    NMS_MODE_AUTO = 0, // dense below NMS_GRID_MIN_BOXES candidates, grid above
+    NMS_MODE_DENSE,    // every kept box against all lower scored boxes, SIMD IoU
+    NMS_MODE_GRID,     // only boxes whose centres fall in nearby grid cells
+} nms_mode_t;
+
+#define NMS_GRID_MIN_BOXES 256
+#define NMS_GRID_CELL 64      // minimum cell size in model input pixels
+#define NMS_GRID_MAX_SIDE 32  // cells per axis, bigger spreads use bigger cells
+
+// Candidates in struct-of-arrays form, index 0 is the highest score.
+// Boxes of different classes never suppress each other.
+typedef struct {
+    int capacity;
+    float *x1;
+    float *y1;
+    float *x2;
+    float *y2;
+    float *area;
+    int *cls;
+    uint8_t *suppressed;      // output of nms_run, 1 = removed
+    int *cell_start;          // grid mode, NMS_GRID_MAX_SIDE^2 + 1 entries
+    int *cell_items;          // grid mode, capacity entries
+} nms_workspace_t;
+
+int nms_workspace_init(nms_workspace_t *ws, int capacity);
+void nms_workspace_release(nms_workspace_t *ws);
+
+// Store candidate k as x/y/w/h in model input pixels.
+static inline void nms_set_box(nms_workspace_t *ws, int k, float x, float y, float w, float h, int cls)
+{
+    ws->x1[k] = x;
+    ws->y1[k] = y;
+    ws->x2[k] = x + w;
+    ws->y2[k] = y + h;
+    ws->area[k] = (ws->x2[k] - x + 1.0f) * (ws->y2[k] - y + 1.0f);
+    ws->cls[k] = cls;
+}
+
+// Greedy NMS over the first count boxes in score order. Fills ws->suppressed
+// and returns the number of boxes kept. Dense mode may rewrite x1/x2.
+int nms_run(nms_workspace_t *ws, int count, float threshold, nms_mode_t mode);
+
+#endif //_RKNN_YOLOV8_DEMO_NMS_H_
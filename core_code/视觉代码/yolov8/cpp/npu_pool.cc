@@ -0,0 +1,411 @@
+#include "npu_pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alloc_stats.h"
+
+typedef enum {
+    NPU_SLOT_FREE = 0,
+    NPU_SLOT_QUEUED,
+    NPU_SLOT_DONE,
+} npu_slot_state_t;
+
+// Reorder buffer entry, frame seq lives in slot seq % depth
+typedef struct {
+    npu_slot_state_t state;
+    image_buffer_t *img;
+    struct timespec submit_time; // CLOCK_MONOTONIC, batch deadline
+    npu_pool_result_t result;
+} npu_slot_t;
+
+typedef struct {
+    npu_pool_t *pool;
+    rknn_app_context_t app_ctx;
+    pthread_t thread;
+    bool started;
+    pthread_cond_t cond;         // CLOCK_MONOTONIC
+    int *queue;  // slot indices, ring of pool->depth
+    int head;
+    int count;
+    int load;    // queued + running frames
+} npu_worker_t;
+
+struct npu_pool
+{
+    npu_worker_t workers[NPU_POOL_MAX_WORKERS];
+    int n_workers;
+    npu_pool_dispatch_t dispatch;
+    int next_worker;
+    int batch;                  // images per run of the model
+    npu_worker_t *batch_worker; // takes the frames of the batch being filled
+    npu_slot_t *slots;
+    int depth;
+    uint64_t next_submit;
+    uint64_t next_result;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t result_cond; // a slot turned DONE
+    pthread_cond_t space_cond;  // a slot turned FREE
+};
+
+static void finish_slot(npu_pool_t *pool, npu_worker_t *w, npu_slot_t *slot)
+{
+    slot->state = NPU_SLOT_DONE;
+    w->load--;
+    pthread_cond_broadcast(&pool->result_cond);
+}
+
+#if defined(ZERO_COPY)
+// Double-buffered worker: the next queued frame is letterboxed and started
+// before the previous one is post-processed, so the NPU does not wait on the
+// CPU side of either (see submit_yolov8_frame).
+static void *npu_worker_main(void *arg)
+{
+    npu_worker_t *w = (npu_worker_t *)arg;
+    npu_pool_t *pool = w->pool;
+    npu_slot_t *inflight[2]; // submitted to the context, oldest first
+    int n_inflight = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (w->count == 0 && n_inflight == 0 && !pool->stop)
+        {
+            pthread_cond_wait(&w->cond, &pool->lock);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+        if (w->count > 0 && n_inflight < 2)
+        {
+            npu_slot_t *slot = &pool->slots[w->queue[w->head]];
+            w->head = (w->head + 1) % pool->depth;
+            w->count--;
+            pthread_mutex_unlock(&pool->lock);
+
+            uint64_t allocs = alloc_stats_thread_count();
+            int ret = submit_yolov8_frame(&w->app_ctx, slot->img, slot);
+            slot->result.allocs = alloc_stats_thread_count() - allocs;
+
+            pthread_mutex_lock(&pool->lock);
+            if (ret != 0)
+            {
+                memset(&slot->result.od_results, 0, sizeof(object_detect_result_list));
+                slot->result.ret = -1;
+                finish_slot(pool, w, slot);
+                continue;
+            }
+            inflight[n_inflight++] = slot;
+            continue;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        npu_slot_t *slot = inflight[0];
+        void *user = NULL;
+        uint64_t allocs = alloc_stats_thread_count();
+        int ret = poll_yolov8_result(&w->app_ctx, &slot->result.od_results, &user);
+        slot->result.allocs += alloc_stats_thread_count() - allocs;
+
+        pthread_mutex_lock(&pool->lock);
+        slot->result.ret = ret == 0 && user == slot ? 0 : -1;
+        inflight[0] = inflight[1];
+        n_inflight--;
+        finish_slot(pool, w, slot);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#else
+// Batch models: more frames for the batch, until it is full or the first
+// frame has waited NPU_POOL_BATCH_WAIT_MS. Called with the lock held.
+static void collect_batch(npu_worker_t *w, int batch)
+{
+    npu_pool_t *pool = w->pool;
+    struct timespec deadline = pool->slots[w->queue[w->head]].submit_time;
+    deadline.tv_nsec += (long)NPU_POOL_BATCH_WAIT_MS * 1000000;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000;
+    deadline.tv_nsec %= 1000000000;
+    while (w->count < batch && !pool->stop)
+    {
+        if (pthread_cond_timedwait(&w->cond, &pool->lock, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+}
+
+static void *npu_worker_main(void *arg)
+{
+    npu_worker_t *w = (npu_worker_t *)arg;
+    npu_pool_t *pool = w->pool;
+    int batch = w->app_ctx.batch > 1 ? w->app_ctx.batch : 1;
+    npu_slot_t *slots[YOLOV8_MAX_BATCH];
+    image_buffer_t *imgs[YOLOV8_MAX_BATCH];
+    object_detect_result_list *od_results[YOLOV8_MAX_BATCH];
+
+    pthread_mutex_lock(&pool->lock);
+    while (true)
+    {
+        while (w->count == 0 && !pool->stop)
+        {
+            pthread_cond_wait(&w->cond, &pool->lock);
+        }
+        if (batch > 1 && !pool->stop)
+        {
+            collect_batch(w, batch);
+        }
+        if (pool->stop)
+        {
+            break;
+        }
+        int n = w->count < batch ? w->count : batch;
+        for (int i = 0; i < n; i++)
+        {
+            slots[i] = &pool->slots[w->queue[w->head]];
+            w->head = (w->head + 1) % pool->depth;
+            imgs[i] = slots[i]->img;
+            od_results[i] = &slots[i]->result.od_results;
+        }
+        w->count -= n;
+        pthread_mutex_unlock(&pool->lock);
+
+        uint64_t allocs = alloc_stats_thread_count();
+        int ret = batch > 1 ? inference_yolov8_batch(&w->app_ctx, imgs, n, od_results)
+                            : inference_yolov8_model(&w->app_ctx, imgs[0], od_results[0]);
+        allocs = alloc_stats_thread_count() - allocs;
+
+        pthread_mutex_lock(&pool->lock);
+        for (int i = 0; i < n; i++)
+        {
+            slots[i]->result.ret = ret;
+            slots[i]->result.allocs = allocs;
+            finish_slot(pool, w, slots[i]);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+#endif
+
+static npu_worker_t *pick_worker(npu_pool_t *pool)
+{
+    npu_worker_t *w = &pool->workers[pool->next_worker];
+    if (pool->dispatch == NPU_POOL_LEAST_LOADED)
+    {
+        // start the scan at the round-robin position so ties rotate
+        for (int i = 1; i < pool->n_workers; i++)
+        {
+            npu_worker_t *c = &pool->workers[(pool->next_worker + i) % pool->n_workers];
+            if (c->load < w->load)
+            {
+                w = c;
+            }
+        }
+    }
+    pool->next_worker = (pool->next_worker + 1) % pool->n_workers;
+    return w;
+}
+
+npu_pool_t *npu_pool_create(const char *model_path, int n_workers, npu_pool_dispatch_t dispatch)
+{
+    if (n_workers < 1)
+    {
+        n_workers = 1;
+    }
+    if (n_workers > NPU_POOL_MAX_WORKERS)
+    {
+        n_workers = NPU_POOL_MAX_WORKERS;
+    }
+
+    npu_pool_t *pool = (npu_pool_t *)calloc(1, sizeof(npu_pool_t));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->result_cond, NULL);
+    pthread_cond_init(&pool->space_cond, NULL);
+    pool->dispatch = dispatch;
+
+    for (int i = 0; i < n_workers; i++)
+    {
+        npu_worker_t *w = &pool->workers[i];
+        int ret = i == 0 ? init_yolov8_model(model_path, &w->app_ctx)
+                         : dup_yolov8_model(&pool->workers[0].app_ctx, &w->app_ctx);
+        if (ret != 0)
+        {
+            // init/dup leave partial state behind on failure
+            release_yolov8_model(&w->app_ctx);
+            memset(&w->app_ctx, 0, sizeof(rknn_app_context_t));
+            if (i == 0)
+            {
+                printf("npu pool: init_yolov8_model fail!\n");
+                npu_pool_destroy(pool);
+                return NULL;
+            }
+            printf("npu pool: only %d of %d contexts\n", i, n_workers);
+            break;
+        }
+        if (n_workers > 1)
+        {
+            set_yolov8_npu_core(&w->app_ctx, i % NPU_POOL_CORES);
+        }
+        w->pool = pool;
+        pthread_condattr_t cond_attr;
+        pthread_condattr_init(&cond_attr);
+        pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&w->cond, &cond_attr);
+        pthread_condattr_destroy(&cond_attr);
+        pool->n_workers++;
+    }
+
+    // a batch model takes a whole batch per slot of a batch-1 model: one
+    // batch running while the next is collected
+    pool->batch = pool->workers[0].app_ctx.batch > 1 ? pool->workers[0].app_ctx.batch : 1;
+    pool->depth = pool->n_workers * NPU_POOL_SLOTS_PER_WORKER * pool->batch;
+    pool->slots = (npu_slot_t *)calloc(pool->depth, sizeof(npu_slot_t));
+    if (pool->slots == NULL)
+    {
+        npu_pool_destroy(pool);
+        return NULL;
+    }
+    for (int i = 0; i < pool->n_workers; i++)
+    {
+        npu_worker_t *w = &pool->workers[i];
+        w->queue = (int *)calloc(pool->depth, sizeof(int));
+        if (w->queue == NULL || pthread_create(&w->thread, NULL, npu_worker_main, w) != 0)
+        {
+            printf("npu pool: start worker %d fail!\n", i);
+            npu_pool_destroy(pool);
+            return NULL;
+        }
+        w->started = true;
+    }
+    printf("npu pool: %d contexts, %s dispatch, batch %d, %d frames in flight\n", pool->n_workers,
+           dispatch == NPU_POOL_LEAST_LOADED ? "least-loaded" : "round-robin", pool->batch, pool->depth);
+    return pool;
+}
+
+void npu_pool_destroy(npu_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    for (int i = 0; i < pool->n_workers; i++)
+    {
+        pthread_cond_broadcast(&pool->workers[i].cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    // duplicated contexts go before the one owning the weights
+    for (int i = pool->n_workers - 1; i >= 0; i--)
+    {
+        npu_worker_t *w = &pool->workers[i];
+        if (w->started)
+        {
+            pthread_join(w->thread, NULL);
+        }
+        release_yolov8_model(&w->app_ctx);
+        pthread_cond_destroy(&w->cond);
+        free(w->queue);
+    }
+    free(pool->slots);
+    pthread_cond_destroy(&pool->space_cond);
+    pthread_cond_destroy(&pool->result_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int npu_pool_workers(npu_pool_t *pool) { return pool->n_workers; }
+
+int npu_pool_depth(npu_pool_t *pool) { return pool->depth; }
+
+int npu_pool_pending(npu_pool_t *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    int pending = (int)(pool->next_submit - pool->next_result);
+    pthread_mutex_unlock(&pool->lock);
+    return pending;
+}
+
+rknn_app_context_t *npu_pool_context(npu_pool_t *pool, int worker)
+{
+    if (worker < 0 || worker >= pool->n_workers)
+    {
+        return NULL;
+    }
+    return &pool->workers[worker].app_ctx;
+}
+
+int npu_pool_submit(npu_pool_t *pool, image_buffer_t *img, void *user)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (pool->next_submit - pool->next_result >= (uint64_t)pool->depth && !pool->stop)
+    {
+        pthread_cond_wait(&pool->space_cond, &pool->lock);
+    }
+    if (pool->stop)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+
+    int idx = (int)(pool->next_submit % pool->depth);
+    npu_slot_t *slot = &pool->slots[idx];
+    slot->state = NPU_SLOT_QUEUED;
+    slot->img = img;
+    clock_gettime(CLOCK_MONOTONIC, &slot->submit_time);
+    slot->result.seq = pool->next_submit;
+    slot->result.user = user;
+    slot->result.ret = -1;
+    slot->result.allocs = 0;
+
+    // frames go out a batch at a time, so they reach one context together
+    if (pool->next_submit % pool->batch == 0)
+    {
+        pool->batch_worker = pick_worker(pool);
+    }
+    npu_worker_t *w = pool->batch_worker;
+    pool->next_submit++;
+    w->queue[(w->head + w->count) % pool->depth] = idx;
+    w->count++;
+    w->load++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+int npu_pool_get_result(npu_pool_t *pool, npu_pool_result_t *result, bool wait)
+{
+    pthread_mutex_lock(&pool->lock);
+    if (pool->next_result == pool->next_submit)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return -1;
+    }
+    npu_slot_t *slot = &pool->slots[pool->next_result % pool->depth];
+    while (slot->state != NPU_SLOT_DONE && wait)
+    {
+        pthread_cond_wait(&pool->result_cond, &pool->lock);
+    }
+    if (slot->state != NPU_SLOT_DONE)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+    memcpy(result, &slot->result, sizeof(npu_pool_result_t));
+    slot->state = NPU_SLOT_FREE;
+    pool->next_result++;
+    pthread_cond_signal(&pool->space_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef _RKNN_YOLOV8_DEMO_NPU_POOL_H_
+#define _RKNN_YOLOV8_DEMO_NPU_POOL_H_
+
+#include <stdint.h>
+
+#include "yolov8.h"
+
+// Several contexts of one model, each on its own worker thread and NPU core
+// (the first is created by init_yolov8_model, the others by
+// dup_yolov8_model). Frames are handed out round-robin or to the least
+// loaded context and their results come back in submit order.
+// On a batch-N model a context collects up to N queued frames per run,
+// waiting at most NPU_POOL_BATCH_WAIT_MS after the first for the rest.
+// Consecutive frames make a batch, with several cameras scheduled in turn
+// that is one frame of each.
+#define NPU_POOL_MAX_WORKERS 8
+#define NPU_POOL_SLOTS_PER_WORKER 2 // one running and one queued frame per context
+#ifndef NPU_POOL_CORES
+#define NPU_POOL_CORES 3            // RK3588
+#endif
+// Contexts and dispatch used by main.cc, 1 runs a single context
+#ifndef NPU_POOL_WORKERS
+#define NPU_POOL_WORKERS 1
+#endif
+#ifndef NPU_POOL_DISPATCH
+#define NPU_POOL_DISPATCH NPU_POOL_LEAST_LOADED
+#endif
+#ifndef NPU_POOL_BATCH_WAIT_MS
+#define NPU_POOL_BATCH_WAIT_MS 20
+#endif
+
+typedef enum {
+    NPU_POOL_ROUND_ROBIN = 0,
+    NPU_POOL_LEAST_LOADED,
+} npu_pool_dispatch_t;
+
+typedef struct {
+    uint64_t seq;  // submit order, from 0
+    void *user;    // as passed to npu_pool_submit
+    int ret;       // inference_yolov8_model return value
+    object_detect_result_list od_results;
+    uint64_t allocs; // heap allocations by the worker for this frame (the whole
+                     // run for a batch), 0 without ALLOC_STATS
+} npu_pool_result_t;
+
+typedef struct npu_pool npu_pool_t;
+
+// Returns NULL if even the first context fails, fewer workers than asked if
+// contexts cannot be duplicated.
+npu_pool_t *npu_pool_create(const char *model_path, int n_workers, npu_pool_dispatch_t dispatch);
+// Frames queued but not yet started are dropped.
+void npu_pool_destroy(npu_pool_t *pool);
+
+int npu_pool_workers(npu_pool_t *pool);
+// Frames that can be in flight, npu_pool_submit blocks beyond that
+int npu_pool_depth(npu_pool_t *pool);
+// Submitted frames whose result has not been taken yet
+int npu_pool_pending(npu_pool_t *pool);
+rknn_app_context_t *npu_pool_context(npu_pool_t *pool, int worker);
+
+// img is read by a worker later, it must stay valid until its result has
+// been returned by npu_pool_get_result.
+int npu_pool_submit(npu_pool_t *pool, image_buffer_t *img, void *user);
+
+// Next result in submit order. Returns 0 with a result, -1 when nothing is
+// pending and 1 if wait is false and the next frame is still running.
+int npu_pool_get_result(npu_pool_t *pool, npu_pool_result_t *result, bool wait);
+
+#endif //_RKNN_YOLOV8_DEMO_NPU_POOL_H_
@@ -0,0 +1,133 @@
+// Throughput of npu_pool on synthetic frames. With the stand-in backend
+// (NPU_STUB) it also checks every result belongs to its frame.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "npu_pool.h"
+
+#define BENCH_WIDTH 640
+#define BENCH_HEIGHT 480
+
+static int check_result(const npu_pool_result_t *result, uint64_t expect_seq)
+{
+    if (result->seq != expect_seq)
+    {
+        printf("result %llu out of order, expected %llu\n", (unsigned long long)result->seq,
+               (unsigned long long)expect_seq);
+        return -1;
+    }
+    if (result->ret != 0)
+    {
+        printf("frame %llu inference fail! ret=%d\n", (unsigned long long)result->seq, result->ret);
+        return -1;
+    }
+#if defined(NPU_STUB)
+    // the stand-in reports the tag written into the frame
+    if (result->od_results.count != 1 || result->od_results.results[0].box.left != (int32_t)result->seq)
+    {
+        printf("frame %llu got the result of another frame\n", (unsigned long long)result->seq);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 5)
+    {
+        printf("Usage: %s <model_path> [workers] [frames] [rr|least]\n", argv[0]);
+        printf("Example: %s model/yolov8.rknn 3 300 least\n", argv[0]);
+        return -1;
+    }
+    const char *model_path = argv[1];
+    int n_workers = argc > 2 ? atoi(argv[2]) : NPU_POOL_CORES;
+    int n_frames = argc > 3 ? atoi(argv[3]) : 300;
+    npu_pool_dispatch_t dispatch = argc > 4 && strcmp(argv[4], "least") == 0 ? NPU_POOL_LEAST_LOADED
+                                                                              : NPU_POOL_ROUND_ROBIN;
+
+    npu_pool_t *pool = npu_pool_create(model_path, n_workers, dispatch);
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    // one frame buffer per reorder slot, a slot is reused only after its
+    // result has been taken
+    int depth = npu_pool_depth(pool);
+    image_buffer_t *frames = (image_buffer_t *)calloc(depth, sizeof(image_buffer_t));
+    int ret = -1;
+    int errors = 0;
+    uint64_t submitted = 0;
+    uint64_t received = 0;
+    npu_pool_result_t result;
+    struct timeval start_time, end_time;
+    float time_use;
+
+    if (frames == NULL)
+    {
+        goto out;
+    }
+    for (int i = 0; i < depth; i++)
+    {
+        frames[i].width = BENCH_WIDTH;
+        frames[i].height = BENCH_HEIGHT;
+        frames[i].format = IMAGE_FORMAT_RGB888;
+        frames[i].size = BENCH_WIDTH * BENCH_HEIGHT * 3;
+        frames[i].virt_addr = (unsigned char *)malloc(frames[i].size);
+        if (frames[i].virt_addr == NULL)
+        {
+            printf("malloc frame size:%d fail!\n", frames[i].size);
+            goto out;
+        }
+        memset(frames[i].virt_addr, 114, frames[i].size);
+    }
+
+    gettimeofday(&start_time, NULL);
+    while (received < (uint64_t)n_frames)
+    {
+        if (submitted < (uint64_t)n_frames && npu_pool_pending(pool) < depth)
+        {
+            image_buffer_t *frame = &frames[submitted % depth];
+            int32_t tag = (int32_t)submitted;
+            memcpy(frame->virt_addr, &tag, sizeof(tag));
+            if (npu_pool_submit(pool, frame, NULL) != 0)
+            {
+                goto out;
+            }
+            submitted++;
+            continue;
+        }
+        if (npu_pool_get_result(pool, &result, true) != 0)
+        {
+            goto out;
+        }
+        if (check_result(&result, received) != 0)
+        {
+            errors++;
+        }
+        received++;
+    }
+    gettimeofday(&end_time, NULL);
+
+    time_use = (end_time.tv_sec - start_time.tv_sec) * 1000 + (end_time.tv_usec - start_time.tv_usec) / 1000.0;
+    printf("%d workers: %d frames in %.1f ms, %.2f FPS, %d errors\n", npu_pool_workers(pool), n_frames, time_use,
+           n_frames * 1000.0 / time_use, errors);
+    ret = errors == 0 ? 0 : 1;
+
+out:
+    npu_pool_destroy(pool);
+    if (frames != NULL)
+    {
+        for (int i = 0; i < depth; i++)
+        {
+            free(frames[i].virt_addr);
+        }
+        free(frames);
+    }
+    return ret;
+}
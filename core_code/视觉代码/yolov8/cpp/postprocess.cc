@@ -13,6 +13,10 @@
 // limitations under the License.
 
 #include "yolov8.h"
+#include "async_log.h"
+#include "score_scan.h"
+#include "nms.h"
+#include "fp16.h"
 
 #include <math.h>
 #include <stdint.h>
@@ -20,12 +24,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
-#include <set>
-#include <vector>
+#include <algorithm>
 #define LABEL_NALE_TXT_PATH "./model/coco_80_labels_list.txt"
 
-static char *labels[OBJ_CLASS_NUM];
+// one entry per line of the label file, the model decides the class count
+static char **labels = nullptr;
+static int label_count = 0;
 
 inline static int clamp(float val, int min, int max) { return val > min ? (val < max ? val : max) : min; }
 
@@ -66,13 +72,16 @@ static char *readLine(FILE *fp, char *buffer, int *len)
     return buffer;
 }
 
-static int readLines(const char *fileName, char *lines[], int max_line)
+// Read every line of fileName into a malloc'd array, returns the line count
+static int readLines(const char *fileName, char ***lines)
 {
     FILE *file = fopen(fileName, "r");
     char *s;
     int i = 0;
     int n = 0;
+    int cap = 0;
 
+    *lines = NULL;
     if (file == NULL)
     {
         printf("Open %s fail!\n", fileName);
@@ -81,100 +90,63 @@ static int readLines(const char *fileName, char *lines[], int max_line)
 
     while ((s = readLine(file, s, &n)) != NULL)
     {
-        lines[i++] = s;
-        if (i >= max_line)
-            break;
+        if (i == cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            char **tmp = (char **)realloc(*lines, cap * sizeof(char *));
+            if (tmp == NULL)
+            {
+                free(s);
+                break;
+            }
+            *lines = tmp;
+        }
+        (*lines)[i++] = s;
     }
     fclose(file);
     return i;
 }
 
-static int loadLabelName(const char *locationFilename, char *label[])
+static int loadLabelName(const char *locationFilename, char ***label)
 {
     printf("load lable %s\n", locationFilename);
-    readLines(locationFilename, label, OBJ_CLASS_NUM);
-    return 0;
+    int n = readLines(locationFilename, label);
+    if (n < 0)
+    {
+        return -1;
+    }
+    printf("%d labels\n", n);
+    return n;
 }
 
-static float CalculateOverlap(float xmin0, float ymin0, float xmax0, float ymax0, float xmin1, float ymin1, float xmax1,
-                              float ymax1)
+// Keep the max_candidates best scores with a partial selection, then order
+// only the kept ones. Ties are broken by index so the order is deterministic.
+static int select_top_candidates(const float *scores, int validCount, int max_candidates, int *indices)
 {
-    float w = fmax(0.f, fmin(xmax0, xmax1) - fmax(xmin0, xmin1) + 1.0);
-    float h = fmax(0.f, fmin(ymax0, ymax1) - fmax(ymin0, ymin1) + 1.0);
-    float i = w * h;
-    float u = (xmax0 - xmin0 + 1.0) * (ymax0 - ymin0 + 1.0) + (xmax1 - xmin1 + 1.0) * (ymax1 - ymin1 + 1.0) - i;
-    return u <= 0.f ? 0.f : (i / u);
-}
+    auto score_greater = [scores](int a, int b) {
+        return scores[a] > scores[b] || (scores[a] == scores[b] && a < b);
+    };
 
-static int nms(int validCount, std::vector<float> &outputLocations, std::vector<int> classIds, std::vector<int> &order,
-               int filterId, float threshold)
-{
     for (int i = 0; i < validCount; ++i)
     {
-        int n = order[i];
-        if (n == -1 || classIds[n] != filterId)
-        {
-            continue;
-        }
-        for (int j = i + 1; j < validCount; ++j)
-        {
-            int m = order[j];
-            if (m == -1 || classIds[m] != filterId)
-            {
-                continue;
-            }
-            float xmin0 = outputLocations[n * 4 + 0];
-            float ymin0 = outputLocations[n * 4 + 1];
-            float xmax0 = outputLocations[n * 4 + 0] + outputLocations[n * 4 + 2];
-            float ymax0 = outputLocations[n * 4 + 1] + outputLocations[n * 4 + 3];
-
-            float xmin1 = outputLocations[m * 4 + 0];
-            float ymin1 = outputLocations[m * 4 + 1];
-            float xmax1 = outputLocations[m * 4 + 0] + outputLocations[m * 4 + 2];
-            float ymax1 = outputLocations[m * 4 + 1] + outputLocations[m * 4 + 3];
-
-            float iou = CalculateOverlap(xmin0, ymin0, xmax0, ymax0, xmin1, ymin1, xmax1, ymax1);
+        indices[i] = i;
+    }
 
-            if (iou > threshold)
-            {
-                order[j] = -1;
-            }
-        }
+    int keep = validCount;
+    if (max_candidates > 0 && validCount > max_candidates)
+    {
+        std::nth_element(indices, indices + max_candidates, indices + validCount, score_greater);
+        keep = max_candidates;
     }
-    return 0;
+    std::sort(indices, indices + keep, score_greater);
+    return keep;
 }
 
-static int quick_sort_indice_inverse(std::vector<float> &input, int left, int right, std::vector<int> &indices)
+static int64_t now_ns()
 {
-    float key;
-    int key_index;
-    int low = left;
-    int high = right;
-    if (left < right)
-    {
-        key_index = indices[left];
-        key = input[left];
-        while (low < high)
-        {
-            while (low < high && input[high] <= key)
-            {
-                high--;
-            }
-            input[low] = input[high];
-            indices[low] = indices[high];
-            while (low < high && input[low] >= key)
-            {
-                low++;
-            }
-            input[high] = input[low];
-            indices[high] = indices[low];
-        }
-        input[low] = key;
-        indices[low] = key_index;
-        quick_sort_indice_inverse(input, left, low - 1, indices);
-        quick_sort_indice_inverse(input, low + 1, right, indices);
-    }
-    return low;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 }
 
 static float sigmoid(float x) { return 1.0 / (1.0 + expf(-x)); }
@@ -205,7 +177,7 @@ static float deqnt_affine_to_f32(int8_t qnt, int32_t zp, float scale) { return (
 
 static float deqnt_affine_u8_to_f32(uint8_t qnt, int32_t zp, float scale) { return ((float)qnt - (float)zp) * scale; }
 
-static void compute_dfl(float* tensor, int dfl_len, float* box){
+static void compute_dfl(const float* tensor, int dfl_len, float* box){
     for (int b=0; b<4; b++){
         float exp_t[dfl_len];
         float exp_sum=0;
@@ -222,262 +194,352 @@ static void compute_dfl(float* tensor, int dfl_len, float* box){
     }
 }
 
-static int process_u8(uint8_t *box_tensor, int32_t box_zp, float box_scale,
-                      uint8_t *score_tensor, int32_t score_zp, float score_scale,
-                      uint8_t *score_sum_tensor, int32_t score_sum_zp, float score_sum_scale,
-                      int grid_h, int grid_w, int stride, int dfl_len,
-                      std::vector<float> &boxes,
-                      std::vector<float> &objProbs,
-                      std::vector<int> &classId,
-                      float threshold)
+// Same as compute_dfl, but exp() of every quantized value comes from the
+// per branch table built by init_dfl_exp_lut. lut must be indexable by the
+// raw value, so int8 callers pass the table offset by 128.
+template <typename T>
+static void compute_dfl_lut(const T *tensor, const float *lut, int dfl_len, float *box)
 {
-    int validCount = 0;
-    int grid_len = grid_h * grid_w;
-    uint8_t score_thres_u8 = qnt_f32_to_affine_u8(threshold, score_zp, score_scale);
-    uint8_t score_sum_thres_u8 = qnt_f32_to_affine_u8(threshold, score_sum_zp, score_sum_scale);
-
-    for (int i = 0; i < grid_h; i++)
+    for (int b = 0; b < 4; b++)
     {
-        for (int j = 0; j < grid_w; j++)
+        float exp_t[dfl_len];
+        float exp_sum = 0;
+        float acc_sum = 0;
+        for (int i = 0; i < dfl_len; i++)
         {
-            int offset = i * grid_w + j;
-            int max_class_id = -1;
-
-            // Use score sum to quickly filter
-            if (score_sum_tensor != nullptr)
-            {
-                if (score_sum_tensor[offset] < score_sum_thres_u8)
-                {
-                    continue;
-                }
-            }
-
-            uint8_t max_score = -score_zp;
-            for (int c = 0; c < OBJ_CLASS_NUM; c++)
-            {
-                if ((score_tensor[offset] > score_thres_u8) && (score_tensor[offset] > max_score))
-                {
-                    max_score = score_tensor[offset];
-                    max_class_id = c;
-                }
-                offset += grid_len;
-            }
+            exp_t[i] = lut[tensor[i + b * dfl_len]];
+            exp_sum += exp_t[i];
+        }
 
-            // compute box
-            if (max_score > score_thres_u8)
-            {
-                offset = i * grid_w + j;
-                float box[4];
-                float before_dfl[dfl_len * 4];
-                for (int k = 0; k < dfl_len * 4; k++)
-                {
-                    before_dfl[k] = deqnt_affine_u8_to_f32(box_tensor[offset], box_zp, box_scale);
-                    offset += grid_len;
-                }
-                compute_dfl(before_dfl, dfl_len, box);
+        for (int i = 0; i < dfl_len; i++)
+        {
+            acc_sum += exp_t[i] / exp_sum * i;
+        }
+        box[b] = acc_sum;
+    }
+}
 
-                float x1, y1, x2, y2, w, h;
-                x1 = (-box[0] + j + 0.5) * stride;
-                y1 = (-box[1] + i + 0.5) * stride;
-                x2 = (box[2] + j + 0.5) * stride;
-                y2 = (box[3] + i + 0.5) * stride;
-                w = x2 - x1;
-                h = y2 - y1;
-                boxes.push_back(x1);
-                boxes.push_back(y1);
-                boxes.push_back(w);
-                boxes.push_back(h);
+#if defined(RV1106_1103)
+// Fixed point DFL: every bin is weighted by exp(-(max - q) * scale) in Q16,
+// so the largest bin is always 1.0 and only the final division is in float.
+static void compute_dfl_q16(const int8_t *tensor, const uint32_t *lut_q16, int dfl_len, float *box)
+{
+    for (int b = 0; b < 4; b++)
+    {
+        const int8_t *bins = tensor + b * dfl_len;
+        int q_max = bins[0];
+        for (int i = 1; i < dfl_len; i++)
+        {
+            q_max = bins[i] > q_max ? bins[i] : q_max;
+        }
 
-                objProbs.push_back(deqnt_affine_u8_to_f32(max_score, score_zp, score_scale));
-                classId.push_back(max_class_id);
-                validCount++;
-            }
+        uint32_t exp_sum = 0;
+        uint32_t acc_sum = 0;
+        for (int i = 0; i < dfl_len; i++)
+        {
+            uint32_t e = lut_q16[q_max - bins[i]];
+            exp_sum += e;
+            acc_sum += e * i;
         }
+        box[b] = (float)acc_sum / exp_sum;
     }
-    return validCount;
 }
+#endif
 
-static int process_i8(int8_t *box_tensor, int32_t box_zp, float box_scale,
-                      int8_t *score_tensor, int32_t score_zp, float score_scale,
-                      int8_t *score_sum_tensor, int32_t score_sum_zp, float score_sum_scale,
-                      int grid_h, int grid_w, int stride, int dfl_len,
-                      std::vector<float> &boxes, 
-                      std::vector<float> &objProbs, 
-                      std::vector<int> &classId, 
-                      float threshold)
+// Memory layout of one output: element (c, i, j) is at
+// (c / c2) * plane_stride + (i * row_stride + j) * c2 + c % c2.
+// NCHW is c2 = 1, NHWC is a single plane with c2 = C.
+typedef enum {
+    TENSOR_LAYOUT_NCHW = 0,  // one grid plane per channel
+    TENSOR_LAYOUT_NHWC,      // all channels of a cell contiguous
+    TENSOR_LAYOUT_NC1HWC2,   // C2 channels of a cell contiguous, C1 planes
+} tensor_layout_kind_t;
+
+typedef struct {
+    tensor_layout_kind_t kind;
+    int c2;
+    int plane_stride;
+    int row_stride;
+} tensor_layout_t;
+
+// The general formula holds for every kind, L only lets the compiler drop
+// the division for the two common ones.
+template <int L>
+static inline int tensor_offset(const tensor_layout_t *layout, int c, int i, int j)
 {
-    int validCount = 0;
-    int grid_len = grid_h * grid_w;
-    int8_t score_thres_i8 = qnt_f32_to_affine(threshold, score_zp, score_scale);
-    int8_t score_sum_thres_i8 = qnt_f32_to_affine(threshold, score_sum_zp, score_sum_scale);
+    if (L == TENSOR_LAYOUT_NCHW)
+    {
+        return c * layout->plane_stride + i * layout->row_stride + j;
+    }
+    if (L == TENSOR_LAYOUT_NHWC)
+    {
+        return (i * layout->row_stride + j) * layout->c2 + c;
+    }
+    return (c / layout->c2) * layout->plane_stride + (i * layout->row_stride + j) * layout->c2 + c % layout->c2;
+}
+
+// true when the first num_classes channels are dense grid_h x grid_w planes
+static inline bool layout_is_planar(const tensor_layout_t *layout, int grid_h, int grid_w, int num_classes)
+{
+    return layout->c2 == 1 && layout->row_stride == grid_w &&
+           (num_classes == 1 || layout->plane_stride == grid_h * grid_w);
+}
 
-    for (int i = 0; i < grid_h; i++)
+// Everything decode_branch needs for one output branch, filled by post_process.
+typedef struct {
+    const void *box;
+    const void *score;
+    const void *score_sum;       // nullptr for models with 2 outputs per branch
+    tensor_layout_t box_layout;
+    tensor_layout_t score_layout;
+    tensor_layout_t score_sum_layout;
+    int32_t score_zp;
+    float score_scale;
+    int32_t score_sum_zp;
+    float score_sum_scale;
+    const float *dfl_lut;        // quantized models, see init_dfl_exp_lut
+    const uint32_t *dfl_lut_q16; // RV1106/1103 fixed point DFL
+    int num_classes;
+    int grid_h;
+    int grid_w;
+    int stride;
+    int dfl_len;
+    float threshold;
+    int row_begin;               // rows [row_begin, row_end) of the grid
+    int row_end;
+} branch_args_t;
+
+// Per element type pieces of decode_branch. Scores are compared as type S:
+// the stored value for quantized tensors, float otherwise.
+template <typename T>
+struct score_traits;
+
+template <>
+struct score_traits<int8_t>
+{
+    typedef int8_t S;
+    static S threshold(float f, int32_t zp, float scale) { return qnt_f32_to_affine(f, zp, scale); }
+    static S floor(int32_t zp) { return -zp; }
+    static S load(const int8_t *p) { return *p; }
+    static float prob(S v, int32_t zp, float scale) { return deqnt_affine_to_f32(v, zp, scale); }
+};
+
+template <>
+struct score_traits<uint8_t>
+{
+    typedef uint8_t S;
+    static S threshold(float f, int32_t zp, float scale) { return qnt_f32_to_affine_u8(f, zp, scale); }
+    static S floor(int32_t zp) { return -zp; }
+    static S load(const uint8_t *p) { return *p; }
+    static float prob(S v, int32_t zp, float scale) { return deqnt_affine_u8_to_f32(v, zp, scale); }
+};
+
+template <>
+struct score_traits<float>
+{
+    typedef float S;
+    static S threshold(float f, int32_t /*zp*/, float /*scale*/) { return f; }
+    static S floor(int32_t /*zp*/) { return 0; }
+    static S load(const float *p) { return *p; }
+    static float prob(S v, int32_t /*zp*/, float /*scale*/) { return v; }
+};
+
+template <>
+struct score_traits<fp16_t>
+{
+    typedef float S;
+    static S threshold(float f, int32_t /*zp*/, float /*scale*/) { return f; }
+    static S floor(int32_t /*zp*/) { return 0; }
+    static S load(const fp16_t *p) { return half_to_float(*p); }
+    static float prob(S v, int32_t /*zp*/, float /*scale*/) { return v; }
+};
+
+// fp16 planes go through the float scan, converted a block at a time
+static void score_mask(const fp16_t *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    float buf[256];
+    for (int k = 0; k < n; k += 256)
     {
-        for (int j = 0; j < grid_w; j++)
-        {
-            int offset = i* grid_w + j;
-            int max_class_id = -1;
+        int cnt = n - k < 256 ? n - k : 256;
+        half_to_float_n(src + k, buf, cnt);
+        score_mask_f32(buf, cnt, thres, cmp, op, mask + k / 32);
+    }
+}
 
-            // 通过 score sum 起到快速过滤的作用
-            if (score_sum_tensor != nullptr){
-                if (score_sum_tensor[offset] < score_sum_thres_i8){
-                    continue;
-                }
-            }
+static inline void decode_dfl(const int8_t *bins, const branch_args_t *a, float *box)
+{
+#if defined(RV1106_1103)
+    if (a->dfl_lut_q16 != nullptr)
+    {
+        compute_dfl_q16(bins, a->dfl_lut_q16, a->dfl_len, box);
+        return;
+    }
+#endif
+    compute_dfl_lut(bins, a->dfl_lut + 128, a->dfl_len, box);
+}
 
-            int8_t max_score = -score_zp;
-            for (int c= 0; c< OBJ_CLASS_NUM; c++){
-                if ((score_tensor[offset] > score_thres_i8) && (score_tensor[offset] > max_score))
-                {
-                    max_score = score_tensor[offset];
-                    max_class_id = c;
-                }
-                offset += grid_len;
-            }
+static inline void decode_dfl(const uint8_t *bins, const branch_args_t *a, float *box)
+{
+    compute_dfl_lut(bins, a->dfl_lut, a->dfl_len, box);
+}
 
-            // compute box
-            if (max_score> score_thres_i8){
-                offset = i* grid_w + j;
-                float box[4];
-                float before_dfl[dfl_len*4];
-                for (int k=0; k< dfl_len*4; k++){
-                    before_dfl[k] = deqnt_affine_to_f32(box_tensor[offset], box_zp, box_scale);
-                    offset += grid_len;
-                }
-                compute_dfl(before_dfl, dfl_len, box);
+static inline void decode_dfl(const float *bins, const branch_args_t *a, float *box)
+{
+    compute_dfl(bins, a->dfl_len, box);
+}
 
-                float x1,y1,x2,y2,w,h;
-                x1 = (-box[0] + j + 0.5)*stride;
-                y1 = (-box[1] + i + 0.5)*stride;
-                x2 = (box[2] + j + 0.5)*stride;
-                y2 = (box[3] + i + 0.5)*stride;
-                w = x2 - x1;
-                h = y2 - y1;
-                boxes.push_back(x1);
-                boxes.push_back(y1);
-                boxes.push_back(w);
-                boxes.push_back(h);
-
-                objProbs.push_back(deqnt_affine_to_f32(max_score, score_zp, score_scale));
-                classId.push_back(max_class_id);
-                validCount ++;
-            }
+static inline void decode_dfl(const fp16_t *bins, const branch_args_t *a, float *box)
+{
+    float bins_f32[a->dfl_len * 4];
+    half_to_float_n(bins, bins_f32, a->dfl_len * 4);
+    compute_dfl(bins_f32, a->dfl_len, box);
+}
+
+// The 4 * dfl_len box bins of cell (i, j), C2 of them are contiguous so
+// NHWC and wide NC1HWC2 are read in place, the rest is gathered into tmp.
+template <typename T, int L>
+static inline const T *gather_box_bins(const T *box_tensor, const tensor_layout_t *layout, int i, int j, int box_len, T *tmp)
+{
+    if (L == TENSOR_LAYOUT_NCHW)
+    {
+        const T *cell = box_tensor + i * layout->row_stride + j;
+        for (int k = 0; k < box_len; k++)
+        {
+            tmp[k] = cell[k * layout->plane_stride];
         }
+        return tmp;
     }
-    return validCount;
+    const T *cell = box_tensor + (i * layout->row_stride + j) * layout->c2;
+    if (layout->c2 >= box_len)
+    {
+        return cell;
+    }
+    for (int k = 0; k < box_len; k += layout->c2)
+    {
+        int n = box_len - k < layout->c2 ? box_len - k : layout->c2;
+        memcpy(tmp + k, cell + (k / layout->c2) * layout->plane_stride, n * sizeof(T));
+    }
+    return tmp;
 }
 
-static int process_fp32(float *box_tensor, float *score_tensor, float *score_sum_tensor, 
-                        int grid_h, int grid_w, int stride, int dfl_len,
-                        std::vector<float> &boxes, 
-                        std::vector<float> &objProbs, 
-                        std::vector<int> &classId, 
-                        float threshold)
+// Threshold scan over the branch rows, only the cells left in the mask go
+// through the per class check and the box decode below. Bit k of the mask is
+// cell k counted from the first row. Dense planes use the SIMD scan,
+// interleaved channels are compared cell by cell.
+template <typename T, int NCLS, int L>
+static void build_candidate_mask(const branch_args_t *a, uint32_t *mask)
 {
-    int validCount = 0;
-    int grid_len = grid_h * grid_w;
-    for (int i = 0; i < grid_h; i++)
+    typedef score_traits<T> traits;
+    typedef typename traits::S S;
+    const T *score_tensor = (const T *)a->score;
+    const T *score_sum_tensor = (const T *)a->score_sum;
+    int num_classes = NCLS > 0 ? NCLS : a->num_classes;
+    int cell_begin = a->row_begin * a->grid_w;
+    int grid_len = (a->row_end - a->row_begin) * a->grid_w;
+    int n_words = SCORE_MASK_WORDS(grid_len);
+    S score_thres = traits::threshold(a->threshold, a->score_zp, a->score_scale);
+    S score_sum_thres = traits::threshold(a->threshold, a->score_sum_zp, a->score_sum_scale);
+
+    bool planar = layout_is_planar(&a->score_layout, a->grid_h, a->grid_w, num_classes) &&
+                  (score_sum_tensor == nullptr || layout_is_planar(&a->score_sum_layout, a->grid_h, a->grid_w, 1));
+    if (planar)
     {
-        for (int j = 0; j < grid_w; j++)
+        if (score_sum_tensor != nullptr)
         {
-            int offset = i* grid_w + j;
-            int max_class_id = -1;
-
-            // 通过 score sum 起到快速过滤的作用
-            if (score_sum_tensor != nullptr){
-                if (score_sum_tensor[offset] < threshold){
-                    continue;
-                }
+            score_mask(score_sum_tensor + cell_begin, grid_len, score_sum_thres, SCORE_CMP_GE, SCORE_MASK_SET, mask);
+            if (num_classes == 1)
+            {
+                score_mask(score_tensor + cell_begin, grid_len, score_thres, SCORE_CMP_GT, SCORE_MASK_AND, mask);
             }
+            return;
+        }
+        memset(mask, 0, n_words * sizeof(uint32_t));
+        for (int c = 0; c < num_classes; c++)
+        {
+            score_mask(score_tensor + c * a->score_layout.plane_stride + cell_begin, grid_len, score_thres, SCORE_CMP_GT,
+                       SCORE_MASK_OR, mask);
+        }
+        return;
+    }
 
-            float max_score = 0;
-            for (int c= 0; c< OBJ_CLASS_NUM; c++){
-                if ((score_tensor[offset] > threshold) && (score_tensor[offset] > max_score))
+    memset(mask, 0, n_words * sizeof(uint32_t));
+    for (int i = a->row_begin; i < a->row_end; i++)
+    {
+        for (int j = 0; j < a->grid_w; j++)
+        {
+            bool keep = false;
+            if (score_sum_tensor != nullptr)
+            {
+                keep = !(traits::load(score_sum_tensor + tensor_offset<L>(&a->score_sum_layout, 0, i, j)) < score_sum_thres);
+                if (keep && num_classes == 1)
                 {
-                    max_score = score_tensor[offset];
-                    max_class_id = c;
+                    keep = traits::load(score_tensor + tensor_offset<L>(&a->score_layout, 0, i, j)) > score_thres;
                 }
-                offset += grid_len;
             }
-
-            // compute box
-            if (max_score> threshold){
-                offset = i* grid_w + j;
-                float box[4];
-                float before_dfl[dfl_len*4];
-                for (int k=0; k< dfl_len*4; k++){
-                    before_dfl[k] = box_tensor[offset];
-                    offset += grid_len;
+            else
+            {
+                for (int c = 0; c < num_classes && !keep; c++)
+                {
+                    keep = traits::load(score_tensor + tensor_offset<L>(&a->score_layout, c, i, j)) > score_thres;
                 }
-                compute_dfl(before_dfl, dfl_len, box);
-
-                float x1,y1,x2,y2,w,h;
-                x1 = (-box[0] + j + 0.5)*stride;
-                y1 = (-box[1] + i + 0.5)*stride;
-                x2 = (box[2] + j + 0.5)*stride;
-                y2 = (box[3] + i + 0.5)*stride;
-                w = x2 - x1;
-                h = y2 - y1;
-                boxes.push_back(x1);
-                boxes.push_back(y1);
-                boxes.push_back(w);
-                boxes.push_back(h);
-
-                objProbs.push_back(max_score);
-                classId.push_back(max_class_id);
-                validCount ++;
+            }
+            if (keep)
+            {
+                int k = i * a->grid_w + j - cell_begin;
+                mask[k / 32] |= 1u << (k % 32);
             }
         }
     }
-    return validCount;
 }
 
-
-#if defined(RV1106_1103)
-static int process_i8_rv1106(int8_t *box_tensor, int32_t box_zp, float box_scale,
-                             int8_t *score_tensor, int32_t score_zp, float score_scale,
-                             int8_t *score_sum_tensor, int32_t score_sum_zp, float score_sum_scale,
-                             int grid_h, int grid_w, int stride, int dfl_len,
-                             std::vector<float> &boxes,
-                             std::vector<float> &objProbs,
-                             std::vector<int> &classId,
-                             float threshold) {
+// Decode one branch: element type T, NCLS classes (0 = a->num_classes at run
+// time) and layout L of all three tensors. Returns the candidates written.
+template <typename T, int NCLS, int L>
+static int decode_branch(const branch_args_t *a, float *boxes, float *objProbs, int *classId, int max_count)
+{
+    typedef score_traits<T> traits;
+    typedef typename traits::S S;
+    const T *box_tensor = (const T *)a->box;
+    const T *score_tensor = (const T *)a->score;
+    int num_classes = NCLS > 0 ? NCLS : a->num_classes;
+    int grid_w = a->grid_w;
+    int cell_begin = a->row_begin * grid_w;
+    int grid_len = (a->row_end - a->row_begin) * grid_w;
+    int stride = a->stride;
+    int box_len = a->dfl_len * 4;
     int validCount = 0;
-    int grid_len = grid_h * grid_w;
-    int8_t score_thres_i8 = qnt_f32_to_affine(threshold, score_zp, score_scale);
-    int8_t score_sum_thres_i8 = qnt_f32_to_affine(threshold, score_sum_zp, score_sum_scale);
+    S score_thres = traits::threshold(a->threshold, a->score_zp, a->score_scale);
 
-    for (int i = 0; i < grid_h; i++) {
-        for (int j = 0; j < grid_w; j++) {
-            int offset = i * grid_w + j;
-            int max_class_id = -1;
+    // 通过 score sum 起到快速过滤的作用
+    uint32_t cand_mask[SCORE_MASK_WORDS(grid_len)];
+    build_candidate_mask<T, NCLS, L>(a, cand_mask);
 
-            // 通过 score sum 起到快速过滤的作用
-            if (score_sum_tensor != nullptr) {
-                //score_sum_tensor [1, 1, 80, 80]
-                if (score_sum_tensor[offset] < score_sum_thres_i8) {
-                    continue;
-                }
-            }
+    for (int w = 0; w < SCORE_MASK_WORDS(grid_len); w++)
+    {
+        for (uint32_t bits = cand_mask[w]; bits != 0; bits &= bits - 1)
+        {
+            int offset = cell_begin + w * 32 + score_mask_ctz(bits);
+            int i = offset / grid_w;
+            int j = offset % grid_w;
+            int max_class_id = -1;
 
-            int8_t max_score = -score_zp;
-            offset = offset * OBJ_CLASS_NUM;
-            for (int c = 0; c < OBJ_CLASS_NUM; c++) {
-                if ((score_tensor[offset + c] > score_thres_i8) && (score_tensor[offset + c] > max_score)) {
-                    max_score = score_tensor[offset + c]; //80类 [1, 80, 80, 80] 3588NCHW 1106NHWC
+            S max_score = traits::floor(a->score_zp);
+            for (int c = 0; c < num_classes; c++)
+            {
+                S score = traits::load(score_tensor + tensor_offset<L>(&a->score_layout, c, i, j));
+                if ((score > score_thres) && (score > max_score))
+                {
+                    max_score = score;
                     max_class_id = c;
                 }
             }
 
             // compute box
-            if (max_score > score_thres_i8) {
-                offset = (i * grid_w + j) * 4 * dfl_len;
+            if (max_score > score_thres && validCount < max_count)
+            {
+                T before_dfl[box_len];
                 float box[4];
-                float before_dfl[dfl_len*4];
-                for (int k=0; k< dfl_len*4; k++){
-                    before_dfl[k] = deqnt_affine_to_f32(box_tensor[offset + k], box_zp, box_scale);
-                }
-                compute_dfl(before_dfl, dfl_len, box);
+                decode_dfl(gather_box_bins<T, L>(box_tensor, &a->box_layout, i, j, box_len, before_dfl), a, box);
 
                 float x1, y1, x2, y2, w, h;
                 x1 = (-box[0] + j + 0.5) * stride;
@@ -486,151 +548,365 @@ static int process_i8_rv1106(int8_t *box_tensor, int32_t box_zp, float box_scale
                 y2 = (box[3] + i + 0.5) * stride;
                 w = x2 - x1;
                 h = y2 - y1;
-                boxes.push_back(x1);
-                boxes.push_back(y1);
-                boxes.push_back(w);
-                boxes.push_back(h);
-
-                objProbs.push_back(deqnt_affine_to_f32(max_score, score_zp, score_scale));
-                classId.push_back(max_class_id);
-                validCount ++;
+                boxes[validCount * 4 + 0] = x1;
+                boxes[validCount * 4 + 1] = y1;
+                boxes[validCount * 4 + 2] = w;
+                boxes[validCount * 4 + 3] = h;
+
+                objProbs[validCount] = traits::prob(max_score, a->score_zp, a->score_scale);
+                classId[validCount] = max_class_id;
+                validCount++;
             }
         }
     }
-    printf("validCount=%d\n", validCount);
-    printf("grid h-%d, w-%d, stride %d\n", grid_h, grid_w, stride);
     return validCount;
 }
+
+typedef int (*decode_branch_fn)(const branch_args_t *a, float *boxes, float *objProbs, int *classId, int max_count);
+
+template <typename T, int NCLS>
+static decode_branch_fn select_decoder_layout(tensor_layout_kind_t kind)
+{
+    switch (kind)
+    {
+    case TENSOR_LAYOUT_NCHW:
+        return decode_branch<T, NCLS, TENSOR_LAYOUT_NCHW>;
+    case TENSOR_LAYOUT_NHWC:
+        return decode_branch<T, NCLS, TENSOR_LAYOUT_NHWC>;
+    default:
+        return decode_branch<T, NCLS, TENSOR_LAYOUT_NC1HWC2>;
+    }
+}
+
+// 1 class (drowning) and 80 classes (COCO) get their own instantiation,
+// other counts use the runtime class loop.
+template <typename T>
+static decode_branch_fn select_decoder_classes(int num_classes, tensor_layout_kind_t kind)
+{
+    switch (num_classes)
+    {
+    case 1:
+        return select_decoder_layout<T, 1>(kind);
+    case 80:
+        return select_decoder_layout<T, 80>(kind);
+    default:
+        return select_decoder_layout<T, 0>(kind);
+    }
+}
+
+static decode_branch_fn select_decoder(rknn_tensor_type type, int num_classes, tensor_layout_kind_t kind)
+{
+    switch (type)
+    {
+    case RKNN_TENSOR_INT8:
+        return select_decoder_classes<int8_t>(num_classes, kind);
+    case RKNN_TENSOR_UINT8:
+        return select_decoder_classes<uint8_t>(num_classes, kind);
+    case RKNN_TENSOR_FLOAT16:
+        return select_decoder_classes<fp16_t>(num_classes, kind);
+    case RKNN_TENSOR_FLOAT32:
+        return select_decoder_classes<float>(num_classes, kind);
+    default:
+        return nullptr;
+    }
+}
+
+// Decode work is cut into tasks of whole rows of one branch. A task writes its
+// candidates at the workspace slot of its first grid cell, so tasks never
+// overlap and the merge only has to close the gaps in task order.
+#define MAX_DECODE_TASKS 32
+
+typedef struct {
+    branch_args_t args;
+    decode_branch_fn decode;
+    int first;  // workspace slot of the first cell
+    int count;  // candidates written
+} decode_task_t;
+
+typedef struct {
+    decode_task_t *tasks;
+    post_process_workspace_t *ws;
+} decode_job_t;
+
+static void run_decode_task(void *arg, int task)
+{
+    decode_job_t *job = (decode_job_t *)arg;
+    decode_task_t *t = &job->tasks[task];
+    int first = t->first;
+    t->count = t->decode(&t->args, job->ws->boxes + first * 4, job->ws->obj_probs + first, job->ws->class_id + first,
+                         (t->args.row_end - t->args.row_begin) * t->args.grid_w);
+}
+
+// Grid size of the box tensor at output index box_idx
+static void get_branch_grid(rknn_app_context_t *app_ctx, int box_idx, int *grid_h, int *grid_w)
+{
+#if defined(RV1106_1103)
+    *grid_h = app_ctx->output_attrs[box_idx].dims[1];
+    *grid_w = app_ctx->output_attrs[box_idx].dims[2];
+#elif defined(RKNPU1)
+    *grid_h = app_ctx->output_attrs[box_idx].dims[1];
+    *grid_w = app_ctx->output_attrs[box_idx].dims[0];
+#else
+    *grid_h = app_ctx->output_attrs[box_idx].dims[2];
+    *grid_w = app_ctx->output_attrs[box_idx].dims[3];
+#endif
+}
+
+// Channel count of the score tensor at output index score_idx
+static int get_branch_classes(rknn_app_context_t *app_ctx, int score_idx)
+{
+    rknn_tensor_attr *attr = &app_ctx->output_attrs[score_idx];
+#if defined(RKNPU1)
+    return attr->dims[2];
+#else
+    return attr->fmt == RKNN_TENSOR_NHWC ? attr->dims[3] : attr->dims[1];
 #endif
+}
 
-int post_process(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_box, float conf_threshold, float nms_threshold, object_detect_result_list *od_results)
+// Layout of output idx as post_process reads it: native for zero copy and
+// RV1106/1103, NCHW from rknn_outputs_get otherwise.
+static void get_output_layout(rknn_app_context_t *app_ctx, int idx, int grid_h, int grid_w, tensor_layout_t *layout)
+{
+    layout->kind = TENSOR_LAYOUT_NCHW;
+    layout->c2 = 1;
+    layout->plane_stride = grid_h * grid_w;
+    layout->row_stride = grid_w;
+#if defined(ZERO_COPY) || defined(RV1106_1103)
+#if defined(ZERO_COPY)
+    rknn_tensor_attr *attr = &app_ctx->output_native_attrs[idx];
+#else
+    rknn_tensor_attr *attr = &app_ctx->output_attrs[idx];
+#endif
+    if (attr->fmt == RKNN_TENSOR_NC1HWC2)
+    {
+        // [N, C1, H, W, C2]
+        layout->kind = TENSOR_LAYOUT_NC1HWC2;
+        layout->c2 = attr->dims[4];
+        layout->row_stride = attr->dims[3];
+        layout->plane_stride = attr->dims[2] * attr->dims[3] * attr->dims[4];
+    }
+    else if (attr->fmt == RKNN_TENSOR_NHWC)
+    {
+        // [N, H, W, C]
+        layout->kind = TENSOR_LAYOUT_NHWC;
+        layout->c2 = attr->dims[3];
+        layout->row_stride = attr->dims[2];
+        layout->plane_stride = attr->dims[1] * attr->dims[2] * attr->dims[3];
+    }
+#else
+    (void)app_ctx;
+    (void)idx;
+#endif
+}
+
+// Element type of the buffers post_process receives
+static rknn_tensor_type get_decode_type(rknn_app_context_t *app_ctx, int idx)
 {
-#if defined(RV1106_1103) 
-    rknn_tensor_mem **_outputs = (rknn_tensor_mem **)outputs;
+#if defined(ZERO_COPY)
+    return app_ctx->output_native_attrs[idx].type;
+#elif defined(RKNPU1)
+    (void)idx;
+    return app_ctx->is_quant ? RKNN_TENSOR_UINT8 : RKNN_TENSOR_FLOAT32;
 #else
-    rknn_output *_outputs = (rknn_output *)outputs;
+    (void)idx;
+    return app_ctx->is_quant ? RKNN_TENSOR_INT8 : RKNN_TENSOR_FLOAT32;
 #endif
-    std::vector<float> filterBoxes;
-    std::vector<float> objProbs;
-    std::vector<int> classId;
+}
+
+static int get_type_bytes(rknn_tensor_type type)
+{
+    switch (type)
+    {
+    case RKNN_TENSOR_FLOAT32:
+        return 4;
+    case RKNN_TENSOR_FLOAT16:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+// Output idx of image `image`, batch models store the images one after the
+// other
+static void *get_output_buf(rknn_app_context_t *app_ctx, void *outputs, int idx, int image)
+{
+#if defined(RV1106_1103)
+    (void)app_ctx;
+    (void)image;  // RV1106/1103 models are batch 1
+    return ((rknn_tensor_mem **)outputs)[idx]->virt_addr;
+#else
+    unsigned char *buf = (unsigned char *)((rknn_output *)outputs)[idx].buf;
+    if (image > 0)
+    {
+        int image_elems = app_ctx->output_attrs[idx].n_elems / app_ctx->batch;
+        buf += (size_t)image * image_elems * get_type_bytes(get_decode_type(app_ctx, idx));
+    }
+    return buf;
+#endif
+}
+
+static int post_process_image(rknn_app_context_t *app_ctx, void *outputs, int image, letterbox_t *letter_box,
+                              float conf_threshold, float nms_threshold, object_detect_result_list *od_results)
+{
+    post_process_workspace_t *ws = &app_ctx->pp_workspace;
+    float *filterBoxes = ws->boxes;
+    float *objProbs = ws->obj_probs;
+    int *classId = ws->class_id;
     int validCount = 0;
-    int stride = 0;
-    int grid_h = 0;
-    int grid_w = 0;
     int model_in_w = app_ctx->model_width;
     int model_in_h = app_ctx->model_height;
 
     memset(od_results, 0, sizeof(object_detect_result_list));
+    int64_t t_start = now_ns();
+    if (ws->capacity <= 0)
+    {
+        printf("post process workspace not initialized!\n");
+        return -1;
+    }
+#if defined(RV1106_1103)
+    if (!app_ctx->is_quant)
+    {
+        printf("RV1106/1103 only support quantization mode\n");
+        return -1;
+    }
+#endif
 
     // default 3 branch
-#ifdef RKNPU1
+#if defined(RV1106_1103)
+    int dfl_len = app_ctx->output_attrs[0].dims[3] / 4;
+#elif defined(RKNPU1)
     int dfl_len = app_ctx->output_attrs[0].dims[2] / 4;
 #else
-    int dfl_len = app_ctx->output_attrs[0].dims[1] /4;
+    int dfl_len = app_ctx->output_attrs[0].dims[1] / 4;
 #endif
     int output_per_branch = app_ctx->io_num.n_output / 3;
+    // with workers, split the grid into about one band of rows per thread
+    int n_threads = thread_pool_size(ws->pool);
+    int band_cells = (ws->capacity + n_threads) / (n_threads + 1);
+    decode_task_t tasks[MAX_DECODE_TASKS];
+    int n_tasks = 0;
+    int first_cell = 0;
     for (int i = 0; i < 3; i++)
     {
-#if defined(RV1106_1103)
-        dfl_len = app_ctx->output_attrs[0].dims[3] /4;
-        void *score_sum = nullptr;
-        int32_t score_sum_zp = 0;
-        float score_sum_scale = 1.0;
-        if (output_per_branch == 3) {
-            score_sum = _outputs[i * output_per_branch + 2]->virt_addr;
-            score_sum_zp = app_ctx->output_attrs[i * output_per_branch + 2].zp;
-            score_sum_scale = app_ctx->output_attrs[i * output_per_branch + 2].scale;
-        }
         int box_idx = i * output_per_branch;
         int score_idx = i * output_per_branch + 1;
-        grid_h = app_ctx->output_attrs[box_idx].dims[1];
-        grid_w = app_ctx->output_attrs[box_idx].dims[2];
-        stride = model_in_h / grid_h;
-        
-        if (app_ctx->is_quant) {
-            validCount += process_i8_rv1106((int8_t *)_outputs[box_idx]->virt_addr, app_ctx->output_attrs[box_idx].zp, app_ctx->output_attrs[box_idx].scale,
-                                (int8_t *)_outputs[score_idx]->virt_addr, app_ctx->output_attrs[score_idx].zp,
-                                app_ctx->output_attrs[score_idx].scale, (int8_t *)score_sum, score_sum_zp, score_sum_scale,
-                                grid_h, grid_w, stride, dfl_len, filterBoxes, objProbs, classId, conf_threshold);
+        branch_args_t args;
+        memset(&args, 0, sizeof(branch_args_t));
+        get_branch_grid(app_ctx, box_idx, &args.grid_h, &args.grid_w);
+        args.stride = model_in_h / args.grid_h;
+        args.dfl_len = dfl_len;
+        args.threshold = conf_threshold;
+        args.num_classes = get_branch_classes(app_ctx, score_idx);
+
+        args.box = get_output_buf(app_ctx, outputs, box_idx, image);
+        args.score = get_output_buf(app_ctx, outputs, score_idx, image);
+        args.score_zp = app_ctx->output_attrs[score_idx].zp;
+        args.score_scale = app_ctx->output_attrs[score_idx].scale;
+        get_output_layout(app_ctx, box_idx, args.grid_h, args.grid_w, &args.box_layout);
+        get_output_layout(app_ctx, score_idx, args.grid_h, args.grid_w, &args.score_layout);
+        args.score_sum_layout = args.score_layout;
+        args.score_sum_scale = 1.0;
+        if (output_per_branch == 3)
+        {
+            args.score_sum = get_output_buf(app_ctx, outputs, score_idx + 1, image);
+            args.score_sum_zp = app_ctx->output_attrs[score_idx + 1].zp;
+            args.score_sum_scale = app_ctx->output_attrs[score_idx + 1].scale;
+            get_output_layout(app_ctx, score_idx + 1, args.grid_h, args.grid_w, &args.score_sum_layout);
         }
-        else
+        if (app_ctx->is_quant)
         {
-            printf("RV1106/1103 only support quantization mode\n", LABEL_NALE_TXT_PATH);
-            return -1;
+            args.dfl_lut = app_ctx->dfl_exp_lut[i];
+#if defined(RV1106_1103)
+            args.dfl_lut_q16 = app_ctx->dfl_exp_lut_q16[i];
+#endif
         }
 
-#else
-        void *score_sum = nullptr;
-        int32_t score_sum_zp = 0;
-        float score_sum_scale = 1.0;
-        if (output_per_branch == 3){
-            score_sum = _outputs[i*output_per_branch + 2].buf;
-            score_sum_zp = app_ctx->output_attrs[i*output_per_branch + 2].zp;
-            score_sum_scale = app_ctx->output_attrs[i*output_per_branch + 2].scale;
+        // mixed layouts fall back to the general NC1HWC2 addressing
+        tensor_layout_kind_t kind = args.box_layout.kind;
+        if (args.score_layout.kind != kind || args.score_sum_layout.kind != kind)
+        {
+            kind = TENSOR_LAYOUT_NC1HWC2;
+        }
+        rknn_tensor_type type = get_decode_type(app_ctx, box_idx);
+        decode_branch_fn decode = select_decoder(type, args.num_classes, kind);
+        if (decode == nullptr)
+        {
+            printf("post_process does not support %s outputs\n", get_type_string(type));
+            return -1;
         }
-        int box_idx = i*output_per_branch;
-        int score_idx = i*output_per_branch + 1;
-
-#ifdef RKNPU1
-        grid_h = app_ctx->output_attrs[box_idx].dims[1];
-        grid_w = app_ctx->output_attrs[box_idx].dims[0];
-#else
-        grid_h = app_ctx->output_attrs[box_idx].dims[2];
-        grid_w = app_ctx->output_attrs[box_idx].dims[3];
-#endif
-        stride = model_in_h / grid_h;
 
-        if (app_ctx->is_quant)
+        int n_bands = (args.grid_h * args.grid_w + band_cells - 1) / band_cells;
+        n_bands = std::min(n_bands, MAX_DECODE_TASKS - n_tasks - (2 - i));
+        n_bands = std::max(1, std::min(n_bands, args.grid_h));
+        int band_rows = (args.grid_h + n_bands - 1) / n_bands;
+        for (int row = 0; row < args.grid_h; row += band_rows)
         {
-#ifdef RKNPU1
-            validCount += process_u8((uint8_t *)_outputs[box_idx].buf, app_ctx->output_attrs[box_idx].zp, app_ctx->output_attrs[box_idx].scale,
-                                     (uint8_t *)_outputs[score_idx].buf, app_ctx->output_attrs[score_idx].zp, app_ctx->output_attrs[score_idx].scale,
-                                     (uint8_t *)score_sum, score_sum_zp, score_sum_scale,
-                                     grid_h, grid_w, stride, dfl_len,
-                                     filterBoxes, objProbs, classId, conf_threshold);
-#else
-            validCount += process_i8((int8_t *)_outputs[box_idx].buf, app_ctx->output_attrs[box_idx].zp, app_ctx->output_attrs[box_idx].scale,
-                                     (int8_t *)_outputs[score_idx].buf, app_ctx->output_attrs[score_idx].zp, app_ctx->output_attrs[score_idx].scale,
-                                     (int8_t *)score_sum, score_sum_zp, score_sum_scale,
-                                     grid_h, grid_w, stride, dfl_len, 
-                                     filterBoxes, objProbs, classId, conf_threshold);
-#endif
+            decode_task_t *t = &tasks[n_tasks++];
+            t->args = args;
+            t->args.row_begin = row;
+            t->args.row_end = std::min(row + band_rows, args.grid_h);
+            t->decode = decode;
+            t->first = first_cell + row * args.grid_w;
+            t->count = 0;
         }
-        else
+        first_cell += args.grid_h * args.grid_w;
+    }
+
+    decode_job_t job = {tasks, ws};
+    thread_pool_run(ws->pool, run_decode_task, &job, n_tasks);
+
+    // close the gaps between task slices, keeping the sequential order
+    for (int t = 0; t < n_tasks; t++)
+    {
+        int first = tasks[t].first;
+        int count = tasks[t].count;
+        if (count > 0 && first != validCount)
         {
-            validCount += process_fp32((float *)_outputs[box_idx].buf, (float *)_outputs[score_idx].buf, (float *)score_sum,
-                                       grid_h, grid_w, stride, dfl_len, 
-                                       filterBoxes, objProbs, classId, conf_threshold);
+            memmove(filterBoxes + validCount * 4, filterBoxes + first * 4, count * 4 * sizeof(float));
+            memmove(objProbs + validCount, objProbs + first, count * sizeof(float));
+            memmove(classId + validCount, classId + first, count * sizeof(int));
         }
+        validCount += count;
+#if defined(RV1106_1103)
+        LOGD("validCount=%d", count);
+        LOGD("grid h-%d, w-%d, stride %d, rows %d-%d", tasks[t].args.grid_h, tasks[t].args.grid_w,
+             tasks[t].args.stride, tasks[t].args.row_begin, tasks[t].args.row_end);
 #endif
     }
 
+    int64_t t_decode = now_ns();
+    ws->timing.decode_ns = t_decode - t_start;
+    ws->timing.select_ns = 0;
+    ws->timing.nms_ns = 0;
+
     // no object detect
     if (validCount <= 0)
     {
         return 0;
     }
-    std::vector<int> indexArray;
-    for (int i = 0; i < validCount; ++i)
-    {
-        indexArray.push_back(i);
-    }
-    quick_sort_indice_inverse(objProbs, 0, validCount - 1, indexArray);
-
-    std::set<int> class_set(std::begin(classId), std::end(classId));
+    int *indexArray = ws->index;
+    validCount = select_top_candidates(objProbs, validCount, MAX_CANDIDATES, indexArray);
+    int64_t t_select = now_ns();
+    ws->timing.select_ns = t_select - t_decode;
 
-    for (auto c : class_set)
+    // Boxes go to the NMS engine in score order, SoA layout
+    nms_workspace_t *nms_ws = &ws->nms;
+    for (int i = 0; i < validCount; ++i)
     {
-        nms(validCount, filterBoxes, classId, indexArray, c, nms_threshold);
+        int n = indexArray[i];
+        nms_set_box(nms_ws, i, filterBoxes[n * 4 + 0], filterBoxes[n * 4 + 1], filterBoxes[n * 4 + 2],
+                    filterBoxes[n * 4 + 3], classId[n]);
     }
+    nms_run(nms_ws, validCount, nms_threshold, NMS_MODE);
+    ws->timing.nms_ns = now_ns() - t_select;
 
     int last_count = 0;
     od_results->count = 0;
 
     /* box valid detect target */
-    for (int i = 0; i < validCount; ++i)
+    for (int i = 0; i < validCount && last_count < MAX_DET; ++i)
     {
-        if (indexArray[i] == -1 || last_count >= OBJ_NUMB_MAX_SIZE)
+        if (nms_ws->suppressed[i])
         {
             continue;
         }
@@ -641,7 +917,7 @@ int post_process(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter
         float x2 = x1 + filterBoxes[n * 4 + 2];
         float y2 = y1 + filterBoxes[n * 4 + 3];
         int id = classId[n];
-        float obj_conf = objProbs[i];
+        float obj_conf = objProbs[n];
 
         od_results->results[last_count].box.left = (int)(clamp(x1, 0, model_in_w) / letter_box->scale);
         od_results->results[last_count].box.top = (int)(clamp(y1, 0, model_in_h) / letter_box->scale);
@@ -655,22 +931,131 @@ int post_process(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter
     return 0;
 }
 
+int post_process(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_box, float conf_threshold, float nms_threshold, object_detect_result_list *od_results)
+{
+    return post_process_image(app_ctx, outputs, 0, letter_box, conf_threshold, nms_threshold, od_results);
+}
+
+int post_process_batch(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_boxes, int n,
+                       float conf_threshold, float nms_threshold, object_detect_result_list **od_results)
+{
+    for (int i = 0; i < n; i++)
+    {
+        int ret = post_process_image(app_ctx, outputs, i, &letter_boxes[i], conf_threshold, nms_threshold,
+                                     od_results[i]);
+        if (ret != 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+int init_dfl_exp_lut(rknn_app_context_t *app_ctx)
+{
+    int output_per_branch = app_ctx->io_num.n_output / 3;
+    if (output_per_branch <= 0)
+    {
+        printf("unexpected output num %d\n", app_ctx->io_num.n_output);
+        return -1;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        rknn_tensor_attr *box_attr = &app_ctx->output_attrs[i * output_per_branch];
+        for (int q = 0; q < 256; q++)
+        {
+#ifdef RKNPU1
+            float val = deqnt_affine_u8_to_f32((uint8_t)q, box_attr->zp, box_attr->scale);
+#else
+            // stored by (q + 128) so int8 lookups can use the raw value
+            float val = deqnt_affine_to_f32((int8_t)(q - 128), box_attr->zp, box_attr->scale);
+#endif
+            app_ctx->dfl_exp_lut[i][q] = exp(val);
+#if defined(RV1106_1103)
+            app_ctx->dfl_exp_lut_q16[i][q] = (uint32_t)(expf(-q * box_attr->scale) * 65536.0f + 0.5f);
+#endif
+        }
+    }
+    return 0;
+}
+
+int init_post_process_workspace(rknn_app_context_t *app_ctx)
+{
+    post_process_workspace_t *ws = &app_ctx->pp_workspace;
+    int output_per_branch = app_ctx->io_num.n_output / 3;
+    if (output_per_branch <= 0)
+    {
+        printf("unexpected output num %d\n", app_ctx->io_num.n_output);
+        return -1;
+    }
+
+    // every grid cell yields at most one candidate
+    int capacity = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        int grid_h = 0;
+        int grid_w = 0;
+        get_branch_grid(app_ctx, i * output_per_branch, &grid_h, &grid_w);
+        capacity += grid_h * grid_w;
+    }
+    int nms_capacity = (MAX_CANDIDATES > 0 && capacity > MAX_CANDIDATES) ? MAX_CANDIDATES : capacity;
+
+    memset(ws, 0, sizeof(post_process_workspace_t));
+    ws->boxes = (float *)malloc(capacity * 4 * sizeof(float));
+    ws->obj_probs = (float *)malloc(capacity * sizeof(float));
+    ws->class_id = (int *)malloc(capacity * sizeof(int));
+    ws->index = (int *)malloc(capacity * sizeof(int));
+    if (!ws->boxes || !ws->obj_probs || !ws->class_id || !ws->index ||
+        nms_workspace_init(&ws->nms, nms_capacity) != 0)
+    {
+        printf("post process workspace malloc fail! capacity=%d\n", capacity);
+        release_post_process_workspace(app_ctx);
+        return -1;
+    }
+    ws->capacity = capacity;
+    if (POST_PROCESS_THREADS > 0)
+    {
+        ws->pool = thread_pool_create(POST_PROCESS_THREADS);
+        if (ws->pool == NULL)
+        {
+            printf("post process thread pool create fail, decoding on one thread\n");
+        }
+    }
+    printf("post process workspace: %d candidates, %d for nms, %d decode threads\n", capacity, nms_capacity,
+           thread_pool_size(ws->pool));
+    return 0;
+}
+
+void release_post_process_workspace(rknn_app_context_t *app_ctx)
+{
+    post_process_workspace_t *ws = &app_ctx->pp_workspace;
+    thread_pool_destroy(ws->pool);
+    free(ws->boxes);
+    free(ws->obj_probs);
+    free(ws->class_id);
+    free(ws->index);
+    nms_workspace_release(&ws->nms);
+    memset(ws, 0, sizeof(post_process_workspace_t));
+}
+
 int init_post_process()
 {
     int ret = 0;
-    ret = loadLabelName(LABEL_NALE_TXT_PATH, labels);
+    ret = loadLabelName(LABEL_NALE_TXT_PATH, &labels);
     if (ret < 0)
     {
         printf("Load %s failed!\n", LABEL_NALE_TXT_PATH);
         return -1;
     }
+    label_count = ret;
     return 0;
 }
 
 char *coco_cls_to_name(int cls_id)
 {
 
-    if (cls_id >= OBJ_CLASS_NUM)
+    if (cls_id < 0 || cls_id >= label_count)
     {
         return "null";
     }
@@ -685,12 +1070,11 @@ char *coco_cls_to_name(int cls_id)
 
 void deinit_post_process()
 {
-    for (int i = 0; i < OBJ_CLASS_NUM; i++)
+    for (int i = 0; i < label_count; i++)
     {
-        if (labels[i] != nullptr)
-        {
-            free(labels[i]);
-            labels[i] = nullptr;
-        }
+        free(labels[i]);
     }
+    free(labels);
+    labels = nullptr;
+    label_count = 0;
 }
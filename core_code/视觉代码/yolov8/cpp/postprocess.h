@@ -9,10 +9,30 @@
 
 #define OBJ_NAME_MAX_SIZE 64
 #define OBJ_NUMB_MAX_SIZE 128
-#define OBJ_CLASS_NUM 1
 #define NMS_THRESH 0.45
 #define BOX_THRESH 0.25
 
+// Candidates kept for NMS (highest scores first) and detections reported per
+// frame, both can be overridden from the build.
+#ifndef MAX_CANDIDATES
+#define MAX_CANDIDATES 1024
+#endif
+#ifndef MAX_DET
+#define MAX_DET OBJ_NUMB_MAX_SIZE
+#endif
+// NMS_MODE_AUTO, NMS_MODE_DENSE or NMS_MODE_GRID, see nms.h
+#ifndef NMS_MODE
+#define NMS_MODE NMS_MODE_AUTO
+#endif
+// Worker threads decoding the output branches in parallel (the big branch is
+// split by rows), 0 decodes everything on the calling thread.
+#ifndef POST_PROCESS_THREADS
+#define POST_PROCESS_THREADS 0
+#endif
+#if MAX_DET > OBJ_NUMB_MAX_SIZE
+#error "MAX_DET must not exceed OBJ_NUMB_MAX_SIZE"
+#endif
+
 // class rknn_app_context_t;
 
 typedef struct {
@@ -28,9 +48,16 @@ typedef struct {
 } object_detect_result_list;
 
 int init_post_process();
+int init_dfl_exp_lut(rknn_app_context_t *app_ctx);
+int init_post_process_workspace(rknn_app_context_t *app_ctx);
+void release_post_process_workspace(rknn_app_context_t *app_ctx);
 void deinit_post_process();
 char *coco_cls_to_name(int cls_id);
 int post_process(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_box, float conf_threshold, float nms_threshold, object_detect_result_list *od_results);
+// Outputs of a batch model, [N, ...] tensors: image i with letter_boxes[i]
+// into od_results[i], for the first n images.
+int post_process_batch(rknn_app_context_t *app_ctx, void *outputs, letterbox_t *letter_boxes, int n,
+                       float conf_threshold, float nms_threshold, object_detect_result_list **od_results);
 
 void deinitPostProcess();
 #endif //_RKNN_YOLOV8_DEMO_POSTPROCESS_H_
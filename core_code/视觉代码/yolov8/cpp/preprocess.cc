@@ -0,0 +1,456 @@
+#include "preprocess.h"
+
+#include "async_log.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PREPROCESS_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PREPROCESS_SSE2
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PREPROCESS_SSSE3
+#endif
+#endif
+
+// Bilinear weights are 7 bit so a horizontally blended sample (<= 255 * 128)
+// still fits a signed 16 bit lane for the vertical pass.
+#define LERP_BITS 7
+#define LERP_ONE (1 << LERP_BITS)
+
+static int src_bytes_per_pixel(image_format_t format)
+{
+    switch ((int)format) // the camera formats are outside image_format_t
+    {
+    case IMAGE_FORMAT_RGB888:
+    case IMAGE_FORMAT_BGR888:
+        return 3;
+    case IMAGE_FORMAT_YUYV422:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+static inline uint8_t clamp_u8(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+// BT.601 limited range, 8 bit fixed point
+static inline void yuv_to_rgb(int y, int u, int v, int *r, int *g, int *b)
+{
+    int c = (y - 16) * 298 + 128;
+    int d = u - 128;
+    int e = v - 128;
+    *r = clamp_u8((c + 409 * e) >> 8);
+    *g = clamp_u8((c - 100 * d - 208 * e) >> 8);
+    *b = clamp_u8((c + 516 * d) >> 8);
+}
+
+// Pixel x of a YUYV row: Y0 U Y1 V holds two pixels sharing U and V
+static inline void load_yuyv(const uint8_t *row, int x, int *r, int *g, int *b)
+{
+    const uint8_t *pair = row + (x & ~1) * 2;
+    yuv_to_rgb(pair[(x & 1) * 2], pair[1], pair[3], r, g, b);
+}
+
+static void release_geometry(letterbox_geometry_t *g)
+{
+    free(g->x_ofs);
+    free(g->x_w);
+    free(g->y_ofs);
+    free(g->y_w);
+    memset(g, 0, sizeof(letterbox_geometry_t));
+}
+
+void release_letterbox_cache(letterbox_cache_t *cache)
+{
+    for (int i = 0; i < cache->n_geometry; i++)
+    {
+        release_geometry(&cache->geometry[i]);
+    }
+    free(cache->rows[0]);
+    free(cache->rows[1]);
+    memset(cache, 0, sizeof(letterbox_cache_t));
+}
+
+// Source position of each output pixel centre, two taps and the weight of the second
+static void build_taps(int src_len, int dst_len, int *ofs, int16_t *w)
+{
+    float ratio = (float)src_len / dst_len;
+    for (int i = 0; i < dst_len; i++)
+    {
+        float s = (i + 0.5f) * ratio - 0.5f;
+        int s0 = (int)floorf(s);
+        float f = s - s0;
+        if (s0 < 0)
+        {
+            s0 = 0;
+            f = 0;
+        }
+        if (s0 >= src_len - 1)
+        {
+            s0 = src_len - 1;
+            f = 0;
+        }
+        int wi = (int)(f * LERP_ONE + 0.5f);
+        if (wi == LERP_ONE)
+        {
+            s0++;
+            wi = 0;
+        }
+        ofs[i * 2] = s0;
+        ofs[i * 2 + 1] = wi != 0 ? s0 + 1 : s0; // a zero weight never reads a second row
+        w[i] = (int16_t)wi;
+    }
+}
+
+static int build_geometry(letterbox_geometry_t *g, const letterbox_cache_t *cache, const image_buffer_t *src)
+{
+    float scale = fminf((float)cache->dst_width / src->width, (float)cache->dst_height / src->height);
+    int resize_w = (int)(src->width * scale);
+    int resize_h = (int)(src->height * scale);
+    resize_w = resize_w < 1 ? 1 : (resize_w > cache->dst_width ? cache->dst_width : resize_w);
+    resize_h = resize_h < 1 ? 1 : (resize_h > cache->dst_height ? cache->dst_height : resize_h);
+
+    g->x_ofs = (int *)malloc(resize_w * 2 * sizeof(int));
+    g->x_w = (int16_t *)malloc(resize_w * sizeof(int16_t));
+    g->y_ofs = (int *)malloc(resize_h * 2 * sizeof(int));
+    g->y_w = (int16_t *)malloc(resize_h * sizeof(int16_t));
+    if (g->x_ofs == NULL || g->x_w == NULL || g->y_ofs == NULL || g->y_w == NULL)
+    {
+        printf("malloc letterbox cache fail!\n");
+        release_geometry(g);
+        return -1;
+    }
+    build_taps(src->width, resize_w, g->x_ofs, g->x_w);
+    build_taps(src->height, resize_h, g->y_ofs, g->y_w);
+
+    g->src_width = src->width;
+    g->src_height = src->height;
+    g->src_format = src->format;
+    g->resize_w = resize_w;
+    g->resize_h = resize_h;
+    g->x_pad = (cache->dst_width - resize_w) / 2;
+    g->y_pad = (cache->dst_height - resize_h) / 2;
+    g->scale = scale;
+    LOGI("letterbox %dx%d -> %dx%d, scale %.3f, pad %d,%d", src->width, src->height, resize_w, resize_h, scale,
+         g->x_pad, g->y_pad);
+    return 0;
+}
+
+// Geometry for src, built on first use. The destination or background
+// changing drops all of them (only happens when the caller rebinds buffers).
+static const letterbox_geometry_t *find_geometry(letterbox_cache_t *cache, const image_buffer_t *src,
+                                                 const image_buffer_t *dst, int dst_stride, int bg_color)
+{
+    if (cache->dst != dst->virt_addr || cache->dst_width != dst->width || cache->dst_height != dst->height ||
+        cache->dst_stride != dst_stride || cache->bg_color != bg_color)
+    {
+        release_letterbox_cache(cache);
+        cache->dst = dst->virt_addr;
+        cache->dst_width = dst->width;
+        cache->dst_height = dst->height;
+        cache->dst_stride = dst_stride;
+        cache->bg_color = bg_color;
+    }
+    for (int i = 0; i < cache->n_geometry; i++)
+    {
+        const letterbox_geometry_t *g = &cache->geometry[i];
+        if (g->src_width == src->width && g->src_height == src->height && g->src_format == src->format)
+        {
+            return g;
+        }
+    }
+
+    letterbox_geometry_t *g;
+    if (cache->n_geometry < LETTERBOX_CACHE_GEOMETRIES)
+    {
+        g = &cache->geometry[cache->n_geometry++];
+    }
+    else
+    {
+        g = &cache->geometry[cache->next_evict];
+        cache->next_evict = (cache->next_evict + 1) % LETTERBOX_CACHE_GEOMETRIES;
+        if (cache->painted == g)
+        {
+            cache->painted = NULL;
+        }
+        release_geometry(g);
+    }
+    if (build_geometry(g, cache, src) != 0)
+    {
+        // keep the table dense, the failed slot is the last or an evicted one
+        *g = cache->geometry[--cache->n_geometry];
+        memset(&cache->geometry[cache->n_geometry], 0, sizeof(letterbox_geometry_t));
+        cache->painted = NULL;
+        return NULL;
+    }
+
+    if (g->resize_w > cache->rows_width)
+    {
+        free(cache->rows[0]);
+        free(cache->rows[1]);
+        cache->rows[0] = (uint16_t *)malloc(g->resize_w * 3 * sizeof(uint16_t));
+        cache->rows[1] = (uint16_t *)malloc(g->resize_w * 3 * sizeof(uint16_t));
+        cache->rows_width = g->resize_w;
+        if (cache->rows[0] == NULL || cache->rows[1] == NULL)
+        {
+            printf("malloc letterbox cache fail!\n");
+            release_letterbox_cache(cache);
+            return NULL;
+        }
+    }
+    return g;
+}
+
+// Everything outside the image area of g; the previous geometry's image may
+// be there. Skipped while the same geometry keeps coming.
+static void paint_pads(letterbox_cache_t *cache, const letterbox_geometry_t *g)
+{
+    if (cache->painted == g)
+    {
+        return;
+    }
+    int width = cache->dst_width;
+    for (int y = 0; y < cache->dst_height; y++)
+    {
+        uint8_t *row = cache->dst + (size_t)y * cache->dst_stride * 3;
+        if (y < g->y_pad || y >= g->y_pad + g->resize_h)
+        {
+            memset(row, cache->bg_color, width * 3);
+            continue;
+        }
+        memset(row, cache->bg_color, g->x_pad * 3);
+        int right = g->x_pad + g->resize_w;
+        memset(row + right * 3, cache->bg_color, (width - right) * 3);
+    }
+    cache->painted = g;
+}
+
+// ---- same size: colour conversion only --------------------------------
+
+static void swap_rb_row(const uint8_t *src, uint8_t *dst, int width)
+{
+    int i = 0;
+#if defined(PREPROCESS_NEON)
+    for (; i + 16 <= width; i += 16)
+    {
+        uint8x16x3_t v = vld3q_u8(src + i * 3);
+        uint8x16_t t = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = t;
+        vst3q_u8(dst + i * 3, v);
+    }
+#elif defined(PREPROCESS_SSSE3)
+    // 4 pixels per 16 byte shuffle, the 4 spare bytes are rewritten by the
+    // next step or the scalar tail
+    const __m128i swap = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 12, 13, 14, 15);
+    for (; i + 6 <= width; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i * 3));
+        _mm_storeu_si128((__m128i *)(dst + i * 3), _mm_shuffle_epi8(v, swap));
+    }
+#endif
+    for (; i < width; i++)
+    {
+        dst[i * 3 + 0] = src[i * 3 + 2];
+        dst[i * 3 + 1] = src[i * 3 + 1];
+        dst[i * 3 + 2] = src[i * 3 + 0];
+    }
+}
+
+static void yuyv_row(const uint8_t *src, uint8_t *dst, int width)
+{
+    for (int i = 0; i < width; i++)
+    {
+        int r, g, b;
+        load_yuyv(src, i, &r, &g, &b);
+        dst[i * 3 + 0] = r;
+        dst[i * 3 + 1] = g;
+        dst[i * 3 + 2] = b;
+    }
+}
+
+static void convert_rows(const letterbox_cache_t *cache, const letterbox_geometry_t *g, const uint8_t *src,
+                         int src_stride, uint8_t *dst)
+{
+    for (int y = 0; y < g->resize_h; y++)
+    {
+        const uint8_t *s = src + (size_t)y * src_stride;
+        uint8_t *d = dst + ((size_t)(g->y_pad + y) * cache->dst_stride + g->x_pad) * 3;
+        switch ((int)g->src_format)
+        {
+        case IMAGE_FORMAT_BGR888:
+            swap_rb_row(s, d, g->resize_w);
+            break;
+        case IMAGE_FORMAT_YUYV422:
+            yuyv_row(s, d, g->resize_w);
+            break;
+        default:
+            memcpy(d, s, g->resize_w * 3);
+            break;
+        }
+    }
+}
+
+// ---- resize: horizontal taps per source row, vertical blend per output row
+
+static void resize_row_h(const letterbox_geometry_t *g, const uint8_t *src, uint16_t *out)
+{
+    const int *ofs = g->x_ofs;
+    const int16_t *xw = g->x_w;
+    int n = g->resize_w;
+    switch ((int)g->src_format)
+    {
+    case IMAGE_FORMAT_BGR888:
+    case IMAGE_FORMAT_RGB888:
+    {
+        // channel order is folded into the taps
+        int c0 = g->src_format == IMAGE_FORMAT_BGR888 ? 2 : 0;
+        int c2 = 2 - c0;
+        for (int i = 0; i < n; i++)
+        {
+            const uint8_t *p0 = src + ofs[i * 2] * 3;
+            const uint8_t *p1 = src + ofs[i * 2 + 1] * 3;
+            int w1 = xw[i];
+            int w0 = LERP_ONE - w1;
+            out[i * 3 + 0] = p0[c0] * w0 + p1[c0] * w1;
+            out[i * 3 + 1] = p0[1] * w0 + p1[1] * w1;
+            out[i * 3 + 2] = p0[c2] * w0 + p1[c2] * w1;
+        }
+        break;
+    }
+    case IMAGE_FORMAT_YUYV422:
+        for (int i = 0; i < n; i++)
+        {
+            int r0, g0, b0, r1, g1, b1;
+            load_yuyv(src, ofs[i * 2], &r0, &g0, &b0);
+            load_yuyv(src, ofs[i * 2 + 1], &r1, &g1, &b1);
+            int w1 = xw[i];
+            int w0 = LERP_ONE - w1;
+            out[i * 3 + 0] = r0 * w0 + r1 * w1;
+            out[i * 3 + 1] = g0 * w0 + g1 * w1;
+            out[i * 3 + 2] = b0 * w0 + b1 * w1;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Horizontally resized source row sy, kept in whichever buffer does not
+// hold row `keep` (the other tap of the same output row).
+static const uint16_t *get_resized_row(letterbox_cache_t *cache, const letterbox_geometry_t *g, const uint8_t *src,
+                                       int src_stride, int sy, int keep)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (cache->row_y[i] == sy)
+        {
+            return cache->rows[i];
+        }
+    }
+    int slot = cache->row_y[0] == keep ? 1 : 0;
+    resize_row_h(g, src + (size_t)sy * src_stride, cache->rows[slot]);
+    cache->row_y[slot] = sy;
+    return cache->rows[slot];
+}
+
+static void blend_rows(const uint16_t *r0, const uint16_t *r1, int wy, uint8_t *dst, int n)
+{
+    int i = 0;
+    const int shift = LERP_BITS * 2;
+#if defined(PREPROCESS_NEON)
+    uint16x4_t w0 = vdup_n_u16(LERP_ONE - wy);
+    uint16x4_t w1 = vdup_n_u16(wy);
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t a = vld1q_u16(r0 + i);
+        uint16x8_t b = vld1q_u16(r1 + i);
+        uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(a), w0), vget_low_u16(b), w1);
+        uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(a), w0), vget_high_u16(b), w1);
+        uint16x8_t s = vcombine_u16(vrshrn_n_u32(lo, LERP_BITS * 2), vrshrn_n_u32(hi, LERP_BITS * 2));
+        vst1_u8(dst + i, vqmovn_u16(s));
+    }
+#elif defined(PREPROCESS_SSE2)
+    // (a, b) pairs against (w0, w1) pairs, one madd per 4 samples
+    const __m128i w = _mm_set1_epi32((wy << 16) | (LERP_ONE - wy));
+    const __m128i round = _mm_set1_epi32(1 << (shift - 1));
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(r0 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(r1 + i));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w);
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), shift);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), shift);
+        __m128i s = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(s, s));
+    }
+#endif
+    for (; i < n; i++)
+    {
+        dst[i] = (uint8_t)((r0[i] * (LERP_ONE - wy) + r1[i] * wy + (1 << (shift - 1))) >> shift);
+    }
+}
+
+static void resize_rows(letterbox_cache_t *cache, const letterbox_geometry_t *g, const uint8_t *src, int src_stride,
+                        uint8_t *dst)
+{
+    // the source changed since the last frame
+    cache->row_y[0] = -1;
+    cache->row_y[1] = -1;
+    for (int y = 0; y < g->resize_h; y++)
+    {
+        int sy0 = g->y_ofs[y * 2];
+        int sy1 = g->y_ofs[y * 2 + 1];
+        const uint16_t *r0 = get_resized_row(cache, g, src, src_stride, sy0, sy1);
+        const uint16_t *r1 = get_resized_row(cache, g, src, src_stride, sy1, sy0);
+        uint8_t *d = dst + ((size_t)(g->y_pad + y) * cache->dst_stride + g->x_pad) * 3;
+        blend_rows(r0, r1, g->y_w[y], d, g->resize_w * 3);
+    }
+}
+
+int convert_image_with_letterbox_fused(letterbox_cache_t *cache, image_buffer_t *src, image_buffer_t *dst,
+                                       letterbox_t *letterbox, int bg_color)
+{
+    int bpp = src_bytes_per_pixel(src->format);
+    if (bpp == 0 || dst->format != IMAGE_FORMAT_RGB888)
+    {
+        // the caller's fallback rewrites the whole buffer, pads included
+        cache->painted = NULL;
+        return 1;
+    }
+    if (src->virt_addr == NULL || dst->virt_addr == NULL || src->width <= 0 || src->height <= 0)
+    {
+        printf("letterbox: bad image %dx%d\n", src->width, src->height);
+        return -1;
+    }
+    int dst_stride = dst->width_stride > 0 ? dst->width_stride : dst->width;
+    const letterbox_geometry_t *g = find_geometry(cache, src, dst, dst_stride, bg_color);
+    if (g == NULL)
+    {
+        return -1;
+    }
+    paint_pads(cache, g);
+    int src_stride = (src->width_stride > 0 ? src->width_stride : src->width) * bpp;
+
+    if (g->resize_w == src->width && g->resize_h == src->height)
+    {
+        convert_rows(cache, g, src->virt_addr, src_stride, dst->virt_addr);
+    }
+    else
+    {
+        resize_rows(cache, g, src->virt_addr, src_stride, dst->virt_addr);
+    }
+
+    letterbox->x_pad = g->x_pad;
+    letterbox->y_pad = g->y_pad;
+    letterbox->scale = g->scale;
+    return 0;
+}
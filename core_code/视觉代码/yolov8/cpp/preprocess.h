@@ -0,0 +1,61 @@
+#ifndef _RKNN_YOLOV8_DEMO_PREPROCESS_H_
+#define _RKNN_YOLOV8_DEMO_PREPROCESS_H_
+
+#include <stdint.h>
+
+#include "common.h"
+
+// Camera formats on top of image_format_t, only read by
+// convert_image_with_letterbox_fused
+#define IMAGE_FORMAT_BGR888 ((image_format_t)0x100)  // OpenCV frames
+#define IMAGE_FORMAT_YUYV422 ((image_format_t)0x101) // V4L2 YUYV, BT.601 limited range
+
+// Source resolutions one cache keeps taps for, one per camera of
+// main.cc's round-robin ingest (CAMERA_MAX) is enough to never rebuild
+#define LETTERBOX_CACHE_GEOMETRIES 8
+
+// Letterbox geometry and bilinear taps for one source size and format
+typedef struct {
+    int src_width;
+    int src_height;
+    image_format_t src_format;
+    int resize_w;
+    int resize_h;
+    int x_pad;
+    int y_pad;
+    float scale;
+    int *x_ofs;           // resize_w * 2, left and right source column
+    int16_t *x_w;         // resize_w, weight of the right column out of 128
+    int *y_ofs;           // resize_h * 2, upper and lower source row
+    int16_t *y_w;         // resize_h, weight of the lower row out of 128
+} letterbox_geometry_t;
+
+// Geometries for one destination buffer, built the first time a source
+// resolution is seen, so frames from cameras with different resolutions
+// alternate without rebuilding. Zero initialised is empty.
+typedef struct {
+    unsigned char *dst;   // pads are written when the geometry changes, the image area every frame
+    int dst_width;
+    int dst_height;
+    int dst_stride;       // pixels
+    int bg_color;
+    letterbox_geometry_t geometry[LETTERBOX_CACHE_GEOMETRIES];
+    int n_geometry;
+    int next_evict;       // replaced next when all are in use
+    const letterbox_geometry_t *painted; // whose pads dst holds, NULL none
+    uint16_t *rows[2];    // horizontally resized source rows, RGB * 128
+    int rows_width;       // pixels rows[] holds, the widest resize_w so far
+    int row_y[2];         // source row held in rows[i] this frame, -1 none
+} letterbox_cache_t;
+
+// Colour conversion (BGR888 / YUYV422 / RGB888 to RGB888), bilinear resize
+// and the bg_color letterbox in one pass over src, straight into dst (RGB888,
+// dst->width_stride pixels per row if set). Returns 0 when done, 1 if src is
+// in a format it does not read (use convert_image_with_letterbox) and -1 on
+// error.
+int convert_image_with_letterbox_fused(letterbox_cache_t *cache, image_buffer_t *src, image_buffer_t *dst,
+                                       letterbox_t *letterbox, int bg_color);
+
+void release_letterbox_cache(letterbox_cache_t *cache);
+
+#endif //_RKNN_YOLOV8_DEMO_PREPROCESS_H_
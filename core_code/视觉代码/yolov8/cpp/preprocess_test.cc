@@ -0,0 +1,402 @@
+// Checks convert_image_with_letterbox_fused against a plain float bilinear
+// reference: BGR888, YUYV422 and RGB888 sources, odd sizes and strides, the
+// same-size (colour conversion only) path, and one cache shared by sources
+// of different resolutions, which must hit its geometries after the first
+// round instead of rebuilding them.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc_stats.h"
+#include "preprocess.h"
+
+#define TEST_BG_COLOR 114
+#define TEST_GAP_BYTE 0xee  // written into the stride gap, must survive
+#define TEST_MAX_ERROR 2    // 7 bit weights against float
+
+typedef struct {
+    image_buffer_t img;
+    uint8_t *data;
+} test_source_t;
+
+typedef struct {
+    const char *name;
+    int src_width;
+    int src_height;
+    int src_stride;  // pixels, 0 packed
+    int dst_width;
+    int dst_height;
+    int dst_stride;  // pixels
+} test_case_t;
+
+static const char *format_name(image_format_t format)
+{
+    switch ((int)format)
+    {
+    case IMAGE_FORMAT_BGR888:
+        return "bgr";
+    case IMAGE_FORMAT_YUYV422:
+        return "yuyv";
+    default:
+        return "rgb";
+    }
+}
+
+// Noise with a smooth ramp in the first channel, so both the taps and the
+// weights show up in the error.
+static int make_source(test_source_t *s, int width, int height, int stride, image_format_t format, int seed)
+{
+    int bpp = format == IMAGE_FORMAT_YUYV422 ? 2 : 3;
+    int row_pixels = stride > 0 ? stride : width;
+    s->data = (uint8_t *)malloc((size_t)row_pixels * height * bpp);
+    if (s->data == NULL)
+    {
+        printf("malloc source fail!\n");
+        return -1;
+    }
+    for (int y = 0; y < height; y++)
+    {
+        uint8_t *row = s->data + (size_t)y * row_pixels * bpp;
+        for (int i = 0; i < row_pixels * bpp; i++)
+        {
+            row[i] = (uint8_t)(((uint32_t)(y * row_pixels * bpp + i + seed) * 2654435761u) >> 24);
+        }
+        if (bpp == 3)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                row[x * 3] = (uint8_t)(x * 7 + y * 3);
+            }
+        }
+    }
+    memset(&s->img, 0, sizeof(image_buffer_t));
+    s->img.width = width;
+    s->img.height = height;
+    s->img.width_stride = stride;
+    s->img.format = format;
+    s->img.virt_addr = s->data;
+    return 0;
+}
+
+static int clamp_u8(int v) { return v < 0 ? 0 : (v > 255 ? 255 : v); }
+
+static void reference_rgb(const image_buffer_t *src, int x, int y, float *rgb)
+{
+    int row_pixels = src->width_stride > 0 ? src->width_stride : src->width;
+    if (src->format == IMAGE_FORMAT_YUYV422)
+    {
+        // BT.601 limited range, one U/V pair per two pixels
+        const uint8_t *p = src->virt_addr + (size_t)y * row_pixels * 2 + (x & ~1) * 2;
+        int c = (p[(x & 1) * 2] - 16) * 298 + 128;
+        int d = p[1] - 128;
+        int e = p[3] - 128;
+        rgb[0] = clamp_u8((c + 409 * e) >> 8);
+        rgb[1] = clamp_u8((c - 100 * d - 208 * e) >> 8);
+        rgb[2] = clamp_u8((c + 516 * d) >> 8);
+        return;
+    }
+    const uint8_t *p = src->virt_addr + ((size_t)y * row_pixels + x) * 3;
+    bool bgr = src->format == IMAGE_FORMAT_BGR888;
+    rgb[0] = p[bgr ? 2 : 0];
+    rgb[1] = p[1];
+    rgb[2] = p[bgr ? 0 : 2];
+}
+
+// Compares dst (dst_stride pixels per row) with the reference letterbox of
+// src. Returns the largest channel error inside the image, or -1 if a pad
+// or the stride gap is wrong.
+static int check_frame(const image_buffer_t *src, const image_buffer_t *dst, const letterbox_t *letterbox)
+{
+    int sw = src->width;
+    int sh = src->height;
+    int dst_stride = dst->width_stride > 0 ? dst->width_stride : dst->width;
+    float scale = fminf((float)dst->width / sw, (float)dst->height / sh);
+    int rw = (int)(sw * scale);
+    int rh = (int)(sh * scale);
+    int max_error = 0;
+
+    for (int y = 0; y < dst->height; y++)
+    {
+        const uint8_t *row = dst->virt_addr + (size_t)y * dst_stride * 3;
+        for (int x = dst->width * 3; x < dst_stride * 3; x++)
+        {
+            if (row[x] != TEST_GAP_BYTE)
+            {
+                printf("stride gap written at %d,%d\n", x / 3, y);
+                return -1;
+            }
+        }
+        for (int x = 0; x < dst->width; x++)
+        {
+            const uint8_t *o = row + x * 3;
+            int ix = x - letterbox->x_pad;
+            int iy = y - letterbox->y_pad;
+            if (ix < 0 || iy < 0 || ix >= rw || iy >= rh)
+            {
+                if (o[0] != TEST_BG_COLOR || o[1] != TEST_BG_COLOR || o[2] != TEST_BG_COLOR)
+                {
+                    printf("pad pixel %d,%d is %d,%d,%d\n", x, y, o[0], o[1], o[2]);
+                    return -1;
+                }
+                continue;
+            }
+            // pixel centres, clamped to the edge like the taps
+            float fx = (ix + 0.5f) * sw / rw - 0.5f;
+            float fy = (iy + 0.5f) * sh / rh - 0.5f;
+            fx = fx < 0 ? 0 : fx;
+            fy = fy < 0 ? 0 : fy;
+            int x0 = (int)fx;
+            int y0 = (int)fy;
+            if (x0 >= sw - 1)
+            {
+                x0 = sw - 1;
+                fx = x0;
+            }
+            if (y0 >= sh - 1)
+            {
+                y0 = sh - 1;
+                fy = y0;
+            }
+            int x1 = x0 + 1 < sw ? x0 + 1 : x0;
+            int y1 = y0 + 1 < sh ? y0 + 1 : y0;
+            float ax = fx - x0;
+            float ay = fy - y0;
+            float p00[3], p01[3], p10[3], p11[3];
+            reference_rgb(src, x0, y0, p00);
+            reference_rgb(src, x1, y0, p01);
+            reference_rgb(src, x0, y1, p10);
+            reference_rgb(src, x1, y1, p11);
+            for (int ch = 0; ch < 3; ch++)
+            {
+                float v = (p00[ch] * (1 - ax) + p01[ch] * ax) * (1 - ay) + (p10[ch] * (1 - ax) + p11[ch] * ax) * ay;
+                int error = abs((int)lrintf(v) - o[ch]);
+                max_error = error > max_error ? error : max_error;
+            }
+        }
+    }
+    return max_error;
+}
+
+static int make_dst(image_buffer_t *dst, int width, int height, int stride)
+{
+    size_t size = (size_t)stride * height * 3;
+    memset(dst, 0, sizeof(image_buffer_t));
+    dst->virt_addr = (unsigned char *)malloc(size);
+    if (dst->virt_addr == NULL)
+    {
+        printf("malloc dst fail!\n");
+        return -1;
+    }
+    memset(dst->virt_addr, TEST_GAP_BYTE, size);
+    dst->width = width;
+    dst->height = height;
+    dst->width_stride = stride == width ? 0 : stride;
+    dst->format = IMAGE_FORMAT_RGB888;
+    return 0;
+}
+
+// One source into a fresh cache, converted twice so the second frame runs
+// with the pads already painted.
+static int run_case(const test_case_t *c, image_format_t format)
+{
+    // YUYV carries one U/V pair per two pixels, odd widths are rounded down
+    int src_width = format == IMAGE_FORMAT_YUYV422 ? c->src_width & ~1 : c->src_width;
+    test_source_t src;
+    image_buffer_t dst;
+    if (make_source(&src, src_width, c->src_height, c->src_stride, format, 0) != 0)
+    {
+        return -1;
+    }
+    if (make_dst(&dst, c->dst_width, c->dst_height, c->dst_stride) != 0)
+    {
+        free(src.data);
+        return -1;
+    }
+
+    letterbox_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    letterbox_t letterbox;
+    memset(&letterbox, 0, sizeof(letterbox));
+    int max_error = -1;
+    for (int i = 0; i < 2; i++)
+    {
+        if (convert_image_with_letterbox_fused(&cache, &src.img, &dst, &letterbox, TEST_BG_COLOR) != 0)
+        {
+            printf("convert_image_with_letterbox_fused fail!\n");
+            max_error = -1;
+            break;
+        }
+        max_error = check_frame(&src.img, &dst, &letterbox);
+        if (max_error < 0)
+        {
+            break;
+        }
+    }
+    // the same-size path only converts colour, it must be exact
+    const letterbox_geometry_t *g = &cache.geometry[0];
+    bool same_size = cache.n_geometry == 1 && g->resize_w == src_width && g->resize_h == c->src_height;
+    int limit = same_size ? 0 : TEST_MAX_ERROR;
+    int failed = max_error < 0 || max_error > limit;
+    printf("%-10s %-4s %4dx%-4d -> %dx%d stride %d: pad %d,%d%s max error %d%s\n", c->name, format_name(format),
+           src_width, c->src_height, c->dst_width, c->dst_height, c->dst_stride, letterbox.x_pad, letterbox.y_pad,
+           same_size ? " same size," : "", max_error, failed ? " FAIL" : "");
+
+    release_letterbox_cache(&cache);
+    free(src.data);
+    free(dst.virt_addr);
+    return failed ? -1 : 0;
+}
+
+// Cameras of different resolutions and formats sharing one cache and one
+// destination, in a mixed order: every frame must be right (pads repainted
+// on a change) and after the first round the geometries are hits, not
+// rebuilt and without heap allocations.
+static int run_shared_cache()
+{
+    static const struct {
+        int width, height;
+        image_format_t format;
+    } cams[] = {
+        {640, 480, IMAGE_FORMAT_BGR888},
+        {1280, 720, IMAGE_FORMAT_BGR888},
+        {640, 640, IMAGE_FORMAT_YUYV422},
+        {321, 961, IMAGE_FORMAT_RGB888},
+        {640, 480, IMAGE_FORMAT_YUYV422},  // same size as the first, other format
+    };
+    const int n_cams = sizeof(cams) / sizeof(cams[0]);
+    test_source_t src[n_cams];
+    image_buffer_t dst;
+    int failed = 0;
+
+    memset(src, 0, sizeof(src));
+    for (int i = 0; i < n_cams; i++)
+    {
+        if (make_source(&src[i], cams[i].width, cams[i].height, 0, cams[i].format, i * 77) != 0)
+        {
+            failed = 1;
+        }
+    }
+    if (failed || make_dst(&dst, 640, 640, 672) != 0)
+    {
+        for (int i = 0; i < n_cams; i++)
+        {
+            free(src[i].data);
+        }
+        return -1;
+    }
+
+    letterbox_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    letterbox_t letterbox;
+    memset(&letterbox, 0, sizeof(letterbox));
+    int *x_ofs[LETTERBOX_CACHE_GEOMETRIES];
+    uint64_t steady_allocs = 0;
+    int bad_frames = 0;
+    for (int f = 0; f < 8 * n_cams; f++)
+    {
+        int cam = f < n_cams ? f : (f * 7) % n_cams;
+        uint64_t allocs = alloc_stats_thread_count();
+        if (convert_image_with_letterbox_fused(&cache, &src[cam].img, &dst, &letterbox, TEST_BG_COLOR) != 0)
+        {
+            printf("convert_image_with_letterbox_fused fail!\n");
+            failed = 1;
+            break;
+        }
+        if (f >= n_cams)
+        {
+            steady_allocs += alloc_stats_thread_count() - allocs;
+        }
+        int max_error = check_frame(&src[cam].img, &dst, &letterbox);
+        if (max_error < 0 || max_error > TEST_MAX_ERROR)
+        {
+            printf("frame %d camera %d: max error %d\n", f, cam, max_error);
+            bad_frames++;
+        }
+        if (f == n_cams - 1)
+        {
+            for (int i = 0; i < cache.n_geometry; i++)
+            {
+                x_ofs[i] = cache.geometry[i].x_ofs;
+            }
+        }
+    }
+
+    // a rebuilt geometry gets new tap tables
+    int rebuilt = 0;
+    for (int i = 0; i < cache.n_geometry && !failed; i++)
+    {
+        rebuilt += cache.geometry[i].x_ofs != x_ofs[i];
+    }
+    failed |= bad_frames != 0 || rebuilt != 0 || cache.n_geometry != n_cams || steady_allocs != 0;
+    printf("shared cache: %d cameras, %d geometries, %d rebuilt, %d bad frames, %llu steady state allocations%s\n",
+           n_cams, cache.n_geometry, rebuilt, bad_frames, (unsigned long long)steady_allocs, failed ? " FAIL" : "");
+
+    // more resolutions than the cache holds: evicted geometries still right
+    bad_frames = 0;
+    for (int k = 0; k < 3 * LETTERBOX_CACHE_GEOMETRIES; k++)
+    {
+        image_buffer_t img = src[0].img;
+        img.width = 101 + k * 10;
+        img.height = 81;
+        img.width_stride = src[0].img.width;
+        if (convert_image_with_letterbox_fused(&cache, &img, &dst, &letterbox, TEST_BG_COLOR) != 0)
+        {
+            printf("convert_image_with_letterbox_fused fail!\n");
+            bad_frames++;
+            break;
+        }
+        int max_error = check_frame(&img, &dst, &letterbox);
+        bad_frames += max_error < 0 || max_error > TEST_MAX_ERROR;
+    }
+    printf("eviction: %d geometries, %d bad frames%s\n", cache.n_geometry, bad_frames, bad_frames ? " FAIL" : "");
+    failed |= bad_frames != 0;
+
+    release_letterbox_cache(&cache);
+    for (int i = 0; i < n_cams; i++)
+    {
+        free(src[i].data);
+    }
+    free(dst.virt_addr);
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    (void)argv;
+    if (argc != 1)
+    {
+        printf("Usage: %s\n", argv[0]);
+        return -1;
+    }
+    static const test_case_t cases[] = {
+        {"vga", 640, 480, 0, 640, 640, 640},       // same size, pads top and bottom
+        {"square", 640, 640, 0, 640, 640, 640},    // same size, no pads
+        {"odd-same", 101, 64, 0, 101, 101, 104},   // same size, odd width
+        {"720p", 1280, 720, 0, 640, 640, 640},
+        {"1080p", 1920, 1080, 1928, 640, 640, 656},
+        {"odd", 321, 243, 0, 640, 640, 640},       // upscale
+        {"odd-small", 101, 77, 103, 64, 64, 70},
+        {"tall", 479, 638, 0, 640, 640, 640},
+    };
+    static const image_format_t formats[] = {IMAGE_FORMAT_BGR888, IMAGE_FORMAT_YUYV422, IMAGE_FORMAT_RGB888};
+    int failures = 0;
+
+    for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    {
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        {
+            failures += run_case(&cases[i], formats[f]) != 0;
+        }
+    }
+    failures += run_shared_cache() != 0;
+    if (failures)
+    {
+        printf("preprocess test: %d failures\n", failures);
+        return -1;
+    }
+    printf("preprocess test passed\n");
+    return 0;
+}
@@ -0,0 +1,300 @@
+// Runs post_process on output captures (see capture.h) without an NPU,
+// compares against the detections recorded on the board and reports the
+// time of each post-process stage.
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yolov8.h"
+#include "capture.h"
+
+// x86 libm and the board can differ in the last bits of exp()
+#define GOLDEN_BOX_TOL 1
+#define GOLDEN_PROP_TOL 1e-4f
+
+typedef struct {
+    int64_t total;
+    int64_t min;
+    int64_t max;
+    int count;
+} stage_stats_t;
+
+static int64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void stage_add(stage_stats_t *s, int64_t ns)
+{
+    if (s->count == 0 || ns < s->min)
+    {
+        s->min = ns;
+    }
+    if (s->count == 0 || ns > s->max)
+    {
+        s->max = ns;
+    }
+    s->total += ns;
+    s->count++;
+}
+
+static void stage_print(const char *name, const stage_stats_t *s)
+{
+    if (s->count == 0)
+    {
+        return;
+    }
+    printf("%-8s avg %9.1f us  min %9.1f us  max %9.1f us\n", name, s->total / 1000.0 / s->count, s->min / 1000.0,
+           s->max / 1000.0);
+}
+
+static void fill_tensor_attr(rknn_tensor_attr *dst, const output_capture_attr_t *src, int index, bool is_quant)
+{
+    memset(dst, 0, sizeof(rknn_tensor_attr));
+    dst->index = index;
+    dst->n_dims = src->n_dims;
+    for (uint32_t i = 0; i < src->n_dims; i++)
+    {
+        dst->dims[i] = src->dims[i];
+    }
+    dst->fmt = (rknn_tensor_format)src->fmt;
+    dst->type = (rknn_tensor_type)src->type;
+    dst->qnt_type = is_quant ? RKNN_TENSOR_QNT_AFFINE_ASYMMETRIC : RKNN_TENSOR_QNT_NONE;
+    dst->zp = src->zp;
+    dst->scale = src->scale;
+    dst->size = src->size;
+}
+
+static int init_replay_context(const output_capture_header_t *hdr, rknn_app_context_t *app_ctx)
+{
+    memset(app_ctx, 0, sizeof(rknn_app_context_t));
+    app_ctx->io_num.n_output = hdr->n_output;
+    app_ctx->model_width = hdr->model_width;
+    app_ctx->model_height = hdr->model_height;
+    app_ctx->model_channel = hdr->model_channel;
+    app_ctx->batch = 1; // captures come from batch-1 models
+    app_ctx->is_quant = hdr->is_quant != 0;
+
+    app_ctx->output_attrs = (rknn_tensor_attr *)calloc(hdr->n_output, sizeof(rknn_tensor_attr));
+    if (app_ctx->output_attrs == NULL)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < hdr->n_output; i++)
+    {
+        fill_tensor_attr(&app_ctx->output_attrs[i], &hdr->attrs[i], i, app_ctx->is_quant);
+    }
+#if defined(ZERO_COPY)
+    // the captured bytes, native layout for zero copy captures and plain
+    // NCHW int8/float for rknn_outputs_get ones
+    app_ctx->output_native_attrs = (rknn_tensor_attr *)calloc(hdr->n_output, sizeof(rknn_tensor_attr));
+    if (app_ctx->output_native_attrs == NULL)
+    {
+        return -1;
+    }
+    for (uint32_t i = 0; i < hdr->n_output; i++)
+    {
+        fill_tensor_attr(&app_ctx->output_native_attrs[i], &hdr->bufs[i], i, app_ctx->is_quant);
+    }
+#endif
+
+    if (init_dfl_exp_lut(app_ctx) != 0 || init_post_process_workspace(app_ctx) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static void release_replay_context(rknn_app_context_t *app_ctx)
+{
+    release_post_process_workspace(app_ctx);
+    free(app_ctx->output_attrs);
+    app_ctx->output_attrs = NULL;
+#if defined(ZERO_COPY)
+    free(app_ctx->output_native_attrs);
+    app_ctx->output_native_attrs = NULL;
+#endif
+}
+
+static int compare_golden(const output_capture_frame_t *frame, const output_capture_det_t *golden,
+                          const object_detect_result_list *od_results)
+{
+    if ((int)frame->det_count != od_results->count)
+    {
+        printf("frame %u: %d detections, golden %u\n", frame->frame_id, od_results->count, frame->det_count);
+        return -1;
+    }
+    for (int i = 0; i < od_results->count; i++)
+    {
+        const object_detect_result *det = &od_results->results[i];
+        const output_capture_det_t *g = &golden[i];
+        if (det->cls_id != g->cls_id || abs(det->box.left - g->left) > GOLDEN_BOX_TOL ||
+            abs(det->box.top - g->top) > GOLDEN_BOX_TOL || abs(det->box.right - g->right) > GOLDEN_BOX_TOL ||
+            abs(det->box.bottom - g->bottom) > GOLDEN_BOX_TOL || fabsf(det->prop - g->prop) > GOLDEN_PROP_TOL)
+        {
+            printf("frame %u det %d: cls %d (%d,%d,%d,%d) %.5f, golden cls %d (%d,%d,%d,%d) %.5f\n", frame->frame_id,
+                   i, det->cls_id, det->box.left, det->box.top, det->box.right, det->box.bottom, det->prop, g->cls_id,
+                   g->left, g->top, g->right, g->bottom, g->prop);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        printf("Usage: %s <capture_file> [loops]\n", argv[0]);
+        printf("Example: %s yolov8_outputs.cap 100\n", argv[0]);
+        return -1;
+    }
+    const char *capture_path = argv[1];
+    int loops = argc == 3 ? atoi(argv[2]) : 1;
+    if (loops < 1)
+    {
+        loops = 1;
+    }
+
+    FILE *fp = fopen(capture_path, "rb");
+    if (fp == NULL)
+    {
+        printf("open %s fail!\n", capture_path);
+        return -1;
+    }
+    output_capture_header_t hdr;
+    if (output_capture_read_header(fp, &hdr) != 0)
+    {
+        fclose(fp);
+        return -1;
+    }
+    if (hdr.platform != (uint32_t)output_capture_platform())
+    {
+        printf("capture is from platform %u, this replay was built for %d\n", hdr.platform, output_capture_platform());
+        fclose(fp);
+        return -1;
+    }
+#if !defined(ZERO_COPY) && !defined(RV1106_1103) && !defined(RKNPU1)
+    for (uint32_t i = 0; i < hdr.n_output; i++)
+    {
+        if (hdr.bufs[i].fmt != RKNN_TENSOR_NCHW)
+        {
+            printf("output %u is not NCHW, replay zero copy captures with a ZERO_COPY build\n", i);
+            fclose(fp);
+            return -1;
+        }
+    }
+#endif
+
+    int ret = -1;
+    rknn_app_context_t app_ctx;
+    void *bufs[OUTPUT_CAPTURE_MAX_OUTPUTS];
+    memset(bufs, 0, sizeof(bufs));
+    output_capture_det_t golden[OBJ_NUMB_MAX_SIZE];
+    output_capture_frame_t frame;
+    stage_stats_t decode_stats, select_stats, nms_stats, total_stats;
+    memset(&decode_stats, 0, sizeof(stage_stats_t));
+    memset(&select_stats, 0, sizeof(stage_stats_t));
+    memset(&nms_stats, 0, sizeof(stage_stats_t));
+    memset(&total_stats, 0, sizeof(stage_stats_t));
+    int frames = 0;
+    int mismatches = 0;
+    long data_start = ftell(fp);
+
+    if (init_replay_context(&hdr, &app_ctx) != 0)
+    {
+        printf("init replay context fail!\n");
+        goto out;
+    }
+    for (uint32_t i = 0; i < hdr.n_output; i++)
+    {
+        bufs[i] = malloc(hdr.bufs[i].size);
+        if (bufs[i] == NULL)
+        {
+            printf("malloc output %u size %u fail!\n", i, hdr.bufs[i].size);
+            goto out;
+        }
+    }
+
+    for (int loop = 0; loop < loops; loop++)
+    {
+        fseek(fp, data_start, SEEK_SET);
+        int r;
+        while ((r = output_capture_read_frame(fp, &hdr, &frame, golden, bufs)) == 1)
+        {
+#if defined(RV1106_1103)
+            rknn_tensor_mem mems[OUTPUT_CAPTURE_MAX_OUTPUTS];
+            rknn_tensor_mem *outputs[OUTPUT_CAPTURE_MAX_OUTPUTS];
+            memset(mems, 0, sizeof(mems));
+            for (uint32_t i = 0; i < hdr.n_output; i++)
+            {
+                mems[i].virt_addr = bufs[i];
+                mems[i].size = hdr.bufs[i].size;
+                outputs[i] = &mems[i];
+            }
+#else
+            rknn_output outputs[OUTPUT_CAPTURE_MAX_OUTPUTS];
+            memset(outputs, 0, sizeof(outputs));
+            for (uint32_t i = 0; i < hdr.n_output; i++)
+            {
+                outputs[i].index = i;
+                outputs[i].buf = bufs[i];
+                outputs[i].size = hdr.bufs[i].size;
+            }
+#endif
+            letterbox_t letter_box;
+            memset(&letter_box, 0, sizeof(letterbox_t));
+            letter_box.x_pad = frame.x_pad;
+            letter_box.y_pad = frame.y_pad;
+            letter_box.scale = frame.scale;
+
+            object_detect_result_list od_results;
+            int64_t t0 = now_ns();
+            if (post_process(&app_ctx, outputs, &letter_box, frame.conf_threshold, frame.nms_threshold,
+                             &od_results) != 0)
+            {
+                printf("post_process fail on frame %u\n", frame.frame_id);
+                goto out;
+            }
+            stage_add(&total_stats, now_ns() - t0);
+            stage_add(&decode_stats, app_ctx.pp_workspace.timing.decode_ns);
+            stage_add(&select_stats, app_ctx.pp_workspace.timing.select_ns);
+            stage_add(&nms_stats, app_ctx.pp_workspace.timing.nms_ns);
+
+            if (loop == 0)
+            {
+                frames++;
+                if (compare_golden(&frame, golden, &od_results) != 0)
+                {
+                    mismatches++;
+                }
+            }
+        }
+        if (r < 0)
+        {
+            goto out;
+        }
+    }
+
+    printf("%d frames x %d loops, %d differ from golden\n", frames, loops, mismatches);
+    stage_print("decode", &decode_stats);
+    stage_print("sort", &select_stats);
+    stage_print("nms", &nms_stats);
+    stage_print("total", &total_stats);
+    ret = mismatches == 0 && frames > 0 ? 0 : 1;
+
+out:
+    for (uint32_t i = 0; i < hdr.n_output; i++)
+    {
+        free(bufs[i]);
+    }
+    release_replay_context(&app_ctx);
+    fclose(fp);
+    return ret;
+}
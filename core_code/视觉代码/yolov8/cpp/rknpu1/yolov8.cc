@@ -18,6 +18,8 @@
 #include <math.h>
 
 #include "yolov8.h"
+#include "async_log.h"
+#include "capture.h"
 #include "common.h"
 #include "file_utils.h"
 #include "image_utils.h"
@@ -31,6 +33,76 @@ static void dump_tensor_attr(rknn_tensor_attr *attr)
            get_qnt_type_string(attr->qnt_type), attr->zp, attr->scale);
 }
 
+// Letterbox destination, rknn input and prealloc'd outputs are created once
+// with the model, inference_yolov8_model reuses them every frame.
+static int init_io_buffers(rknn_app_context_t *app_ctx)
+{
+    image_buffer_t *dst_img = &app_ctx->input_img;
+    memset(dst_img, 0, sizeof(image_buffer_t));
+    dst_img->width = app_ctx->model_width;
+    dst_img->height = app_ctx->model_height;
+    dst_img->format = IMAGE_FORMAT_RGB888;
+    dst_img->size = get_image_size(dst_img);
+    dst_img->virt_addr = (unsigned char *)malloc(dst_img->size);
+    if (dst_img->virt_addr == NULL)
+    {
+        printf("malloc buffer size:%d fail!\n", dst_img->size);
+        return -1;
+    }
+
+    app_ctx->inputs = (rknn_input *)calloc(app_ctx->io_num.n_input, sizeof(rknn_input));
+    app_ctx->outputs = (rknn_output *)calloc(app_ctx->io_num.n_output, sizeof(rknn_output));
+    if (app_ctx->inputs == NULL || app_ctx->outputs == NULL)
+    {
+        printf("malloc rknn input/output fail!\n");
+        return -1;
+    }
+    app_ctx->inputs[0].index = 0;
+    app_ctx->inputs[0].type = RKNN_TENSOR_UINT8;
+    app_ctx->inputs[0].fmt = RKNN_TENSOR_NHWC;
+    app_ctx->inputs[0].size = app_ctx->model_width * app_ctx->model_height * app_ctx->model_channel;
+    app_ctx->inputs[0].buf = dst_img->virt_addr;
+
+    for (int i = 0; i < app_ctx->io_num.n_output; i++)
+    {
+        rknn_output *output = &app_ctx->outputs[i];
+        output->index = i;
+        output->want_float = (!app_ctx->is_quant);
+        output->is_prealloc = 1;
+        output->size = app_ctx->output_attrs[i].n_elems * (app_ctx->is_quant ? sizeof(uint8_t) : sizeof(float));
+        output->buf = malloc(output->size);
+        if (output->buf == NULL)
+        {
+            printf("malloc output %d size:%d fail!\n", i, output->size);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void release_io_buffers(rknn_app_context_t *app_ctx)
+{
+    if (app_ctx->outputs != NULL)
+    {
+        for (int i = 0; i < app_ctx->io_num.n_output; i++)
+        {
+            free(app_ctx->outputs[i].buf);
+        }
+        free(app_ctx->outputs);
+        app_ctx->outputs = NULL;
+    }
+    if (app_ctx->inputs != NULL)
+    {
+        free(app_ctx->inputs);
+        app_ctx->inputs = NULL;
+    }
+    if (app_ctx->input_img.virt_addr != NULL)
+    {
+        free(app_ctx->input_img.virt_addr);
+        app_ctx->input_img.virt_addr = NULL;
+    }
+}
+
 int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
 {
     int ret;
@@ -115,6 +187,18 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     app_ctx->output_attrs = (rknn_tensor_attr *)malloc(io_num.n_output * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->output_attrs, output_attrs, io_num.n_output * sizeof(rknn_tensor_attr));
 
+    // Build the DFL exp tables once, post_process only does lookups
+    if (app_ctx->is_quant)
+    {
+        init_dfl_exp_lut(app_ctx);
+    }
+
+    ret = init_post_process_workspace(app_ctx);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
     if (input_attrs[0].fmt == RKNN_TENSOR_NCHW)
     {
         printf("model is NCHW input fmt\n");
@@ -132,11 +216,41 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     printf("model input height=%d, width=%d, channel=%d\n",
            app_ctx->model_height, app_ctx->model_width, app_ctx->model_channel);
 
+    // batch-N models need the rknpu2 copy backend
+    if (input_attrs[0].dims[3] > 1)
+    {
+        printf("model batch %d not supported by this backend\n", input_attrs[0].dims[3]);
+        return -1;
+    }
+    app_ctx->batch = 1;
+
+    ret = init_io_buffers(app_ctx);
+    if (ret != 0)
+    {
+        release_io_buffers(app_ctx);
+        return -1;
+    }
+
     return 0;
 }
 
+// RKNPU1 has a single NPU core and no rknn_dup_context, the pool runs one context
+int dup_yolov8_model(rknn_app_context_t *src_ctx, rknn_app_context_t *app_ctx)
+{
+    printf("dup_yolov8_model is not supported on RKNPU1\n");
+    return -1;
+}
+
+int set_yolov8_npu_core(rknn_app_context_t *app_ctx, int core)
+{
+    return core > 0 ? -1 : 0;
+}
+
 int release_yolov8_model(rknn_app_context_t *app_ctx)
 {
+    release_post_process_workspace(app_ctx);
+    release_letterbox_cache(&app_ctx->letterbox_cache);
+    release_io_buffers(app_ctx);
     if (app_ctx->input_attrs != NULL)
     {
         free(app_ctx->input_attrs);
@@ -158,10 +272,7 @@ int release_yolov8_model(rknn_app_context_t *app_ctx)
 int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, object_detect_result_list *od_results)
 {
     int ret;
-    image_buffer_t dst_img;
     letterbox_t letter_box;
-    rknn_input inputs[app_ctx->io_num.n_input];
-    rknn_output outputs[app_ctx->io_num.n_output];
     const float nms_threshold = NMS_THRESH;      // Default NMS threshold
     const float box_conf_threshold = BOX_THRESH; // Default box threshold
     int bg_color = 114;
@@ -173,24 +284,14 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
 
     memset(od_results, 0x00, sizeof(*od_results));
     memset(&letter_box, 0, sizeof(letterbox_t));
-    memset(&dst_img, 0, sizeof(image_buffer_t));
-    memset(inputs, 0, sizeof(inputs));
-    memset(outputs, 0, sizeof(outputs));
-
-    // Pre Process
-    dst_img.width = app_ctx->model_width;
-    dst_img.height = app_ctx->model_height;
-    dst_img.format = IMAGE_FORMAT_RGB888;
-    dst_img.size = get_image_size(&dst_img);
-    dst_img.virt_addr = (unsigned char *)malloc(dst_img.size);
-    if (dst_img.virt_addr == NULL)
-    {
-        printf("malloc buffer size:%d fail!\n", dst_img.size);
-        return -1;
-    }
 
-    // letterbox
-    ret = convert_image_with_letterbox(img, &dst_img, &letter_box, bg_color);
+    // Pre Process, letterbox straight into the input buffer bound to inputs[0]
+    ret = convert_image_with_letterbox_fused(&app_ctx->letterbox_cache, img, &app_ctx->input_img, &letter_box,
+                                             bg_color);
+    if (ret > 0)
+    {
+        ret = convert_image_with_letterbox(img, &app_ctx->input_img, &letter_box, bg_color);
+    }
     if (ret < 0)
     {
         printf("convert_image_with_letterbox fail! ret=%d\n", ret);
@@ -198,13 +299,7 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
     }
 
     // Set Input Data
-    inputs[0].index = 0;
-    inputs[0].type = RKNN_TENSOR_UINT8;
-    inputs[0].fmt = RKNN_TENSOR_NHWC;
-    inputs[0].size = app_ctx->model_width * app_ctx->model_height * app_ctx->model_channel;
-    inputs[0].buf = dst_img.virt_addr;
-
-    ret = rknn_inputs_set(app_ctx->rknn_ctx, app_ctx->io_num.n_input, inputs);
+    ret = rknn_inputs_set(app_ctx->rknn_ctx, app_ctx->io_num.n_input, app_ctx->inputs);
     if (ret < 0)
     {
         printf("rknn_input_set fail! ret=%d\n", ret);
@@ -212,7 +307,7 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
     }
 
     // Run
-    printf("rknn_run\n");
+    LOGD("rknn_run");
     ret = rknn_run(app_ctx->rknn_ctx, nullptr);
     if (ret < 0)
     {
@@ -220,31 +315,35 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
         return -1;
     }
 
-    // Get Output
-    memset(outputs, 0, sizeof(outputs));
-    for (int i = 0; i < app_ctx->io_num.n_output; i++)
-    {
-        outputs[i].index = i;
-        outputs[i].want_float = (!app_ctx->is_quant);
-    }
-    ret = rknn_outputs_get(app_ctx->rknn_ctx, app_ctx->io_num.n_output, outputs, NULL);
+    // Get Output, written into the prealloc'd buffers
+    ret = rknn_outputs_get(app_ctx->rknn_ctx, app_ctx->io_num.n_output, app_ctx->outputs, NULL);
     if (ret < 0)
     {
         printf("rknn_outputs_get fail! ret=%d\n", ret);
-        goto out;
+        return -1;
     }
 
     // Post Process
-    post_process(app_ctx, outputs, &letter_box, box_conf_threshold, nms_threshold, od_results);
+    post_process(app_ctx, app_ctx->outputs, &letter_box, box_conf_threshold, nms_threshold, od_results);
+    if (app_ctx->capture != NULL)
+    {
+        output_capture_write(app_ctx->capture, app_ctx, app_ctx->outputs, &letter_box, box_conf_threshold,
+                             nms_threshold, od_results);
+    }
 
     // Remeber to release rknn output
-    rknn_outputs_release(app_ctx->rknn_ctx, app_ctx->io_num.n_output, outputs);
+    rknn_outputs_release(app_ctx->rknn_ctx, app_ctx->io_num.n_output, app_ctx->outputs);
+
+    return ret;
+}
 
-out:
-    if (dst_img.virt_addr != NULL)
+int inference_yolov8_batch(rknn_app_context_t *app_ctx, image_buffer_t **imgs, int n,
+                           object_detect_result_list **od_results)
+{
+    if (n != 1)
     {
-        free(dst_img.virt_addr);
+        printf("inference_yolov8_batch: batch-1 model\n");
+        return -1;
     }
-
-    return ret;
+    return inference_yolov8_model(app_ctx, imgs[0], od_results[0]);
 }
\ No newline at end of file
@@ -18,6 +18,8 @@
 #include <math.h>
 
 #include "yolov8.h"
+#include "async_log.h"
+#include "capture.h"
 #include "common.h"
 #include "file_utils.h"
 #include "image_utils.h"
@@ -31,28 +33,98 @@ static void dump_tensor_attr(rknn_tensor_attr *attr)
            get_qnt_type_string(attr->qnt_type), attr->zp, attr->scale);
 }
 
-int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
+// Letterbox destination, rknn input and prealloc'd outputs are created once
+// with the model, inference_yolov8_model reuses them every frame. A batch
+// model's input holds its images one after the other.
+static int init_io_buffers(rknn_app_context_t *app_ctx)
 {
-    int ret;
-    int model_len = 0;
-    char *model;
-    rknn_context ctx = 0;
-
-    // Load RKNN Model
-    model_len = read_data_from_file(model_path, &model);
-    if (model == NULL)
+    image_buffer_t *dst_img = &app_ctx->input_img;
+    memset(dst_img, 0, sizeof(image_buffer_t));
+    dst_img->width = app_ctx->model_width;
+    dst_img->height = app_ctx->model_height;
+    dst_img->format = IMAGE_FORMAT_RGB888;
+    dst_img->size = get_image_size(dst_img);
+    dst_img->virt_addr = (unsigned char *)malloc((size_t)dst_img->size * app_ctx->batch);
+    if (dst_img->virt_addr == NULL)
     {
-        printf("load_model fail!\n");
+        printf("malloc buffer size:%d fail!\n", dst_img->size * app_ctx->batch);
         return -1;
     }
+    if (app_ctx->batch > 1)
+    {
+        app_ctx->slot_caches = (letterbox_cache_t *)calloc(app_ctx->batch - 1, sizeof(letterbox_cache_t));
+        if (app_ctx->slot_caches == NULL)
+        {
+            printf("malloc letterbox caches fail!\n");
+            return -1;
+        }
+    }
 
-    ret = rknn_init(&ctx, model, model_len, 0, NULL);
-    free(model);
-    if (ret < 0)
+    app_ctx->inputs = (rknn_input *)calloc(app_ctx->io_num.n_input, sizeof(rknn_input));
+    app_ctx->outputs = (rknn_output *)calloc(app_ctx->io_num.n_output, sizeof(rknn_output));
+    if (app_ctx->inputs == NULL || app_ctx->outputs == NULL)
     {
-        printf("rknn_init fail! ret=%d\n", ret);
+        printf("malloc rknn input/output fail!\n");
         return -1;
     }
+    app_ctx->inputs[0].index = 0;
+    app_ctx->inputs[0].type = RKNN_TENSOR_UINT8;
+    app_ctx->inputs[0].fmt = RKNN_TENSOR_NHWC;
+    app_ctx->inputs[0].size = app_ctx->model_width * app_ctx->model_height * app_ctx->model_channel * app_ctx->batch;
+    app_ctx->inputs[0].buf = dst_img->virt_addr;
+
+    for (int i = 0; i < app_ctx->io_num.n_output; i++)
+    {
+        rknn_output *output = &app_ctx->outputs[i];
+        output->index = i;
+        output->want_float = (!app_ctx->is_quant);
+        output->is_prealloc = 1;
+        output->size = app_ctx->output_attrs[i].n_elems * (app_ctx->is_quant ? sizeof(uint8_t) : sizeof(float));
+        output->buf = malloc(output->size);
+        if (output->buf == NULL)
+        {
+            printf("malloc output %d size:%d fail!\n", i, output->size);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void release_io_buffers(rknn_app_context_t *app_ctx)
+{
+    if (app_ctx->outputs != NULL)
+    {
+        for (int i = 0; i < app_ctx->io_num.n_output; i++)
+        {
+            free(app_ctx->outputs[i].buf);
+        }
+        free(app_ctx->outputs);
+        app_ctx->outputs = NULL;
+    }
+    if (app_ctx->inputs != NULL)
+    {
+        free(app_ctx->inputs);
+        app_ctx->inputs = NULL;
+    }
+    if (app_ctx->slot_caches != NULL)
+    {
+        for (int i = 0; i < app_ctx->batch - 1; i++)
+        {
+            release_letterbox_cache(&app_ctx->slot_caches[i]);
+        }
+        free(app_ctx->slot_caches);
+        app_ctx->slot_caches = NULL;
+    }
+    if (app_ctx->input_img.virt_addr != NULL)
+    {
+        free(app_ctx->input_img.virt_addr);
+        app_ctx->input_img.virt_addr = NULL;
+    }
+}
+
+static int setup_yolov8_model(rknn_context ctx, rknn_app_context_t *app_ctx)
+{
+    int ret;
 
     // Get Model Input Output Number
     rknn_input_output_num io_num;
@@ -115,6 +187,18 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     app_ctx->output_attrs = (rknn_tensor_attr *)malloc(io_num.n_output * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->output_attrs, output_attrs, io_num.n_output * sizeof(rknn_tensor_attr));
 
+    // Build the DFL exp tables once, post_process only does lookups
+    if (app_ctx->is_quant)
+    {
+        init_dfl_exp_lut(app_ctx);
+    }
+
+    ret = init_post_process_workspace(app_ctx);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
     if (input_attrs[0].fmt == RKNN_TENSOR_NCHW)
     {
         printf("model is NCHW input fmt\n");
@@ -132,11 +216,85 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     printf("model input height=%d, width=%d, channel=%d\n",
            app_ctx->model_height, app_ctx->model_width, app_ctx->model_channel);
 
+    // batch-N models run N letterboxed images at once, [N, H, W, C] or [N, C, H, W]
+    app_ctx->batch = input_attrs[0].dims[0] > 1 ? input_attrs[0].dims[0] : 1;
+    if (app_ctx->batch > YOLOV8_MAX_BATCH)
+    {
+        printf("model batch %d, at most %d supported\n", app_ctx->batch, YOLOV8_MAX_BATCH);
+        return -1;
+    }
+    if (app_ctx->batch > 1)
+    {
+        printf("model batch=%d\n", app_ctx->batch);
+    }
+
+    ret = init_io_buffers(app_ctx);
+    if (ret != 0)
+    {
+        release_io_buffers(app_ctx);
+        return -1;
+    }
+
+    return 0;
+}
+
+int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
+{
+    int ret;
+    int model_len = 0;
+    char *model;
+    rknn_context ctx = 0;
+
+    // Load RKNN Model
+    model_len = read_data_from_file(model_path, &model);
+    if (model == NULL)
+    {
+        printf("load_model fail!\n");
+        return -1;
+    }
+
+    ret = rknn_init(&ctx, model, model_len, 0, NULL);
+    free(model);
+    if (ret < 0)
+    {
+        printf("rknn_init fail! ret=%d\n", ret);
+        return -1;
+    }
+
+    return setup_yolov8_model(ctx, app_ctx);
+}
+
+// Second context sharing the weights of src_ctx, for running on another NPU core
+int dup_yolov8_model(rknn_app_context_t *src_ctx, rknn_app_context_t *app_ctx)
+{
+    rknn_context ctx = 0;
+    int ret = rknn_dup_context(&src_ctx->rknn_ctx, &ctx);
+    if (ret < 0)
+    {
+        printf("rknn_dup_context fail! ret=%d\n", ret);
+        return -1;
+    }
+    return setup_yolov8_model(ctx, app_ctx);
+}
+
+// Pin the context to NPU core `core`, -1 lets the driver pick
+int set_yolov8_npu_core(rknn_app_context_t *app_ctx, int core)
+{
+    rknn_core_mask core_mask = core < 0 ? RKNN_NPU_CORE_AUTO : (rknn_core_mask)(RKNN_NPU_CORE_0 << core);
+    int ret = rknn_set_core_mask(app_ctx->rknn_ctx, core_mask);
+    if (ret < 0)
+    {
+        printf("rknn_set_core_mask %d fail! ret=%d\n", core, ret);
+        return -1;
+    }
     return 0;
 }
 
 int release_yolov8_model(rknn_app_context_t *app_ctx)
 {
+    release_post_process_workspace(app_ctx);
+    release_letterbox_cache(&app_ctx->letterbox_cache);
+    release_io_buffers(app_ctx);
     if (app_ctx->input_attrs != NULL)
     {
         free(app_ctx->input_attrs);
@@ -156,55 +314,48 @@ int release_yolov8_model(rknn_app_context_t *app_ctx)
 }
 
 int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, object_detect_result_list *od_results)
+{
+    return inference_yolov8_batch(app_ctx, &img, 1, &od_results);
+}
+
+int inference_yolov8_batch(rknn_app_context_t *app_ctx, image_buffer_t **imgs, int n,
+                           object_detect_result_list **od_results)
 {
     int ret;
-    image_buffer_t dst_img;
-    letterbox_t letter_box;
-    rknn_input inputs[app_ctx->io_num.n_input];
-    rknn_output outputs[app_ctx->io_num.n_output];
+    letterbox_t letter_boxes[YOLOV8_MAX_BATCH];
     const float nms_threshold = NMS_THRESH;      // 默认的NMS阈值
     const float box_conf_threshold = BOX_THRESH; // 默认的置信度阈值
     int bg_color = 114;
 
-    if ((!app_ctx) || !(img) || (!od_results))
+    if ((!app_ctx) || !(imgs) || (!od_results) || n < 1 || n > app_ctx->batch)
     {
         return -1;
     }
 
-    memset(od_results, 0x00, sizeof(*od_results));
-    memset(&letter_box, 0, sizeof(letterbox_t));
-    memset(&dst_img, 0, sizeof(image_buffer_t));
-    memset(inputs, 0, sizeof(inputs));
-    memset(outputs, 0, sizeof(outputs));
-
-    // Pre Process
-    dst_img.width = app_ctx->model_width;
-    dst_img.height = app_ctx->model_height;
-    dst_img.format = IMAGE_FORMAT_RGB888;
-    dst_img.size = get_image_size(&dst_img);
-    dst_img.virt_addr = (unsigned char *)malloc(dst_img.size);
-    if (dst_img.virt_addr == NULL)
-    {
-        printf("malloc buffer size:%d fail!\n", dst_img.size);
-        return -1;
-    }
+    memset(letter_boxes, 0, sizeof(letter_boxes));
 
-    // letterbox
-    ret = convert_image_with_letterbox(img, &dst_img, &letter_box, bg_color);
-    if (ret < 0)
+    // Pre Process, letterbox straight into the input buffer bound to inputs[0],
+    // image i into slot i, each slot keeps its own geometry
+    for (int i = 0; i < n; i++)
     {
-        printf("convert_image_with_letterbox fail! ret=%d\n", ret);
-        return -1;
+        memset(od_results[i], 0x00, sizeof(object_detect_result_list));
+        image_buffer_t dst_img = app_ctx->input_img;
+        dst_img.virt_addr += (size_t)i * dst_img.size;
+        letterbox_cache_t *cache = i == 0 ? &app_ctx->letterbox_cache : &app_ctx->slot_caches[i - 1];
+        ret = convert_image_with_letterbox_fused(cache, imgs[i], &dst_img, &letter_boxes[i], bg_color);
+        if (ret > 0)
+        {
+            ret = convert_image_with_letterbox(imgs[i], &dst_img, &letter_boxes[i], bg_color);
+        }
+        if (ret < 0)
+        {
+            printf("convert_image_with_letterbox fail! ret=%d\n", ret);
+            return -1;
+        }
     }
 
     // Set Input Data
-    inputs[0].index = 0;
-    inputs[0].type = RKNN_TENSOR_UINT8;
-    inputs[0].fmt = RKNN_TENSOR_NHWC;
-    inputs[0].size = app_ctx->model_width * app_ctx->model_height * app_ctx->model_channel;
-    inputs[0].buf = dst_img.virt_addr;
-
-    ret = rknn_inputs_set(app_ctx->rknn_ctx, app_ctx->io_num.n_input, inputs);
+    ret = rknn_inputs_set(app_ctx->rknn_ctx, app_ctx->io_num.n_input, app_ctx->inputs);
     if (ret < 0)
     {
         printf("rknn_input_set fail! ret=%d\n", ret);
@@ -212,7 +363,7 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
     }
 
     // Run
-    printf("rknn_run\n");
+    LOGD("rknn_run");
     ret = rknn_run(app_ctx->rknn_ctx, nullptr);
     if (ret < 0)
     {
@@ -220,31 +371,24 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
         return -1;
     }
 
-    // Get Output
-    memset(outputs, 0, sizeof(outputs));
-    for (int i = 0; i < app_ctx->io_num.n_output; i++)
-    {
-        outputs[i].index = i;
-        outputs[i].want_float = (!app_ctx->is_quant);
-    }
-    ret = rknn_outputs_get(app_ctx->rknn_ctx, app_ctx->io_num.n_output, outputs, NULL);
+    // Get Output, written into the prealloc'd buffers
+    ret = rknn_outputs_get(app_ctx->rknn_ctx, app_ctx->io_num.n_output, app_ctx->outputs, NULL);
     if (ret < 0)
     {
         printf("rknn_outputs_get fail! ret=%d\n", ret);
-        goto out;
+        return -1;
     }
 
     // Post Process
-    post_process(app_ctx, outputs, &letter_box, box_conf_threshold, nms_threshold, od_results);
-
-    // Remeber to release rknn output
-    rknn_outputs_release(app_ctx->rknn_ctx, app_ctx->io_num.n_output, outputs);
-
-out:
-    if (dst_img.virt_addr != NULL)
+    post_process_batch(app_ctx, app_ctx->outputs, letter_boxes, n, box_conf_threshold, nms_threshold, od_results);
+    if (app_ctx->capture != NULL && app_ctx->batch == 1)
     {
-        free(dst_img.virt_addr);
+        output_capture_write(app_ctx->capture, app_ctx, app_ctx->outputs, &letter_boxes[0], box_conf_threshold,
+                             nms_threshold, od_results[0]);
     }
 
+    // Remeber to release rknn output
+    rknn_outputs_release(app_ctx->rknn_ctx, app_ctx->io_num.n_output, app_ctx->outputs);
+
     return ret;
-}
\ No newline at end of file
+}
@@ -18,6 +18,8 @@
 #include <math.h>
 
 #include "yolov8.h"
+#include "async_log.h"
+#include "capture.h"
 #include "common.h"
 #include "file_utils.h"
 #include "image_utils.h"
@@ -132,6 +134,18 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     app_ctx->output_attrs = (rknn_tensor_attr *)malloc(io_num.n_output * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->output_attrs, output_attrs, io_num.n_output * sizeof(rknn_tensor_attr));
 
+    // Build the DFL exp tables once, post_process only does lookups
+    if (app_ctx->is_quant)
+    {
+        init_dfl_exp_lut(app_ctx);
+    }
+
+    ret = init_post_process_workspace(app_ctx);
+    if (ret != 0)
+    {
+        return -1;
+    }
+
     if (input_attrs[0].fmt == RKNN_TENSOR_NCHW) 
     {
         printf("model is NCHW input fmt\n");
@@ -149,11 +163,33 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
     printf("model input height=%d, width=%d, channel=%d\n",
            app_ctx->model_height, app_ctx->model_width, app_ctx->model_channel);
 
+    // batch-N models need the rknpu2 copy backend
+    if (input_attrs[0].dims[0] > 1)
+    {
+        printf("model batch %d not supported by this backend\n", input_attrs[0].dims[0]);
+        return -1;
+    }
+    app_ctx->batch = 1;
+
     return 0;
 }
 
+// RV1106/1103 has a single NPU core and no rknn_dup_context, the pool runs one context
+int dup_yolov8_model(rknn_app_context_t *src_ctx, rknn_app_context_t *app_ctx)
+{
+    printf("dup_yolov8_model is not supported on RV1106/1103\n");
+    return -1;
+}
+
+int set_yolov8_npu_core(rknn_app_context_t *app_ctx, int core)
+{
+    return core > 0 ? -1 : 0;
+}
+
 int release_yolov8_model(rknn_app_context_t *app_ctx)
 {    
+    release_post_process_workspace(app_ctx);
+    release_letterbox_cache(&app_ctx->letterbox_cache);
     if (app_ctx->input_attrs != NULL)
     {
         free(app_ctx->input_attrs);
@@ -205,14 +241,21 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
     dst_img.format = IMAGE_FORMAT_RGB888;
     dst_img.size = get_image_size(&dst_img);
     dst_img.fd = app_ctx->input_mems[0]->fd;
+    dst_img.virt_addr = (unsigned char *)app_ctx->input_mems[0]->virt_addr;
+    dst_img.width_stride = app_ctx->input_attrs[0].w_stride;
     if (dst_img.virt_addr == NULL && dst_img.fd == 0)
     {
         printf("malloc buffer size:%d fail!\n", dst_img.size);
         return -1;
     }
 
-    // letterbox
-    ret = convert_image_with_letterbox(img, &dst_img, &letter_box, bg_color);
+    // letterbox, camera frame to the NPU input in one pass; other formats
+    // still go through convert_image_with_letterbox (RGA on the dma fd)
+    ret = convert_image_with_letterbox_fused(&app_ctx->letterbox_cache, img, &dst_img, &letter_box, bg_color);
+    if (ret > 0)
+    {
+        ret = convert_image_with_letterbox(img, &dst_img, &letter_box, bg_color);
+    }
     if (ret < 0)
     {
         printf("convert_image_with_letterbox fail! ret=%d\n", ret);
@@ -220,7 +263,7 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
     }
 
     // Run
-    printf("rknn_run\n");
+    LOGD("rknn_run");
     ret = rknn_run(app_ctx->rknn_ctx, nullptr);
     if (ret < 0) {
         printf("rknn_run fail! ret=%d\n", ret);
@@ -229,6 +272,22 @@ int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, obj
 
     // Post Process
     post_process(app_ctx, app_ctx->output_mems, &letter_box, box_conf_threshold, nms_threshold, od_results);
+    if (app_ctx->capture != NULL)
+    {
+        output_capture_write(app_ctx->capture, app_ctx, app_ctx->output_mems, &letter_box, box_conf_threshold, nms_threshold,
+                             od_results);
+    }
 out:
     return ret;
+}
+
+int inference_yolov8_batch(rknn_app_context_t *app_ctx, image_buffer_t **imgs, int n,
+                           object_detect_result_list **od_results)
+{
+    if (n != 1)
+    {
+        printf("inference_yolov8_batch: batch-1 model\n");
+        return -1;
+    }
+    return inference_yolov8_model(app_ctx, imgs[0], od_results[0]);
 }
\ No newline at end of file
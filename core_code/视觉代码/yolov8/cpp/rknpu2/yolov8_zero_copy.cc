@@ -18,10 +18,41 @@
 #include <math.h>
 
 #include "yolov8.h"
+#include "async_log.h"
+#include "capture.h"
 #include "common.h"
 #include "file_utils.h"
 #include "image_utils.h"
 
+#define YOLOV8_IO_SETS 2
+#define YOLOV8_ASYNC_TIMEOUT_MS 1000
+
+typedef enum {
+    YOLOV8_IO_SET_FREE = 0,
+    YOLOV8_IO_SET_RUNNING,
+    YOLOV8_IO_SET_DONE,     // outputs ready (or ret < 0), waiting for poll_yolov8_result
+} yolov8_io_set_state_t;
+
+// State of submit_yolov8_frame / poll_yolov8_result, created on the first
+// submit. Frames alternate between set 0 (the context's input_mems and
+// output_mems) and set 1 below.
+struct yolov8_async {
+    rknn_tensor_mem *input_mem;
+    rknn_tensor_mem *output_mems[9];
+    letterbox_cache_t letterbox_cache;
+    yolov8_io_set_state_t state[YOLOV8_IO_SETS];
+    letterbox_t letter_box[YOLOV8_IO_SETS];
+    void *user[YOLOV8_IO_SETS];
+    uint64_t frame_id[YOLOV8_IO_SETS];  // returned by rknn_run, for rknn_wait
+    int ret[YOLOV8_IO_SETS];
+    uint64_t next_submit;
+    uint64_t next_poll;
+    int running;            // set started with non_block, -1 none
+    int bound;              // set bound with rknn_set_io_mem
+};
+
+static void release_async(rknn_app_context_t *app_ctx);
+
 static void dump_tensor_attr(rknn_tensor_attr *attr) {
     char dims[128] = {0};
     for (int i = 0; i < attr->n_dims; ++i) {
@@ -36,25 +67,8 @@ static void dump_tensor_attr(rknn_tensor_attr *attr) {
            attr->scale);
 }
 
-int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx) {
+static int setup_yolov8_model(rknn_context ctx, rknn_app_context_t *app_ctx) {
     int ret;
-    int model_len = 0;
-    char *model;
-    rknn_context ctx = 0;
-
-    // Load RKNN Model
-    model_len = read_data_from_file(model_path, &model);
-    if (model == NULL) {
-        printf("load_model fail!\n");
-        return -1;
-    }
-
-    ret = rknn_init(&ctx, model, model_len, 0, NULL);
-    free(model);
-    if (ret < 0) {
-        printf("rknn_init fail! ret=%d\n", ret);
-        return -1;
-    }
 
     // Get Model Input Output Number
     rknn_input_output_num io_num;
@@ -153,12 +167,21 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx) {
     app_ctx->output_attrs = (rknn_tensor_attr *)malloc(io_num.n_output * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->output_attrs, output_attrs, io_num.n_output * sizeof(rknn_tensor_attr));
 
+    // Build the DFL exp tables once, post_process only does lookups
+    if (app_ctx->is_quant) {
+        init_dfl_exp_lut(app_ctx);
+    }
+
+    ret = init_post_process_workspace(app_ctx);
+    if (ret != 0) {
+        return -1;
+    }
+
     app_ctx->input_native_attrs = (rknn_tensor_attr *)malloc(io_num.n_input * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->input_native_attrs, input_native_attrs, io_num.n_input * sizeof(rknn_tensor_attr));
     app_ctx->output_native_attrs = (rknn_tensor_attr *)malloc(io_num.n_output * sizeof(rknn_tensor_attr));
     memcpy(app_ctx->output_native_attrs, output_native_attrs, io_num.n_output * sizeof(rknn_tensor_attr));
 
-
     if (input_attrs[0].fmt == RKNN_TENSOR_NCHW) {
         printf("model is NCHW input fmt\n");
         app_ctx->model_channel = input_attrs[0].dims[1];
@@ -173,35 +196,66 @@ int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx) {
     printf("model input height=%d, width=%d, channel=%d\n",
            app_ctx->model_height, app_ctx->model_width, app_ctx->model_channel);
 
+    // batch-N models need the rknpu2 copy backend
+    if (input_attrs[0].dims[0] > 1) {
+        printf("model batch %d not supported by this backend\n", input_attrs[0].dims[0]);
+        return -1;
+    }
+    app_ctx->batch = 1;
+
     return 0;
 }
 
-int NC1HWC2_i8_to_NCHW_i8(const int8_t *src, int8_t *dst, int *dims, int channel, int h, int w, int zp, float scale) {
-    int batch  = dims[0];
-    int C1     = dims[1];
-    int C2     = dims[4];
-    int hw_src = dims[2] * dims[3];
-    int hw_dst = h * w;
-    for (int i = 0; i < batch; i++) {
-        const int8_t *src_b = src + i * C1 * hw_src * C2;
-        int8_t        *dst_b = dst + i * channel * hw_dst;
-        for (int c = 0; c < channel; ++c) {
-            int           plane  = c / C2;
-            const int8_t *src_bc = plane * hw_src * C2 + src_b;
-            int           offset = c % C2;
-            for (int cur_h = 0; cur_h < h; ++cur_h)
-                for (int cur_w = 0; cur_w < w; ++cur_w) {
-                    int cur_hw                 = cur_h * w + cur_w;
-                    dst_b[c * hw_dst + cur_hw] = src_bc[C2 * cur_hw + offset] ; // int8-->int8
-                }
-        }
+int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx) {
+    int ret;
+    int model_len = 0;
+    char *model;
+    rknn_context ctx = 0;
+
+    // Load RKNN Model
+    model_len = read_data_from_file(model_path, &model);
+    if (model == NULL) {
+        printf("load_model fail!\n");
+        return -1;
     }
 
+    ret = rknn_init(&ctx, model, model_len, 0, NULL);
+    free(model);
+    if (ret < 0) {
+        printf("rknn_init fail! ret=%d\n", ret);
+        return -1;
+    }
+
+    return setup_yolov8_model(ctx, app_ctx);
+}
+
+// Second context sharing the weights of src_ctx, for running on another NPU core
+int dup_yolov8_model(rknn_app_context_t *src_ctx, rknn_app_context_t *app_ctx) {
+    rknn_context ctx = 0;
+    int ret = rknn_dup_context(&src_ctx->rknn_ctx, &ctx);
+    if (ret < 0) {
+        printf("rknn_dup_context fail! ret=%d\n", ret);
+        return -1;
+    }
+    return setup_yolov8_model(ctx, app_ctx);
+}
+
+// Pin the context to NPU core `core`, -1 lets the driver pick
+int set_yolov8_npu_core(rknn_app_context_t *app_ctx, int core) {
+    rknn_core_mask core_mask = core < 0 ? RKNN_NPU_CORE_AUTO : (rknn_core_mask)(RKNN_NPU_CORE_0 << core);
+    int ret = rknn_set_core_mask(app_ctx->rknn_ctx, core_mask);
+    if (ret < 0) {
+        printf("rknn_set_core_mask %d fail! ret=%d\n", core, ret);
+        return -1;
+    }
     return 0;
 }
 
 int release_yolov8_model(rknn_app_context_t *app_ctx) {
     int ret;
+    release_async(app_ctx);
+    release_post_process_workspace(app_ctx);
+    release_letterbox_cache(&app_ctx->letterbox_cache);
     if (app_ctx->input_attrs != NULL) {
         free(app_ctx->input_attrs);
         app_ctx->input_attrs = NULL;
@@ -249,82 +303,291 @@ int release_yolov8_model(rknn_app_context_t *app_ctx) {
     return 0;
 }
 
-int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, object_detect_result_list *od_results) {
+// One input/output memory set of a context. Set 0 is the one bound by
+// setup_yolov8_model, set 1 belongs to the async state.
+typedef struct {
+    rknn_tensor_mem *input_mem;
+    rknn_tensor_mem **output_mems;
+    letterbox_cache_t *letterbox_cache; // per set, the destination differs
+} io_set_t;
+
+static io_set_t get_io_set(rknn_app_context_t *app_ctx, int set) {
+    io_set_t io;
+    if (set == 0) {
+        io.input_mem = app_ctx->input_mems[0];
+        io.output_mems = app_ctx->output_mems;
+        io.letterbox_cache = &app_ctx->letterbox_cache;
+    } else {
+        io.input_mem = app_ctx->async->input_mem;
+        io.output_mems = app_ctx->async->output_mems;
+        io.letterbox_cache = &app_ctx->async->letterbox_cache;
+    }
+    return io;
+}
+
+// Pre Process: letterbox img into the input of set
+static int fill_input(rknn_app_context_t *app_ctx, int set, image_buffer_t *img, letterbox_t *letter_box) {
     int ret;
     image_buffer_t dst_img;
-    letterbox_t letter_box;
-    const float nms_threshold = NMS_THRESH;      // 默认的NMS阈值
-    const float box_conf_threshold = BOX_THRESH; // 默认的置信度阈值
     int bg_color = 114;
+    io_set_t io = get_io_set(app_ctx, set);
 
-    if ((!app_ctx) || !(img) || (!od_results)) {
-        return -1;
-    }
-
-    memset(od_results, 0x00, sizeof(*od_results));
-    memset(&letter_box, 0, sizeof(letterbox_t));
+    memset(letter_box, 0, sizeof(letterbox_t));
     memset(&dst_img, 0, sizeof(image_buffer_t));
-
-    // Pre Process
     dst_img.width = app_ctx->model_width;
     dst_img.height = app_ctx->model_height;
     dst_img.format = IMAGE_FORMAT_RGB888;
     dst_img.size = get_image_size(&dst_img);
-    dst_img.fd = app_ctx->input_mems[0]->fd;
-    dst_img.virt_addr = (unsigned char*)app_ctx->input_mems[0]->virt_addr;
+    dst_img.fd = io.input_mem->fd;
+    dst_img.virt_addr = (unsigned char*)io.input_mem->virt_addr;
+    dst_img.width_stride = app_ctx->input_native_attrs[0].w_stride;
 
     if (dst_img.virt_addr == NULL && dst_img.fd == 0) {
         printf("malloc buffer size:%d fail!\n", dst_img.size);
         return -1;
     }
 
-    // letterbox
-    ret = convert_image_with_letterbox(img, &dst_img, &letter_box, bg_color);
+    // letterbox, camera frame to the NPU input in one pass
+    ret = convert_image_with_letterbox_fused(io.letterbox_cache, img, &dst_img, letter_box, bg_color);
+    if (ret > 0) {
+        ret = convert_image_with_letterbox(img, &dst_img, letter_box, bg_color);
+    }
     if (ret < 0) {
         printf("convert_image_with_letterbox fail! ret=%d\n", ret);
         return -1;
     }
+    return 0;
+}
+
+// Post Process on the outputs of set
+static int process_outputs(rknn_app_context_t *app_ctx, int set, letterbox_t *letter_box,
+                           object_detect_result_list *od_results) {
+    const float nms_threshold = NMS_THRESH;      // 默认的NMS阈值
+    const float box_conf_threshold = BOX_THRESH; // 默认的置信度阈值
+    io_set_t io = get_io_set(app_ctx, set);
+
+    // post_process reads the native layout (NC1HWC2 etc.) and type (int8 or
+    // fp16) in place through output_native_attrs, no conversion or copy
+    rknn_output outputs[app_ctx->io_num.n_output];
+    memset(outputs, 0, sizeof(outputs));
+    if (!app_ctx->is_quant && app_ctx->output_native_attrs[0].type != RKNN_TENSOR_FLOAT16) {
+        printf("zero copy only supports int8 and fp16 outputs, got %s\n",
+               get_type_string(app_ctx->output_native_attrs[0].type));
+        return -1;
+    }
+    for (uint32_t i = 0; i < app_ctx->io_num.n_output; i++) {
+        outputs[i].index = i;
+        outputs[i].buf = io.output_mems[i]->virt_addr;
+        outputs[i].size = app_ctx->output_native_attrs[i].size_with_stride;
+    }
+
+    int ret = post_process(app_ctx, outputs, letter_box, box_conf_threshold, nms_threshold, od_results);
+    if (ret != 0) {
+        return ret;
+    }
+    if (app_ctx->capture != NULL) {
+        output_capture_write(app_ctx->capture, app_ctx, outputs, letter_box, box_conf_threshold, nms_threshold,
+                             od_results);
+    }
+    return 0;
+}
+
+// Point the context at set, rknn_run reads and writes whatever is bound
+static int bind_io_set(rknn_app_context_t *app_ctx, int set) {
+    io_set_t io = get_io_set(app_ctx, set);
+    int ret = rknn_set_io_mem(app_ctx->rknn_ctx, io.input_mem, &app_ctx->input_native_attrs[0]);
+    if (ret < 0) {
+        printf("input_mems rknn_set_io_mem fail! ret=%d\n", ret);
+        return -1;
+    }
+    for (uint32_t i = 0; i < app_ctx->io_num.n_output; i++) {
+        ret = rknn_set_io_mem(app_ctx->rknn_ctx, io.output_mems[i], &app_ctx->output_native_attrs[i]);
+        if (ret < 0) {
+            printf("output_mems rknn_set_io_mem fail! ret=%d\n", ret);
+            return -1;
+        }
+    }
+    app_ctx->async->bound = set;
+    return 0;
+}
+
+int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, object_detect_result_list *od_results) {
+    int ret;
+    letterbox_t letter_box;
+
+    if ((!app_ctx) || !(img) || (!od_results)) {
+        return -1;
+    }
+
+    memset(od_results, 0x00, sizeof(*od_results));
+
+    // the async API may have left set 1 bound
+    if (app_ctx->async != NULL) {
+        if (app_ctx->async->next_poll != app_ctx->async->next_submit) {
+            printf("inference_yolov8_model: async frames outstanding\n");
+            return -1;
+        }
+        if (app_ctx->async->bound != 0 && bind_io_set(app_ctx, 0) != 0) {
+            return -1;
+        }
+    }
+
+    ret = fill_input(app_ctx, 0, img, &letter_box);
+    if (ret < 0) {
+        return -1;
+    }
 
     // Run
-    printf("rknn_run\n");
+    LOGD("rknn_run");
     ret = rknn_run(app_ctx->rknn_ctx, nullptr);
     if (ret < 0) {
         printf("rknn_run fail! ret=%d\n", ret);
         return -1;
     }
 
-    //NC1HWC2 to NCHW
-    rknn_output outputs[app_ctx->io_num.n_output];
-    memset(outputs, 0, sizeof(outputs));
+    return process_outputs(app_ctx, 0, &letter_box, od_results);
+}
+
+int inference_yolov8_batch(rknn_app_context_t *app_ctx, image_buffer_t **imgs, int n,
+                           object_detect_result_list **od_results) {
+    if (n != 1) {
+        printf("inference_yolov8_batch: batch-1 model\n");
+        return -1;
+    }
+    return inference_yolov8_model(app_ctx, imgs[0], od_results[0]);
+}
+
+// ---- double-buffered async API ------------------------------------------
+
+static int init_async(rknn_app_context_t *app_ctx) {
+    yolov8_async_t *as = (yolov8_async_t *)calloc(1, sizeof(yolov8_async_t));
+    if (as == NULL) {
+        return -1;
+    }
+    as->running = -1;
+    app_ctx->async = as;
+
+    as->input_mem = rknn_create_mem(app_ctx->rknn_ctx, app_ctx->input_native_attrs[0].size_with_stride);
+    bool ok = as->input_mem != NULL;
+    for (uint32_t i = 0; i < app_ctx->io_num.n_output && ok; i++) {
+        as->output_mems[i] = rknn_create_mem(app_ctx->rknn_ctx, app_ctx->output_native_attrs[i].size_with_stride);
+        ok = as->output_mems[i] != NULL;
+    }
+    if (!ok) {
+        printf("rknn_create_mem for the second io set fail!\n");
+        release_async(app_ctx);
+        return -1;
+    }
+    return 0;
+}
+
+static int wait_running(rknn_app_context_t *app_ctx) {
+    yolov8_async_t *as = app_ctx->async;
+    int set = as->running;
+    if (set < 0) {
+        return 0;
+    }
+    // the id rknn_run returned for this set's run
+    rknn_run_extend ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.frame_id = as->frame_id[set];
+    ext.timeout_ms = YOLOV8_ASYNC_TIMEOUT_MS;
+    int ret = rknn_wait(app_ctx->rknn_ctx, &ext);
+    if (ret < 0) {
+        printf("rknn_wait fail! ret=%d\n", ret);
+    }
+    as->ret[set] = ret;
+    as->state[set] = YOLOV8_IO_SET_DONE;
+    as->running = -1;
+    return ret;
+}
+
+static void release_async(rknn_app_context_t *app_ctx) {
+    yolov8_async_t *as = app_ctx->async;
+    if (as == NULL) {
+        return;
+    }
+    wait_running(app_ctx);
+    if (as->input_mem != NULL) {
+        rknn_destroy_mem(app_ctx->rknn_ctx, as->input_mem);
+    }
     for (uint32_t i = 0; i < app_ctx->io_num.n_output; i++) {
-        int   channel = app_ctx->output_attrs[i].dims[1];
-        int   h       = app_ctx->output_attrs[i].n_dims > 2 ? app_ctx->output_attrs[i].dims[2] : 1;
-        int   w       = app_ctx->output_attrs[i].n_dims > 3 ? app_ctx->output_attrs[i].dims[3] : 1;
-        int   hw      = h * w;
-        int   zp      = app_ctx->output_native_attrs[i].zp;
-        float scale   = app_ctx->output_native_attrs[i].scale;
-        if (app_ctx->is_quant) {
-            outputs[i].size = app_ctx->output_native_attrs[i].n_elems * sizeof(int8_t);
-            outputs[i].buf = (int8_t *)malloc(outputs[i].size);
-            if (app_ctx->output_native_attrs[i].fmt == RKNN_TENSOR_NC1HWC2) {
-                NC1HWC2_i8_to_NCHW_i8((int8_t *)app_ctx->output_mems[i]->virt_addr, (int8_t *)outputs[i].buf,
-                                      (int *)app_ctx->output_native_attrs[i].dims, channel, h, w, zp, scale);
-            } else {
-                memcpy(outputs[i].buf, app_ctx->output_mems[i]->virt_addr, outputs[i].size);
-            }
-        } else {
-            printf("Currently zero copy does not support fp16!\n");
-            goto out;
+        if (as->output_mems[i] != NULL) {
+            rknn_destroy_mem(app_ctx->rknn_ctx, as->output_mems[i]);
         }
     }
+    release_letterbox_cache(&as->letterbox_cache);
+    free(as);
+    app_ctx->async = NULL;
+}
 
-    // Post Process
-    post_process(app_ctx, outputs, &letter_box, box_conf_threshold, nms_threshold, od_results);
+int submit_yolov8_frame(rknn_app_context_t *app_ctx, image_buffer_t *img, void *user) {
+    if ((!app_ctx) || !(img)) {
+        return -1;
+    }
+    if (app_ctx->async == NULL && init_async(app_ctx) != 0) {
+        return -1;
+    }
+    yolov8_async_t *as = app_ctx->async;
+    int set = (int)(as->next_submit % YOLOV8_IO_SETS);
+    if (as->state[set] != YOLOV8_IO_SET_FREE) {
+        return 1;
+    }
 
-    for (int i = 0; i < app_ctx->io_num.n_output; i++) {
-        free(outputs[i].buf);
+    // CPU side of this frame, the NPU is still busy with the previous one
+    if (fill_input(app_ctx, set, img, &as->letter_box[set]) != 0) {
+        return -1;
+    }
+
+    // one run per context at a time: start this frame as soon as the
+    // previous one is done, its outputs wait for poll_yolov8_result
+    wait_running(app_ctx);
+    as->user[set] = user;
+    as->state[set] = YOLOV8_IO_SET_DONE;
+    as->ret[set] = bind_io_set(app_ctx, set);
+    as->next_submit++;
+    if (as->ret[set] != 0) {
+        return 0; // reported by poll_yolov8_result
     }
 
-out:
+    // the runtime numbers the runs of this context, synchronous ones
+    // included, rknn_wait takes the id it hands back
+    rknn_run_extend ext;
+    memset(&ext, 0, sizeof(ext));
+    ext.non_block = 1;
+    ext.timeout_ms = YOLOV8_ASYNC_TIMEOUT_MS;
+    int ret = rknn_run(app_ctx->rknn_ctx, &ext);
+    if (ret < 0) {
+        printf("rknn_run fail! ret=%d\n", ret);
+        as->ret[set] = ret;
+        return 0;
+    }
+    as->frame_id[set] = ext.frame_id;
+    as->state[set] = YOLOV8_IO_SET_RUNNING;
+    as->running = set;
+    return 0;
+}
+
+int poll_yolov8_result(rknn_app_context_t *app_ctx, object_detect_result_list *od_results, void **user) {
+    if ((!app_ctx) || (!od_results)) {
+        return -1;
+    }
+    yolov8_async_t *as = app_ctx->async;
+    if (as == NULL || as->next_poll == as->next_submit) {
+        return -1;
+    }
+    int set = (int)(as->next_poll % YOLOV8_IO_SETS);
+    if (as->state[set] == YOLOV8_IO_SET_RUNNING) {
+        wait_running(app_ctx);
+    }
+
+    // the NPU may already be running the next frame out of the other set
+    memset(od_results, 0x00, sizeof(*od_results));
+    int ret = as->ret[set] < 0 ? -2 : process_outputs(app_ctx, set, &as->letter_box[set], od_results);
+    if (user != NULL) {
+        *user = as->user[set];
+    }
+    as->state[set] = YOLOV8_IO_SET_FREE;
+    as->next_poll++;
     return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,264 @@
+#include "score_scan.h"
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SCORE_SCAN_NEON
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SCORE_SCAN_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCORE_SCAN_SSE2
+#endif
+
+static inline void merge_word(uint32_t *mask, int w, uint32_t bits, score_mask_op_t op)
+{
+    switch (op)
+    {
+    case SCORE_MASK_AND:
+        mask[w] &= bits;
+        break;
+    case SCORE_MASK_OR:
+        mask[w] |= bits;
+        break;
+    default:
+        mask[w] = bits;
+        break;
+    }
+}
+
+template <typename T>
+static inline uint32_t cmp_word_c(const T *src, int cnt, T thres, score_cmp_t cmp)
+{
+    uint32_t bits = 0;
+    if (cmp == SCORE_CMP_GE)
+    {
+        for (int k = 0; k < cnt; k++)
+        {
+            if (!(src[k] < thres))
+                bits |= 1u << k;
+        }
+    }
+    else
+    {
+        for (int k = 0; k < cnt; k++)
+        {
+            if (src[k] > thres)
+                bits |= 1u << k;
+        }
+    }
+    return bits;
+}
+
+// Words [first_word, SCORE_MASK_WORDS(n)) with the scalar compare.
+template <typename T>
+static void score_mask_tail(const T *src, int n, T thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask, int first_word)
+{
+    for (int w = first_word; w * 32 < n; w++)
+    {
+        int cnt = n - w * 32 < 32 ? n - w * 32 : 32;
+        merge_word(mask, w, cmp_word_c(src + w * 32, cnt, thres, cmp), op);
+    }
+}
+
+void score_mask_i8_c(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_tail(src, n, thres, cmp, op, mask, 0);
+}
+
+void score_mask_u8_c(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_tail(src, n, thres, cmp, op, mask, 0);
+}
+
+void score_mask_f32_c(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_tail(src, n, thres, cmp, op, mask, 0);
+}
+
+#if defined(SCORE_SCAN_NEON)
+
+static inline uint32_t movemask_u8(uint8x16_t m)
+{
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t b = vandq_u8(m, vld1q_u8(weights));
+    return (uint32_t)vaddv_u8(vget_low_u8(b)) | ((uint32_t)vaddv_u8(vget_high_u8(b)) << 8);
+}
+
+static inline uint32_t movemask_u32(uint32x4_t m)
+{
+    static const uint32_t weights[4] = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(m, vld1q_u32(weights)));
+}
+
+static inline uint32_t cmp_word_i8(const int8_t *src, int8x16_t t, score_cmp_t cmp)
+{
+    int8x16_t v0 = vld1q_s8(src);
+    int8x16_t v1 = vld1q_s8(src + 16);
+    if (cmp == SCORE_CMP_GE)
+        return movemask_u8(vcgeq_s8(v0, t)) | (movemask_u8(vcgeq_s8(v1, t)) << 16);
+    return movemask_u8(vcgtq_s8(v0, t)) | (movemask_u8(vcgtq_s8(v1, t)) << 16);
+}
+
+static inline uint32_t cmp_word_u8(const uint8_t *src, uint8x16_t t, score_cmp_t cmp)
+{
+    uint8x16_t v0 = vld1q_u8(src);
+    uint8x16_t v1 = vld1q_u8(src + 16);
+    if (cmp == SCORE_CMP_GE)
+        return movemask_u8(vcgeq_u8(v0, t)) | (movemask_u8(vcgeq_u8(v1, t)) << 16);
+    return movemask_u8(vcgtq_u8(v0, t)) | (movemask_u8(vcgtq_u8(v1, t)) << 16);
+}
+
+static inline uint32_t cmp_word_f32(const float *src, float32x4_t t, score_cmp_t cmp)
+{
+    uint32_t bits = 0;
+    for (int k = 0; k < 32; k += 4)
+    {
+        float32x4_t v = vld1q_f32(src + k);
+        // "not less than" keeps NaN cells like the scalar filter does
+        uint32x4_t m = cmp == SCORE_CMP_GE ? vmvnq_u32(vcltq_f32(v, t)) : vcgtq_f32(v, t);
+        bits |= movemask_u32(m) << k;
+    }
+    return bits;
+}
+
+#define SCORE_SET1_I8(x) vdupq_n_s8(x)
+#define SCORE_SET1_U8(x) vdupq_n_u8(x)
+#define SCORE_SET1_F32(x) vdupq_n_f32(x)
+
+#elif defined(SCORE_SCAN_AVX2)
+
+static inline uint32_t cmp_word_i8(const int8_t *src, __m256i t, score_cmp_t cmp)
+{
+    __m256i v = _mm256_loadu_si256((const __m256i *)src);
+    if (cmp == SCORE_CMP_GE)
+        return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(t, v));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, t));
+}
+
+static inline uint32_t cmp_word_u8(const uint8_t *src, __m256i t, score_cmp_t cmp)
+{
+    // no unsigned compare in AVX2: v >= t <=> max(v, t) == v
+    __m256i v = _mm256_loadu_si256((const __m256i *)src);
+    __m256i m = _mm256_max_epu8(v, t);
+    if (cmp == SCORE_CMP_GE)
+        return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, v));
+    return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(m, t));
+}
+
+static inline uint32_t cmp_word_f32(const float *src, __m256 t, score_cmp_t cmp)
+{
+    uint32_t bits = 0;
+    for (int k = 0; k < 32; k += 8)
+    {
+        __m256 v = _mm256_loadu_ps(src + k);
+        __m256 m = cmp == SCORE_CMP_GE ? _mm256_cmp_ps(v, t, _CMP_NLT_UQ) : _mm256_cmp_ps(v, t, _CMP_GT_OQ);
+        bits |= (uint32_t)_mm256_movemask_ps(m) << k;
+    }
+    return bits;
+}
+
+#define SCORE_SET1_I8(x) _mm256_set1_epi8(x)
+#define SCORE_SET1_U8(x) _mm256_set1_epi8((char)(x))
+#define SCORE_SET1_F32(x) _mm256_set1_ps(x)
+
+#elif defined(SCORE_SCAN_SSE2)
+
+static inline uint32_t cmp_half_i8(const int8_t *src, __m128i t, score_cmp_t cmp)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    if (cmp == SCORE_CMP_GE)
+        return ~(uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(t, v)) & 0xffff;
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpgt_epi8(v, t));
+}
+
+static inline uint32_t cmp_word_i8(const int8_t *src, __m128i t, score_cmp_t cmp)
+{
+    return cmp_half_i8(src, t, cmp) | (cmp_half_i8(src + 16, t, cmp) << 16);
+}
+
+static inline uint32_t cmp_half_u8(const uint8_t *src, __m128i t, score_cmp_t cmp)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    __m128i m = _mm_max_epu8(v, t);
+    if (cmp == SCORE_CMP_GE)
+        return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(m, v));
+    return ~(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(m, t)) & 0xffff;
+}
+
+static inline uint32_t cmp_word_u8(const uint8_t *src, __m128i t, score_cmp_t cmp)
+{
+    return cmp_half_u8(src, t, cmp) | (cmp_half_u8(src + 16, t, cmp) << 16);
+}
+
+static inline uint32_t cmp_word_f32(const float *src, __m128 t, score_cmp_t cmp)
+{
+    uint32_t bits = 0;
+    for (int k = 0; k < 32; k += 4)
+    {
+        __m128 v = _mm_loadu_ps(src + k);
+        __m128 m = cmp == SCORE_CMP_GE ? _mm_cmpnlt_ps(v, t) : _mm_cmpgt_ps(v, t);
+        bits |= (uint32_t)_mm_movemask_ps(m) << k;
+    }
+    return bits;
+}
+
+#define SCORE_SET1_I8(x) _mm_set1_epi8(x)
+#define SCORE_SET1_U8(x) _mm_set1_epi8((char)(x))
+#define SCORE_SET1_F32(x) _mm_set1_ps(x)
+
+#endif
+
+#if defined(SCORE_SCAN_NEON) || defined(SCORE_SCAN_AVX2) || defined(SCORE_SCAN_SSE2)
+
+void score_mask_i8(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    int full = n / 32;
+    auto t = SCORE_SET1_I8(thres);
+    for (int w = 0; w < full; w++)
+    {
+        merge_word(mask, w, cmp_word_i8(src + w * 32, t, cmp), op);
+    }
+    score_mask_tail(src, n, thres, cmp, op, mask, full);
+}
+
+void score_mask_u8(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    int full = n / 32;
+    auto t = SCORE_SET1_U8(thres);
+    for (int w = 0; w < full; w++)
+    {
+        merge_word(mask, w, cmp_word_u8(src + w * 32, t, cmp), op);
+    }
+    score_mask_tail(src, n, thres, cmp, op, mask, full);
+}
+
+void score_mask_f32(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    int full = n / 32;
+    auto t = SCORE_SET1_F32(thres);
+    for (int w = 0; w < full; w++)
+    {
+        merge_word(mask, w, cmp_word_f32(src + w * 32, t, cmp), op);
+    }
+    score_mask_tail(src, n, thres, cmp, op, mask, full);
+}
+
+#else
+
+void score_mask_i8(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_i8_c(src, n, thres, cmp, op, mask);
+}
+
+void score_mask_u8(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_u8_c(src, n, thres, cmp, op, mask);
+}
+
+void score_mask_f32(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_f32_c(src, n, thres, cmp, op, mask);
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _RKNN_YOLOV8_DEMO_SCORE_SCAN_H_
+#define _RKNN_YOLOV8_DEMO_SCORE_SCAN_H_
+
+#include <stdint.h>
+
+// Candidate bitmask over a grid: bit (k % 32) of mask[k / 32] belongs to cell k.
+#define SCORE_MASK_WORDS(n) (((n) + 31) / 32)
+
+typedef enum {
+    SCORE_CMP_GE = 0,   // keep cell when !(val < thres), the score sum filter
+    SCORE_CMP_GT,       // keep cell when val > thres, the class score filter
+} score_cmp_t;
+
+typedef enum {
+    SCORE_MASK_SET = 0, // mask  = cmp
+    SCORE_MASK_AND,     // mask &= cmp
+    SCORE_MASK_OR,      // mask |= cmp
+} score_mask_op_t;
+
+// Compare n contiguous cells against thres and merge the result into mask.
+// Uses NEON on aarch64, AVX2/SSE2 on x86 and a scalar loop elsewhere; all
+// variants produce the same bits, padding bits of the last word are cleared.
+void score_mask_i8(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+void score_mask_u8(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+void score_mask_f32(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+
+// Scalar reference used for the tails and on targets without SIMD.
+void score_mask_i8_c(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+void score_mask_u8_c(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+void score_mask_f32_c(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask);
+
+// Overloads so templated decoders can pick the kernel by element type.
+static inline void score_mask(const int8_t *src, int n, int8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_i8(src, n, thres, cmp, op, mask);
+}
+static inline void score_mask(const uint8_t *src, int n, uint8_t thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_u8(src, n, thres, cmp, op, mask);
+}
+static inline void score_mask(const float *src, int n, float thres, score_cmp_t cmp, score_mask_op_t op, uint32_t *mask)
+{
+    score_mask_f32(src, n, thres, cmp, op, mask);
+}
+
+// Index of the lowest set bit, the word must be non zero.
+static inline int score_mask_ctz(uint32_t word) { return __builtin_ctz(word); }
+
+#endif //_RKNN_YOLOV8_DEMO_SCORE_SCAN_H_
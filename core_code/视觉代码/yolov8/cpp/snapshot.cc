@@ -0,0 +1,199 @@
+#include "snapshot.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "async_log.h"
+
+typedef struct {
+    cv::Mat image; // the caller's pixels, not a copy
+    char path[SNAPSHOT_PATH_MAX];
+    snapshot_done_fn done;
+    void *user;
+} snapshot_job_t;
+
+struct snapshot_writer
+{
+    pthread_t *threads;
+    int n_threads;
+    std::vector<int> params; // cv::imencode
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    snapshot_job_t *jobs;    // circular, queue_size
+    int queue_size;
+    int first;
+    int count;
+    bool stop;
+    uint64_t dropped;
+};
+
+// Encode and write one job, the image is released before returning
+static void write_snapshot(snapshot_writer_t *writer, snapshot_job_t *job, std::vector<unsigned char> &buf)
+{
+    bool encoded = cv::imencode(".jpg", job->image, buf, writer->params);
+    job->image.release();
+    if (job->done != NULL)
+    {
+        job->done(job->user);
+    }
+    if (!encoded)
+    {
+        LOGE("snapshot: encode %s fail!", job->path);
+        return;
+    }
+
+    char tmp_path[SNAPSHOT_PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", job->path);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL)
+    {
+        LOGE("snapshot: open %s fail!", tmp_path);
+        return;
+    }
+    bool written = fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+    written = fclose(fp) == 0 && written;
+    if (!written || rename(tmp_path, job->path) != 0)
+    {
+        LOGE("snapshot: write %s fail!", job->path);
+        remove(tmp_path);
+        return;
+    }
+    LOGI("Saved result to %s", job->path);
+}
+
+static void *encoder_main(void *arg)
+{
+    snapshot_writer_t *writer = (snapshot_writer_t *)arg;
+#if defined(__linux__)
+    // behind the pipeline stages when cores are short
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), SNAPSHOT_NICE);
+#endif
+    std::vector<unsigned char> buf; // grows to the largest JPEG once
+    snapshot_job_t job;
+    pthread_mutex_lock(&writer->lock);
+    while (true)
+    {
+        if (writer->count == 0)
+        {
+            if (writer->stop)
+            {
+                break;
+            }
+            pthread_cond_wait(&writer->cond, &writer->lock);
+            continue;
+        }
+        snapshot_job_t *slot = &writer->jobs[writer->first];
+        job.image = slot->image;
+        slot->image.release();
+        memcpy(job.path, slot->path, sizeof(job.path));
+        job.done = slot->done;
+        job.user = slot->user;
+        writer->first = (writer->first + 1) % writer->queue_size;
+        writer->count--;
+
+        pthread_mutex_unlock(&writer->lock);
+        write_snapshot(writer, &job, buf);
+        pthread_mutex_lock(&writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+snapshot_writer_t *snapshot_writer_create(int n_threads, int queue_size, int jpeg_quality)
+{
+    if (n_threads < 1 || queue_size < 1)
+    {
+        return NULL;
+    }
+    snapshot_writer_t *writer = new snapshot_writer_t();
+    writer->threads = new pthread_t[n_threads];
+    writer->jobs = new snapshot_job_t[queue_size];
+    writer->queue_size = queue_size;
+    writer->params.push_back(cv::IMWRITE_JPEG_QUALITY);
+    writer->params.push_back(jpeg_quality);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&writer->threads[i], NULL, encoder_main, writer) != 0)
+        {
+            printf("snapshot: pthread_create fail, %d of %d encoders\n", i, n_threads);
+            break;
+        }
+        writer->n_threads++;
+    }
+    if (writer->n_threads == 0)
+    {
+        snapshot_writer_destroy(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+void snapshot_writer_destroy(snapshot_writer_t *writer)
+{
+    if (writer == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    for (int i = 0; i < writer->n_threads; i++)
+    {
+        pthread_join(writer->threads[i], NULL);
+    }
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    delete[] writer->jobs;
+    delete[] writer->threads;
+    delete writer;
+}
+
+int snapshot_writer_submit(snapshot_writer_t *writer, const cv::Mat &image, const char *path, snapshot_done_fn done,
+                           void *user)
+{
+    if (writer == NULL || path == NULL || image.empty() || strlen(path) >= SNAPSHOT_PATH_MAX)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&writer->lock);
+    if (writer->stop)
+    {
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+    if (writer->count == writer->queue_size)
+    {
+        writer->dropped++;
+        pthread_mutex_unlock(&writer->lock);
+        return 1;
+    }
+    snapshot_job_t *slot = &writer->jobs[(writer->first + writer->count) % writer->queue_size];
+    slot->image = image; // header only, the pixels are shared
+    strcpy(slot->path, path);
+    slot->done = done;
+    slot->user = user;
+    writer->count++;
+    pthread_cond_signal(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+uint64_t snapshot_writer_dropped(snapshot_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    uint64_t dropped = writer->dropped;
+    pthread_mutex_unlock(&writer->lock);
+    return dropped;
+}
@@ -0,0 +1,41 @@
+#ifndef _RKNN_YOLOV8_DEMO_SNAPSHOT_H_
+#define _RKNN_YOLOV8_DEMO_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <opencv2/opencv.hpp>
+
+// JPEG snapshots off the detection loop. submit only queues a reference to
+// the caller's image, encoder threads (at a lower priority) encode and
+// write it and hand the image back through a callback. A full queue drops
+// the snapshot instead of blocking the caller.
+#ifndef SNAPSHOT_THREADS
+#define SNAPSHOT_THREADS 1
+#endif
+#ifndef SNAPSHOT_JPEG_QUALITY
+#define SNAPSHOT_JPEG_QUALITY 90
+#endif
+#define SNAPSHOT_QUEUE_SIZE 2
+#define SNAPSHOT_NICE 10 // added to the encoder threads' nice value
+#define SNAPSHOT_PATH_MAX 128
+
+typedef struct snapshot_writer snapshot_writer_t;
+
+// done(user) is called on an encoder thread once image is no longer read
+typedef void (*snapshot_done_fn)(void *user);
+
+snapshot_writer_t *snapshot_writer_create(int n_threads, int queue_size, int jpeg_quality);
+// Writes out what is queued, then stops the encoder threads.
+void snapshot_writer_destroy(snapshot_writer_t *writer);
+
+// image must not be written until done(user). Returns 0 once queued, 1 if
+// the queue is full and the snapshot is dropped (done is not called) and -1
+// on error. The file appears complete under path (written aside and
+// renamed).
+int snapshot_writer_submit(snapshot_writer_t *writer, const cv::Mat &image, const char *path, snapshot_done_fn done,
+                           void *user);
+
+// Snapshots dropped on a full queue so far
+uint64_t snapshot_writer_dropped(snapshot_writer_t *writer);
+
+#endif //_RKNN_YOLOV8_DEMO_SNAPSHOT_H_
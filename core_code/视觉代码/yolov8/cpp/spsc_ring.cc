@@ -0,0 +1,197 @@
+#include "spsc_ring.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+// head is written by the producer only. tail is advanced by the consumer
+// and, to evict under SPSC_RING_DROP_OLDEST, by the producer, so both sides
+// move it with a CAS. Indices grow without wrapping, slot = index % capacity.
+struct spsc_ring
+{
+    uint64_t head;
+    char pad0[SPSC_RING_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t tail;
+    char pad1[SPSC_RING_CACHE_LINE - sizeof(uint64_t)];
+    void **slots;
+    int capacity;
+    spsc_ring_policy_t policy;
+    bool closed;
+    uint64_t dropped;
+    sem_t items; // one token per push, evicted items leave theirs behind
+    sem_t space; // free slots, SPSC_RING_BLOCK only
+};
+
+spsc_ring_t *spsc_ring_create(int capacity, spsc_ring_policy_t policy)
+{
+    if (capacity < 1)
+    {
+        return NULL;
+    }
+    spsc_ring_t *ring = (spsc_ring_t *)calloc(1, sizeof(spsc_ring_t));
+    if (ring == NULL)
+    {
+        return NULL;
+    }
+    ring->slots = (void **)calloc(capacity, sizeof(void *));
+    if (ring->slots == NULL)
+    {
+        free(ring);
+        return NULL;
+    }
+    ring->capacity = capacity;
+    ring->policy = policy;
+    sem_init(&ring->items, 0, 0);
+    sem_init(&ring->space, 0, policy == SPSC_RING_BLOCK ? capacity : 0);
+    return ring;
+}
+
+void spsc_ring_destroy(spsc_ring_t *ring)
+{
+    if (ring == NULL)
+    {
+        return;
+    }
+    sem_destroy(&ring->space);
+    sem_destroy(&ring->items);
+    free(ring->slots);
+    free(ring);
+}
+
+static bool is_closed(spsc_ring_t *ring) { return __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE); }
+
+// Take the item at tail, NULL if empty. Safe against a concurrent eviction
+// by the producer: the slot is read before the CAS that claims it.
+static void *take_tail(spsc_ring_t *ring, uint64_t head)
+{
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    while (tail != head)
+    {
+        void *item = __atomic_load_n(&ring->slots[tail % ring->capacity], __ATOMIC_RELAXED);
+        if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            return item;
+        }
+    }
+    return NULL;
+}
+
+int spsc_ring_push(spsc_ring_t *ring, void *item, void **dropped)
+{
+    if (dropped != NULL)
+    {
+        *dropped = NULL;
+    }
+    if (ring->policy == SPSC_RING_BLOCK)
+    {
+        while (sem_wait(&ring->space) != 0)
+        {
+        }
+    }
+    if (is_closed(ring))
+    {
+        sem_post(&ring->space);
+        return -1;
+    }
+    uint64_t head = ring->head;
+    while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= (uint64_t)ring->capacity)
+    {
+        // SPSC_RING_DROP_OLDEST only, a space token guarantees room otherwise
+        void *old = take_tail(ring, head);
+        if (old != NULL)
+        {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+            if (dropped != NULL)
+            {
+                *dropped = old;
+            }
+        }
+        // else the consumer just popped it, there is room now
+    }
+    // the slot of head - capacity has been claimed, nobody reads it any more
+    __atomic_store_n(&ring->slots[head % ring->capacity], item, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    sem_post(&ring->items);
+    return 0;
+}
+
+static int wait_items(spsc_ring_t *ring, int timeout_us, const struct timespec *deadline)
+{
+    int ret;
+    do
+    {
+        if (timeout_us < 0)
+        {
+            ret = sem_wait(&ring->items);
+        }
+        else if (timeout_us == 0)
+        {
+            ret = sem_trywait(&ring->items);
+        }
+        else
+        {
+            ret = sem_timedwait(&ring->items, deadline);
+        }
+    } while (ret != 0 && errno == EINTR);
+    return ret;
+}
+
+int spsc_ring_pop(spsc_ring_t *ring, void **item, int timeout_us)
+{
+    struct timespec deadline;
+    if (timeout_us > 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_us / 1000000;
+        deadline.tv_nsec += (timeout_us % 1000000) * 1000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    while (true)
+    {
+        // one items token per push, evicted items and the close leave
+        // tokens without an item behind
+        if (wait_items(ring, timeout_us, &deadline) != 0)
+        {
+            return is_closed(ring) && spsc_ring_count(ring) == 0 ? -1 : 1;
+        }
+        void *got = take_tail(ring, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE));
+        if (got != NULL)
+        {
+            if (ring->policy == SPSC_RING_BLOCK)
+            {
+                sem_post(&ring->space);
+            }
+            *item = got;
+            return 0;
+        }
+        if (is_closed(ring))
+        {
+            // leave the token for the next call
+            sem_post(&ring->items);
+            return -1;
+        }
+    }
+}
+
+void spsc_ring_close(spsc_ring_t *ring)
+{
+    __atomic_store_n(&ring->closed, true, __ATOMIC_RELEASE);
+    sem_post(&ring->items);
+    sem_post(&ring->space);
+}
+
+int spsc_ring_count(spsc_ring_t *ring)
+{
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    return (int)(head - tail);
+}
+
+uint64_t spsc_ring_dropped(spsc_ring_t *ring) { return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED); }
@@ -0,0 +1,36 @@
+#ifndef _RKNN_YOLOV8_DEMO_SPSC_RING_H_
+#define _RKNN_YOLOV8_DEMO_SPSC_RING_H_
+
+#include <stdint.h>
+
+// Bounded single-producer single-consumer queue of pointers between two
+// pipeline stages. Push and pop are lock-free, a side only sleeps (on a
+// semaphore) when it has nothing to do.
+typedef struct spsc_ring spsc_ring_t;
+
+typedef enum {
+    SPSC_RING_BLOCK = 0,    // push waits for space, nothing is lost
+    SPSC_RING_DROP_OLDEST,  // push on a full ring evicts the oldest item, latest frame wins
+} spsc_ring_policy_t;
+
+spsc_ring_t *spsc_ring_create(int capacity, spsc_ring_policy_t policy);
+void spsc_ring_destroy(spsc_ring_t *ring);
+
+// item must not be NULL. Returns 0 once queued, -1 if the ring is closed.
+// With SPSC_RING_DROP_OLDEST *dropped receives the evicted item (NULL if
+// none), which goes back to the producer.
+int spsc_ring_push(spsc_ring_t *ring, void *item, void **dropped);
+
+// Oldest item. Returns 0 with an item, 1 if nothing arrived within
+// timeout_us (< 0 waits forever) and -1 once the ring is closed and empty.
+int spsc_ring_pop(spsc_ring_t *ring, void **item, int timeout_us);
+
+// Producer side end of stream, wakes both sides. Items already queued can
+// still be popped.
+void spsc_ring_close(spsc_ring_t *ring);
+
+int spsc_ring_count(spsc_ring_t *ring);
+// Items evicted by SPSC_RING_DROP_OLDEST so far
+uint64_t spsc_ring_dropped(spsc_ring_t *ring);
+
+#endif //_RKNN_YOLOV8_DEMO_SPSC_RING_H_
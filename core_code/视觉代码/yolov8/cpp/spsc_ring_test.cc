@@ -0,0 +1,251 @@
+// Producer/consumer stress test of spsc_ring: every item pushed is either
+// popped once, in order, or (SPSC_RING_DROP_OLDEST) handed back to the
+// producer as dropped, and close lets the consumer drain what is queued.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+typedef struct {
+    spsc_ring_t *ring;
+    uintptr_t n_items;     // items are 1..n_items, NULL cannot be queued
+    uint8_t *was_dropped;  // per item, set when handed back
+    uint64_t returned;
+    int bad;
+} ring_test_t;
+
+static void *producer_main(void *arg)
+{
+    ring_test_t *t = (ring_test_t *)arg;
+    uintptr_t last_dropped = 0;
+    for (uintptr_t i = 1; i <= t->n_items; i++)
+    {
+        void *dropped = NULL;
+        if (spsc_ring_push(t->ring, (void *)i, &dropped) != 0)
+        {
+            printf("push %lu failed on an open ring\n", (unsigned long)i);
+            t->bad++;
+            break;
+        }
+        if (dropped != NULL)
+        {
+            // evicted oldest first, each one only once
+            uintptr_t v = (uintptr_t)dropped;
+            if (v <= last_dropped || v >= i || t->was_dropped[v] != 0)
+            {
+                printf("item %lu dropped out of order or twice\n", (unsigned long)v);
+                t->bad++;
+            }
+            t->was_dropped[v] = 1;
+            last_dropped = v;
+            t->returned++;
+        }
+        // lets the consumer in on a single core
+        if (i % 64 == 0)
+        {
+            sched_yield();
+        }
+    }
+    spsc_ring_close(t->ring);
+    return NULL;
+}
+
+static int run_stress(spsc_ring_policy_t policy, int capacity, uintptr_t n_items)
+{
+    ring_test_t t;
+    memset(&t, 0, sizeof(t));
+    t.ring = spsc_ring_create(capacity, policy);
+    t.n_items = n_items;
+    t.was_dropped = (uint8_t *)calloc(n_items + 1, 1);
+    uint8_t *got = (uint8_t *)calloc(n_items + 1, 1);  // consumer side marks
+    if (t.ring == NULL || t.was_dropped == NULL || got == NULL)
+    {
+        printf("out of memory\n");
+        spsc_ring_destroy(t.ring);
+        free(t.was_dropped);
+        free(got);
+        return -1;
+    }
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, producer_main, &t) != 0)
+    {
+        printf("pthread_create fail!\n");
+        spsc_ring_destroy(t.ring);
+        free(t.was_dropped);
+        free(got);
+        return -1;
+    }
+
+    // the consumer alternates blocking and timed pops so both wake paths run
+    uintptr_t last = 0;
+    uint64_t popped = 0;
+    int ret;
+    void *item;
+    while ((ret = spsc_ring_pop(t.ring, &item, popped % 7 == 0 ? 50 : -1)) >= 0)
+    {
+        if (ret > 0)
+        {
+            continue;
+        }
+        uintptr_t v = (uintptr_t)item;
+        if (v <= last || v > n_items)
+        {
+            printf("popped %lu after %lu\n", (unsigned long)v, (unsigned long)last);
+            t.bad++;
+        }
+        else
+        {
+            got[v] = 1;
+        }
+        last = v;
+        popped++;
+    }
+    pthread_join(producer, NULL);
+
+    // the producer's marks are visible after the join: no item may be
+    // both popped and dropped, or neither
+    uint64_t lost = 0;
+    for (uintptr_t i = 1; i <= n_items; i++)
+    {
+        if (got[i] && t.was_dropped[i])
+        {
+            printf("item %lu popped and dropped\n", (unsigned long)i);
+            t.bad++;
+        }
+        else if (!got[i] && !t.was_dropped[i])
+        {
+            lost++;
+        }
+    }
+    if (lost != 0 || popped + t.returned != n_items)
+    {
+        t.bad++;
+    }
+    if (spsc_ring_dropped(t.ring) != t.returned)
+    {
+        printf("ring counted %llu drops, producer got %llu back\n", (unsigned long long)spsc_ring_dropped(t.ring),
+               (unsigned long long)t.returned);
+        t.bad++;
+    }
+    if (policy == SPSC_RING_BLOCK && t.returned != 0)
+    {
+        printf("blocking ring dropped items\n");
+        t.bad++;
+    }
+
+    printf("%s capacity %d: popped %llu, dropped %llu, lost %llu%s\n",
+           policy == SPSC_RING_BLOCK ? "block" : "drop oldest", capacity, (unsigned long long)popped,
+           (unsigned long long)t.returned, (unsigned long long)lost, t.bad ? " FAIL" : "");
+    spsc_ring_destroy(t.ring);
+    free(t.was_dropped);
+    free(got);
+    return t.bad ? -1 : 0;
+}
+
+static void *close_main(void *arg)
+{
+    spsc_ring_t *ring = (spsc_ring_t *)arg;
+    spsc_ring_close(ring);
+    return NULL;
+}
+
+// close on an open ring: queued items are still popped, then -1; a pop
+// waiting on an empty ring is woken; push after close fails.
+static int run_close(spsc_ring_policy_t policy)
+{
+    const char *name = policy == SPSC_RING_BLOCK ? "block" : "drop oldest";
+    spsc_ring_t *ring = spsc_ring_create(4, policy);
+    if (ring == NULL)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+    int bad = 0;
+    void *item = NULL;
+    void *dropped = NULL;
+
+    if (spsc_ring_pop(ring, &item, 1000) != 1)
+    {
+        printf("%s: timed pop on an empty ring did not time out\n", name);
+        bad++;
+    }
+    for (uintptr_t i = 1; i <= 3; i++)
+    {
+        spsc_ring_push(ring, (void *)i, &dropped);
+    }
+    spsc_ring_close(ring);
+    if (spsc_ring_push(ring, (void *)4, &dropped) != -1)
+    {
+        printf("%s: push after close succeeded\n", name);
+        bad++;
+    }
+    for (uintptr_t i = 1; i <= 3; i++)
+    {
+        if (spsc_ring_pop(ring, &item, -1) != 0 || (uintptr_t)item != i)
+        {
+            printf("%s: item %lu not drained after close\n", name, (unsigned long)i);
+            bad++;
+        }
+    }
+    if (spsc_ring_pop(ring, &item, -1) != -1 || spsc_ring_pop(ring, &item, 1000) != -1)
+    {
+        printf("%s: pop on a closed empty ring did not return -1\n", name);
+        bad++;
+    }
+    spsc_ring_destroy(ring);
+
+    // the consumer is already asleep when the ring is closed
+    ring = spsc_ring_create(4, policy);
+    if (ring == NULL)
+    {
+        printf("out of memory\n");
+        return -1;
+    }
+    pthread_t closer;
+    if (pthread_create(&closer, NULL, close_main, ring) != 0)
+    {
+        printf("pthread_create fail!\n");
+        spsc_ring_destroy(ring);
+        return -1;
+    }
+    if (spsc_ring_pop(ring, &item, -1) != -1)
+    {
+        printf("%s: waiting pop not woken by close\n", name);
+        bad++;
+    }
+    pthread_join(closer, NULL);
+    spsc_ring_destroy(ring);
+
+    printf("%s close:%s\n", name, bad ? " FAIL" : " ok");
+    return bad ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        printf("Usage: %s [items]\n", argv[0]);
+        return -1;
+    }
+    uintptr_t n_items = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    static const int capacities[] = {1, 2, 4, 16};
+    int failed = 0;
+
+    for (int p = 0; p < 2; p++)
+    {
+        spsc_ring_policy_t policy = p == 0 ? SPSC_RING_BLOCK : SPSC_RING_DROP_OLDEST;
+        for (size_t i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++)
+        {
+            failed |= run_stress(policy, capacities[i], n_items) != 0;
+        }
+        failed |= run_close(policy) != 0;
+    }
+    printf(failed ? "spsc_ring test FAILED\n" : "spsc_ring test passed\n");
+    return failed ? -1 : 0;
+}
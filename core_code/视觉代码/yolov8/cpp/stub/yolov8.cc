@@ -0,0 +1,94 @@
+// Stand-in for the NPU backends on hosts without one (cmake -DNPU_STUB=ON).
+// No rknn calls: each inference sleeps for the time one NPU core takes and
+// reports a single box tagged with the first bytes of the input frame, which
+// is enough to check the scheduling and ordering of npu_pool on x86.
+// NPU_STUB_BATCH > 1 stands in for a batch model: a run costs NPU_STUB_RUN_US
+// plus NPU_STUB_BATCH_IMAGE_US per further input slot, used or not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "yolov8.h"
+
+#ifndef NPU_STUB_RUN_US
+#define NPU_STUB_RUN_US 25000
+#endif
+#ifndef NPU_STUB_BATCH
+#define NPU_STUB_BATCH 1
+#endif
+#ifndef NPU_STUB_BATCH_IMAGE_US
+#define NPU_STUB_BATCH_IMAGE_US 15000
+#endif
+
+int init_yolov8_model(const char *model_path, rknn_app_context_t *app_ctx)
+{
+    printf("stub npu: %s ignored, %d us per frame\n", model_path, NPU_STUB_RUN_US);
+    app_ctx->io_num.n_input = 1;
+    app_ctx->io_num.n_output = 0;
+    app_ctx->model_width = 640;
+    app_ctx->model_height = 640;
+    app_ctx->model_channel = 3;
+    app_ctx->batch = NPU_STUB_BATCH;
+    app_ctx->is_quant = true;
+    return 0;
+}
+
+int dup_yolov8_model(rknn_app_context_t *src_ctx, rknn_app_context_t *app_ctx)
+{
+    app_ctx->io_num = src_ctx->io_num;
+    app_ctx->model_width = src_ctx->model_width;
+    app_ctx->model_height = src_ctx->model_height;
+    app_ctx->model_channel = src_ctx->model_channel;
+    app_ctx->batch = src_ctx->batch;
+    app_ctx->is_quant = src_ctx->is_quant;
+    return 0;
+}
+
+int set_yolov8_npu_core(rknn_app_context_t *app_ctx, int core)
+{
+    return 0;
+}
+
+int release_yolov8_model(rknn_app_context_t *app_ctx)
+{
+    return 0;
+}
+
+static void stub_result(image_buffer_t *img, object_detect_result_list *od_results)
+{
+    memset(od_results, 0x00, sizeof(*od_results));
+    int32_t tag = 0;
+    if (img->virt_addr != NULL)
+    {
+        memcpy(&tag, img->virt_addr, sizeof(tag));
+    }
+    od_results->count = 1;
+    od_results->results[0].box.left = tag;
+    od_results->results[0].box.top = 0;
+    od_results->results[0].box.right = img->width;
+    od_results->results[0].box.bottom = img->height;
+    od_results->results[0].prop = 1.0f;
+    od_results->results[0].cls_id = 0;
+}
+
+int inference_yolov8_model(rknn_app_context_t *app_ctx, image_buffer_t *img, object_detect_result_list *od_results)
+{
+    return inference_yolov8_batch(app_ctx, &img, 1, &od_results);
+}
+
+int inference_yolov8_batch(rknn_app_context_t *app_ctx, image_buffer_t **imgs, int n,
+                           object_detect_result_list **od_results)
+{
+    if ((!app_ctx) || !(imgs) || (!od_results) || n < 1 || n > app_ctx->batch)
+    {
+        return -1;
+    }
+    usleep(NPU_STUB_RUN_US + (app_ctx->batch - 1) * NPU_STUB_BATCH_IMAGE_US);
+    for (int i = 0; i < n; i++)
+    {
+        stub_result(imgs[i], od_results[i]);
+    }
+    return 0;
+}
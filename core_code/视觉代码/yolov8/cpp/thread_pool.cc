@@ -0,0 +1,137 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct thread_pool
+{
+    pthread_t *threads;
+    int n_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    // current job, only changed by thread_pool_run once every task is done
+    thread_pool_task_fn fn;
+    void *arg;
+    int n_tasks;
+    int next_task;
+    int done_tasks;
+    bool stop;
+};
+
+// Take and run tasks of the current job until none are left, lock held on
+// entry and exit.
+static void run_tasks_locked(thread_pool_t *pool)
+{
+    while (pool->next_task < pool->n_tasks)
+    {
+        int task = pool->next_task++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->fn(pool->arg, task);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->done_tasks == pool->n_tasks)
+        {
+            pthread_cond_signal(&pool->done_cond);
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    thread_pool_t *pool = (thread_pool_t *)arg;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop)
+    {
+        if (pool->next_task < pool->n_tasks)
+        {
+            run_tasks_locked(pool);
+        }
+        else
+        {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+thread_pool_t *thread_pool_create(int n_threads)
+{
+    thread_pool_t *pool = (thread_pool_t *)calloc(1, sizeof(thread_pool_t));
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+    pool->threads = (pthread_t *)calloc(n_threads > 0 ? n_threads : 1, sizeof(pthread_t));
+    if (pool->threads == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0)
+        {
+            printf("thread_pool: pthread_create fail, %d of %d workers\n", i, n_threads);
+            break;
+        }
+        pool->n_threads++;
+    }
+    return pool;
+}
+
+void thread_pool_destroy(thread_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->n_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int thread_pool_size(thread_pool_t *pool) { return pool != NULL ? pool->n_threads : 0; }
+
+void thread_pool_run(thread_pool_t *pool, thread_pool_task_fn fn, void *arg, int n_tasks)
+{
+    if (pool == NULL || pool->n_threads == 0 || n_tasks <= 1)
+    {
+        for (int t = 0; t < n_tasks; t++)
+        {
+            fn(arg, t);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n_tasks = n_tasks;
+    pool->next_task = 0;
+    pool->done_tasks = 0;
+    pthread_cond_broadcast(&pool->work_cond);
+
+    // the caller works too instead of just waiting
+    run_tasks_locked(pool);
+    while (pool->done_tasks < pool->n_tasks)
+    {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,20 @@
+#ifndef _RKNN_YOLOV8_DEMO_THREAD_POOL_H_
+#define _RKNN_YOLOV8_DEMO_THREAD_POOL_H_
+
+// Small persistent pool for fork/join work inside one frame. Workers are
+// created once and sleep between jobs, running a job does not allocate.
+typedef struct thread_pool thread_pool_t;
+
+typedef void (*thread_pool_task_fn)(void *arg, int task);
+
+thread_pool_t *thread_pool_create(int n_threads);
+void thread_pool_destroy(thread_pool_t *pool);
+
+// Worker threads, not counting the caller of thread_pool_run.
+int thread_pool_size(thread_pool_t *pool);
+
+// Call fn(arg, t) for t in [0, n_tasks) on the workers and the calling
+// thread, returns once every task has finished. Not reentrant.
+void thread_pool_run(thread_pool_t *pool, thread_pool_task_fn fn, void *arg, int n_tasks);
+
+#endif //_RKNN_YOLOV8_DEMO_THREAD_POOL_H_
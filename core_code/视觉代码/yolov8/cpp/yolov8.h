@@ -18,6 +18,12 @@
 
 #include "rknn_api.h"
 #include "common.h"
+#include "nms.h"
+#include "thread_pool.h"
+#include "preprocess.h"
+
+// Images per run of a batch-N model (dims[0] of the input), at most
+#define YOLOV8_MAX_BATCH 8
 
 #if defined(RV1106_1103) 
     typedef struct {
@@ -27,6 +33,26 @@
     }rknn_dma_buf;
 #endif
 
+// Stage times of the last post_process call
+typedef struct {
+    int64_t decode_ns;
+    int64_t select_ns;    // top-K selection and score sort
+    int64_t nms_ns;
+} post_process_timing_t;
+
+// Scratch memory of post_process, sized once from the output shapes by
+// init_post_process_workspace so a steady state frame never hits the heap.
+typedef struct {
+    int capacity;         // one candidate per grid cell over all branches
+    float *boxes;         // capacity * 4, x/y/w/h in model input pixels
+    float *obj_probs;
+    int *class_id;
+    int *index;           // score order after top-K selection
+    nms_workspace_t nms;  // min(capacity, MAX_CANDIDATES) boxes
+    thread_pool_t *pool;  // branch decode workers, see POST_PROCESS_THREADS
+    post_process_timing_t timing;
+} post_process_workspace_t;
+
 typedef struct {
     rknn_context rknn_ctx;
     rknn_input_output_num io_num;
@@ -42,11 +68,28 @@ typedef struct {
     rknn_tensor_mem* output_mems[9];
     rknn_tensor_attr* input_native_attrs;
     rknn_tensor_attr* output_native_attrs;
+    struct yolov8_async* async; // second io set of submit_yolov8_frame, NULL until used
+#endif
+#if !defined(RV1106_1103) && !defined(ZERO_COPY)
+    // created by init_yolov8_model, reused every frame
+    image_buffer_t input_img;   // letterbox destination of image 0, inputs[0].buf
+    letterbox_cache_t* slot_caches; // images 1 .. batch-1 of a batch model
+    rknn_input* inputs;
+    rknn_output* outputs;       // is_prealloc buffers
 #endif
     int model_channel;
     int model_width;
     int model_height;
+    int batch;                  // images per run, 1 but on batch-N models (rknpu2 copy backend)
     bool is_quant;
+    // exp() of every quantized box value, one table per branch (init_dfl_exp_lut)
+    float dfl_exp_lut[3][256];
+#if defined(RV1106_1103)
+    uint32_t dfl_exp_lut_q16[3][256]; // exp(-d * scale) in Q16, d = max bin - bin
+#endif
+    letterbox_cache_t letterbox_cache; // geometry of the last camera resolution
+    post_process_workspace_t pp_workspace;
+    struct output_capture *capture; // records post_process inputs when set, see capture.h
 } rknn_app_context_t;
 
 #include "postprocess.h"
@@ -54,8 +97,39 @@ typedef struct {
 
 int init_yolov8_model(const char* model_path, rknn_app_context_t* app_ctx);
 
+// Another context on the weights of src_ctx (rknn_dup_context), -1 where unsupported
+int dup_yolov8_model(rknn_app_context_t* src_ctx, rknn_app_context_t* app_ctx);
+
+// Run the context on NPU core `core` (0, 1, 2), -1 for the driver's choice
+int set_yolov8_npu_core(rknn_app_context_t* app_ctx, int core);
+
 int release_yolov8_model(rknn_app_context_t* app_ctx);
 
 int inference_yolov8_model(rknn_app_context_t* app_ctx, image_buffer_t* img, object_detect_result_list* od_results);
 
+// imgs[0..n) in one run of a batch model, n <= app_ctx->batch, the results
+// go to od_results[i]. Input slots past n hold stale images whose results are
+// dropped. Backends without batch models only take n == 1.
+int inference_yolov8_batch(rknn_app_context_t* app_ctx, image_buffer_t** imgs, int n,
+                           object_detect_result_list** od_results);
+
+#if defined(ZERO_COPY)
+typedef struct yolov8_async yolov8_async_t;
+
+// Double-buffered inference on one context with two input/output memory
+// sets: submit_yolov8_frame letterboxes into the free set and starts rknn_run
+// without waiting, poll_yolov8_result post-processes the oldest frame. Frame
+// N+1 is prepared and frame N-1 post-processed while the NPU runs frame N.
+// Single caller thread; don't call inference_yolov8_model with frames
+// outstanding.
+
+// 0 when started, 1 if both sets are outstanding (poll first), -1 on error
+int submit_yolov8_frame(rknn_app_context_t* app_ctx, image_buffer_t* img, void* user);
+
+// Oldest frame in submit order, user as passed to submit; blocks while it is
+// still running. 0 with a result, -1 when nothing is outstanding or its
+// outputs can't be post-processed, -2 if its run failed.
+int poll_yolov8_result(rknn_app_context_t* app_ctx, object_detect_result_list* od_results, void** user);
+#endif
+
 #endif //_RKNN_DEMO_YOLOV8_H_
\ No newline at end of file